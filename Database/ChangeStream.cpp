@@ -0,0 +1,74 @@
+#include "pch.h"
+#include "ChangeStream.h"
+#include "TableScanner.h"
+
+namespace DatabaseLib
+{
+	ChangeStream::ChangeStream(Storage& storage, std::string fileName)
+		: storage(storage), fileName(std::move(fileName))
+	{
+		TableScanner scanner(this->storage, this->fileName);
+		std::vector<ScannedRow> rows;
+		while (scanner.nextBatch(rows))
+		{
+			for (auto& row : rows)
+			{
+				if (!row.line.empty())
+				{
+					lastSequence = json::parse(row.line.begin(), row.line.end())["sequence"];
+					readSequence = lastSequence;
+					readPosition = row.position + row.line.size() + 1;
+				}
+			}
+		}
+	}
+
+	void ChangeStream::append(const json& event)
+	{
+		std::lock_guard lock(mutex);
+		std::string line = event.dump();
+		line.push_back('\n');
+		storage.append(fileName, line);
+		lastSequence = event["sequence"];
+	}
+
+	json ChangeStream::read(std::uint64_t afterSequence, unsigned limit)
+	{
+		std::lock_guard lock(mutex);
+		Offset position = 0;
+		if (afterSequence >= readSequence)
+		{
+			position = readPosition;
+		}
+
+		// A line without its newline yet is still being written by the leader.
+		Offset length = storage.size(fileName);
+		json events = json::array();
+		while (events.size() < limit)
+		{
+			std::string line = storage.readLine(fileName, position);
+			Offset next = position + line.size() + 1;
+			if (line.empty() || next > length)
+			{
+				break;
+			}
+			json event = json::parse(line);
+			std::uint64_t sequence = event["sequence"];
+			position = next;
+			if (sequence <= afterSequence)
+			{
+				continue;
+			}
+			readSequence = sequence;
+			readPosition = position;
+			events.push_back(std::move(event));
+		}
+		return events;
+	}
+
+	std::uint64_t ChangeStream::getLastSequence()
+	{
+		std::lock_guard lock(mutex);
+		return lastSequence;
+	}
+}
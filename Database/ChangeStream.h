@@ -0,0 +1,35 @@
+#pragma once
+#include <map>
+#include <vector>
+#include "DatabaseLib.h"
+#include "JsonComparator.h"
+#include "Cursor.h"
+#include "Storage.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace DatabaseLib
+{
+	// Ordered log of changes, one JSON event per line, each carrying a
+	// "sequence" number one above the previous event's. The file may be read
+	// by another Database, or another process, while it is being appended to.
+	class DATABASE_API ChangeStream
+	{
+	private:
+		Storage& storage;
+		std::string fileName;
+		std::mutex mutex;
+		std::uint64_t lastSequence = 0;
+		// Where the last read stopped, so a tailing reader does not rescan the file.
+		std::uint64_t readSequence = 0;
+		Offset readPosition = 0;
+	public:
+		ChangeStream(Storage& storage, std::string fileName);
+
+		void append(const json& event);
+		// Returns up to limit events with sequence numbers above afterSequence.
+		json read(std::uint64_t afterSequence, unsigned limit);
+		std::uint64_t getLastSequence();
+	};
+}
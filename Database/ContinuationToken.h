@@ -0,0 +1,83 @@
+#pragma once
+#include "JsonComparator.h"
+#include "DatabaseException.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace DatabaseLib
+{
+	// Position of the next row of a paged scan: the key value and the position
+	// in its offsets list. Tokens are the MessagePack encoding of
+	// [keyName, keyValue, offsetIndex] in unpadded base64url.
+	struct ContinuationToken
+	{
+		std::string keyName;
+		json keyValue;
+		size_t offsetIndex = 0;
+
+		std::string encode() const
+		{
+			static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+			std::vector<std::uint8_t> bytes = json::to_msgpack(json::array({ keyName, keyValue, offsetIndex }));
+			std::string token;
+			token.reserve((bytes.size() * 4 + 2) / 3);
+			for (size_t i = 0; i < bytes.size(); i += 3)
+			{
+				std::uint32_t chunk = (std::uint32_t)bytes[i] << 16;
+				size_t available = std::min<size_t>(3, bytes.size() - i);
+				if (available > 1)
+				{
+					chunk |= (std::uint32_t)bytes[i + 1] << 8;
+				}
+				if (available > 2)
+				{
+					chunk |= bytes[i + 2];
+				}
+				for (size_t j = 0; j <= available; j++)
+				{
+					token.push_back(alphabet[(chunk >> (18 - 6 * j)) & 0x3f]);
+				}
+			}
+			return token;
+		}
+
+		static ContinuationToken decode(const std::string& token)
+		{
+			std::vector<std::uint8_t> bytes;
+			bytes.reserve(token.size() * 3 / 4);
+			std::uint32_t chunk = 0;
+			unsigned bits = 0;
+			for (char symbol : token)
+			{
+				int value = symbol >= 'A' && symbol <= 'Z' ? symbol - 'A'
+					: symbol >= 'a' && symbol <= 'z' ? symbol - 'a' + 26
+					: symbol >= '0' && symbol <= '9' ? symbol - '0' + 52
+					: symbol == '-' ? 62 : symbol == '_' ? 63 : -1;
+				if (value < 0)
+				{
+					throw DatabaseException("Invalid continuation token", ErrorCode::INVALID_CONTINUATION_TOKEN);
+				}
+				chunk = (chunk << 6) | (std::uint32_t)value;
+				bits += 6;
+				if (bits >= 8)
+				{
+					bits -= 8;
+					bytes.push_back((std::uint8_t)(chunk >> bits));
+				}
+			}
+
+			json decoded = json::from_msgpack(bytes, true, false);
+			if (!decoded.is_array() || decoded.size() != 3 || !decoded[0].is_string() || !decoded[2].is_number_unsigned())
+			{
+				throw DatabaseException("Invalid continuation token", ErrorCode::INVALID_CONTINUATION_TOKEN);
+			}
+			ContinuationToken position;
+			position.keyName = decoded[0].get<std::string>();
+			position.keyValue = decoded[1];
+			position.offsetIndex = decoded[2].get<size_t>();
+			return position;
+		}
+	};
+}
@@ -2,7 +2,9 @@
 
 namespace DatabaseLib
 {
-	using Indexes = std::map<json, std::vector<unsigned>, JsonComparator>;
+	using Offset = std::uint64_t;
+	using Indexes = std::map<json, std::vector<Offset>, JsonComparator>;
+	using IncludedValues = std::map<json, std::vector<json>, JsonComparator>;
 	struct Cursor
 	{
 		Indexes::iterator currentRow;
@@ -17,4 +19,20 @@ namespace DatabaseLib
 
 		Cursor() {}
 	};
+
+	using CursorId = unsigned;
+
+	// Cursor opened by openCursor or splitScan. Its position is kept as a key
+	// value rather than an iterator, so rows removed between fetches are
+	// skipped instead of invalidating it.
+	struct ScanCursor
+	{
+		std::string tableName;
+		std::string keyName;
+		bool isStarted = false;
+		json currentKey;
+		size_t offsetIndex = 0;
+		json lowerBound;
+		json upperBound;
+	};
 }
\ No newline at end of file
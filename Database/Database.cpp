@@ -1,364 +1,3245 @@
 #include "pch.h"
 #include "Database.h"
-#include <fstream>
 #include <sstream>
 #include <mutex>
+#include <algorithm>
+#include <unordered_set>
+#include <iterator>
+#include <future>
+#include <thread>
 
 namespace DatabaseLib
 {
+	Database::Database()
+		: Database(std::make_shared<FileStorage>())
+	{}
+
+	Database::Database(bool isWarmedUp)
+		: Database(std::make_shared<FileStorage>(), isWarmedUp)
+	{}
+
+	Database::Database(std::shared_ptr<Storage> storage, bool isWarmedUp)
+		: storage(std::move(storage))
+	{
+		loadCatalog();
+		json replica = readJsonFromFile(REPLICA_FILE);
+		if (replica.is_object())
+		{
+			appliedSequence = replica.value("sequence", (std::uint64_t)0);
+			applyingChange = replica.value("applying", json());
+		}
+		if (!isWarmedUp)
+		{
+			return;
+		}
+		std::vector<std::future<void>> loads;
+		for (auto table : catalog.items())
+		{
+			for (auto key : table.value()["keys"].items())
+			{
+				loads.push_back(std::async(std::launch::async, &Database::warmIndex, this, table.key(), key.key()));
+			}
+		}
+		for (auto& load : loads)
+		{
+			load.get();
+		}
+	}
+
+	Database::~Database()
+	{
+		disableExpiryReaper();
+		disableMaintenance();
+	}
+
 	Connection Database::connect()
 	{
-		Connection connection = Connection();
-		connections[connection.getConnectionId()];
-		return connection;
+		OperationTimer timer(stats, Operation::CONNECT);
+		std::unique_lock lock(mutex_);
+		Connection connection = Connection();
+		connections[connection.getConnectionId()];
+		return connection;
+	}
+
+	void Database::disconnect(Connection connection)
+	{
+		OperationTimer timer(stats, Operation::DISCONNECT);
+		std::unique_lock lock(mutex_);
+		if (!connections.erase(connection.getConnectionId()))
+		{
+			throw DatabaseException("You havent't been connected", ErrorCode::NO_CONNECTION);
+		}
+		openCursors.erase(connection.getConnectionId());
+	}
+
+	void Database::createTable(const std::string& tableName, const json& keysJson, Connection connection)
+	{
+		createTable(tableName, keysJson, json::object(), connection);
+	}
+
+	void Database::createTable(const std::string& tableName, const json& keysJson, const json& options,
+		Connection connection)
+	{
+		OperationTimer timer(stats, Operation::CREATE_TABLE, tableName);
+		std::unique_lock lock(mutex_);
+		ensureIsConnected(connection);
+		if (options.contains("clusterKey") && !keysJson.contains(options["clusterKey"].get<std::string>()))
+		{
+			throw DatabaseException("Key not found: " + options["clusterKey"].get<std::string>(), ErrorCode::KEY_NOT_FOUND);
+		}
+		if (options.contains("engine") && options["engine"] != "file" && options["engine"] != "log")
+		{
+			throw DatabaseException("Unknown storage engine: " + options["engine"].dump(), ErrorCode::INVALID_OPTIONS);
+		}
+		if (options.contains("include"))
+		{
+			for (auto key : options["include"].items())
+			{
+				if (!keysJson.contains(key.key()))
+				{
+					throw DatabaseException("Key not found: " + key.key(), ErrorCode::KEY_NOT_FOUND);
+				}
+			}
+		}
+		if (options.contains("partitioning"))
+		{
+			unsigned partitionCount = getPartitionCount({ {"options", options} });
+			if (!options["partitioning"].contains("column") || partitionCount == 0 || partitionCount > MAX_PARTITIONS)
+			{
+				throw DatabaseException("Invalid partitioning: " + options["partitioning"].dump(), ErrorCode::INVALID_OPTIONS);
+			}
+		}
+		if (options.contains("ttl"))
+		{
+			const json& ttl = options["ttl"];
+			if (!ttl.is_object() || (ttl.contains("column") && !ttl["column"].is_string())
+				|| (ttl.contains("seconds") && (!ttl["seconds"].is_number() || ttl["seconds"] <= 0)))
+			{
+				throw DatabaseException("Invalid ttl: " + ttl.dump(), ErrorCode::INVALID_OPTIONS);
+			}
+		}
+		catalog[tableName]["keys"] = keysJson;
+		if (!options.empty())
+		{
+			catalog[tableName]["options"] = options;
+		}
+
+		for (auto key : keysJson.items())
+		{
+			storage->write(tableName + "_" + key.key() + JSON_EXT, json::array().dump());
+		}
+
+		tablesColumns.erase(tableName);
+		tablesIncludedValues.erase(tableName);
+		if (options.value("compressed", false))
+		{
+			storage->write(tableName + COLUMNS_EXT, json::array().dump());
+		}
+
+		saveCatalog();
+		if (isRecordingChanges())
+		{
+			recordChange({ {"operation", "createTable"}, {"table", tableName}, {"keys", keysJson}, {"options", options} });
+		}
+	}
+
+	void Database::removeTable(const std::string& tableName, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::REMOVE_TABLE, tableName);
+		std::unique_lock lock(mutex_);
+		ensureIsConnected(connection);
+		ensureTableExists(tableName, catalog);
+
+		json keysJson = catalog[tableName]["keys"];
+		for (auto key : keysJson.items())
+		{
+			storage->remove(tableName + "_" + key.key() + JSON_EXT);
+			storage->remove(tableName + "_" + key.key() + LOG_EXT);
+			indexDumps[tableName][key.key()]++;
+		}
+		unsigned partitionCount = getPartitionCount(catalog[tableName]);
+		for (unsigned partition = 0; partition < partitionCount; partition++)
+		{
+			storage->remove(getTableFileName(tableName, partition));
+		}
+
+		catalog.erase(tableName);
+		saveCatalog();
+
+		tablesIndexes.erase(tableName);
+		indexLogSizes.erase(tableName);
+		indexRowCounts.erase(tableName);
+		deletedRows.erase(tableName);
+		tablesColumns.erase(tableName);
+		tablesIncludedValues.erase(tableName);
+		tableRewrites[tableName]++;
+		storage->remove(tableName + DEL_EXT);
+		storage->remove(tableName + COLUMNS_EXT);
+		if (isRecordingChanges())
+		{
+			recordChange({ {"operation", "removeTable"}, {"table", tableName} });
+		}
+	}
+
+	void Database::addKey(const std::string& tableName, const json& keysJson, Connection connection)
+	{
+		addKey(tableName, keysJson, json::array(), connection);
+	}
+
+	void Database::addKey(const std::string& tableName, const json& keysJson, const json& includedColumns,
+		Connection connection)
+	{
+		OperationTimer timer(stats, Operation::ADD_KEY, tableName);
+		std::unique_lock lock(mutex_);
+		ensureIsConnected(connection);
+		json tablesMeta = catalog;
+		auto newKey = keysJson.items().begin();
+		std::string keyName = newKey.key();
+		tablesMeta[tableName]["keys"][keyName] = newKey.value();
+		if (!includedColumns.empty())
+		{
+			tablesMeta[tableName]["options"]["include"][keyName] = includedColumns;
+		}
+
+		loadDeletedRows(tableName);
+		loadColumns(tableName);
+		auto& deleted = deletedRows[tableName];
+
+		std::vector<std::string> keyColumns = newKey.value();
+		std::vector<std::string> columns = keyColumns;
+		for (std::string column : includedColumns)
+		{
+			columns.push_back(column);
+		}
+
+		// Partitions are independent files, so they are scanned in parallel
+		// and merged into the index afterwards.
+		std::vector<std::future<std::vector<std::pair<json, Offset>>>> scans;
+		unsigned partitionCount = getPartitionCount(tablesMeta[tableName]);
+		for (unsigned partition = 0; partition < partitionCount; partition++)
+		{
+			scans.push_back(std::async(std::launch::async, [this, tableName, partition, columns, &deleted]()
+			{
+				std::vector<std::pair<json, Offset>> keys;
+				TableScanner scanner(*storage, getTableFileName(tableName, partition), &stats);
+				std::vector<ScannedRow> rows;
+				while (scanner.nextBatch(rows))
+				{
+					for (auto& row : rows)
+					{
+						Offset location = toLocation(partition, row.position);
+						if (deleted.find(location) == deleted.end())
+						{
+							keys.emplace_back(extractKey(tableName, row.line, columns), location);
+						}
+					}
+				}
+				return keys;
+			}));
+		}
+
+		tablesIndexes[tableName][keyName].clear();
+		tablesIncludedValues[tableName].erase(keyName);
+		indexRowCounts[tableName][keyName] = 0;
+		for (auto& scan : scans)
+		{
+			for (auto& [fields, location] : scan.get())
+			{
+				json key = json::object();
+				for (auto& keyColumn : keyColumns)
+				{
+					key[keyColumn] = fields[keyColumn];
+				}
+				json included;
+				for (std::string column : includedColumns)
+				{
+					included[column] = fields[column];
+				}
+				insertIntoIndex(tablesIndexes[tableName][keyName], tablesIncludedValues[tableName][keyName],
+					key, location, included);
+				indexRowCounts[tableName][keyName]++;
+			}
+		}
+
+		dumpIndex(tableName, keyName);
+
+		catalog = std::move(tablesMeta);
+		saveCatalog();
+		if (isRecordingChanges())
+		{
+			recordChange({ {"operation", "addKey"}, {"table", tableName}, {"keys", keysJson},
+				{"included", includedColumns} });
+		}
+	}
+
+	void Database::removeKey(const std::string& tableName, const std::string& keyName, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::REMOVE_KEY, tableName);
+		timer.setKey(keyName);
+		std::unique_lock lock(mutex_);
+		ensureIsConnected(connection);
+		json& tableMeta = catalog[tableName];
+		tableMeta["keys"].erase(keyName);
+		if (tableMeta.contains("options") && tableMeta["options"].contains("include"))
+		{
+			tableMeta["options"]["include"].erase(keyName);
+		}
+		saveCatalog();
+
+		tablesIndexes[tableName].erase(keyName);
+		indexLogSizes[tableName].erase(keyName);
+		indexRowCounts[tableName].erase(keyName);
+		tablesIncludedValues[tableName].erase(keyName);
+
+		storage->remove(tableName + "_" + keyName + JSON_EXT);
+		storage->remove(tableName + "_" + keyName + LOG_EXT);
+		indexDumps[tableName][keyName]++;
+		if (isRecordingChanges())
+		{
+			recordChange({ {"operation", "removeKey"}, {"table", tableName}, {"key", keyName} });
+		}
+	}
+
+	void Database::reorganizeTable(const std::string& tableName, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::REORGANIZE_TABLE, tableName);
+		std::unique_lock lock(mutex_);
+		ensureIsConnected(connection);
+		ensureTableExists(tableName, catalog);
+
+		rewriteTable(tableName, catalog);
+		saveCatalog();
+	}
+
+	void Database::checkpoint(const std::string& directory, Offset bytesPerSecond, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::CHECKPOINT);
+		ensureIsConnected(connection);
+		storage->createDirectory(directory);
+		json tablesMeta;
+		{
+			std::shared_lock lock(mutex_);
+			tablesMeta = catalog;
+		}
+
+		// Every table is captured at its own point in time: indexes, deleted rows
+		// and data file lengths are taken under the lock, then the data files are
+		// copied up to those lengths while writers keep appending. A rewrite of the
+		// table restarts its copy; the last attempt holds the lock throughout.
+		json checkpointMeta = json::object();
+		auto started = std::chrono::steady_clock::now();
+		Offset copied = 0;
+		for (auto table : tablesMeta.items())
+		{
+			std::string tableName = table.key();
+			for (unsigned attempt = 1; attempt <= CHECKPOINT_MAX_ATTEMPTS; attempt++)
+			{
+				std::unique_lock lock(mutex_);
+				if (!catalog.contains(tableName))
+				{
+					break;
+				}
+				json tableMeta = catalog[tableName];
+				loadColumns(tableName);
+				for (auto key : tableMeta["keys"].items())
+				{
+					loadIndex(tableName, key.key());
+					writeIndex(tableName, key.key(), directory + "/" + tableName + "_" + key.key() + JSON_EXT);
+				}
+				if (!tablesColumns[tableName].is_null())
+				{
+					storage->write(directory + "/" + tableName + COLUMNS_EXT, tablesColumns[tableName].dump());
+				}
+				loadDeletedRows(tableName);
+				writeDeletedRows(tableName, directory + "/" + tableName + DEL_EXT);
+				std::vector<Offset> lengths;
+				unsigned partitionCount = getPartitionCount(tableMeta);
+				for (unsigned partition = 0; partition < partitionCount; partition++)
+				{
+					lengths.push_back(storage->size(getTableFileName(tableName, partition)));
+				}
+				unsigned generation = getContentGeneration(tableName);
+
+				bool isLastAttempt = attempt == CHECKPOINT_MAX_ATTEMPTS;
+				if (!isLastAttempt)
+				{
+					lock.unlock();
+				}
+				if (copyTableFiles(tableName, lengths, directory, generation, isLastAttempt,
+					bytesPerSecond, started, copied))
+				{
+					checkpointMeta[tableName] = tableMeta;
+					break;
+				}
+			}
+		}
+
+		storage->write(directory + "/" + META_FILE, checkpointMeta.dump());
+	}
+
+	json Database::getRowByKey(const std::string& tableName, const json& keyJson, Connection connection)
+	{
+		return getRowByKey(tableName, keyJson, json::array(), connection);
+	}
+
+	json Database::getRowByKey(const std::string& tableName, const json& keyJson, const json& projection,
+		Connection connection)
+	{
+		OperationTimer timer(stats, Operation::GET_ROW_BY_KEY, tableName);
+		ensureIsConnected(connection);
+		auto properties = keyJson.items().begin();
+		std::string keyName = properties.key();
+		timer.setKey(keyName);
+		warmIndex(tableName, keyName);
+
+		std::shared_lock lock(mutex_);
+
+		auto row = tablesIndexes[tableName][keyName].find(properties.value());
+		auto end = tablesIndexes[tableName][keyName].end();
+		if (row == end)
+		{
+			throw DatabaseException("Key value not found", ErrorCode::KEY_VALUE_NOT_FOUND);
+		}
+
+		std::string expiryColumn = getExpiryColumn(tableName);
+		std::vector<std::string> coveringColumns;
+		if (projection.is_array() && !projection.empty())
+		{
+			coveringColumns = projection.get<std::vector<std::string>>();
+			if (!expiryColumn.empty())
+			{
+				coveringColumns.push_back(expiryColumn);
+			}
+		}
+		for (size_t offsetIndex = 0; offsetIndex < row->second.size(); offsetIndex++)
+		{
+			json found = coveringColumns.empty() ? json() : readCoveredRow(tableName, keyName, row, offsetIndex, coveringColumns);
+			if (found.is_null())
+			{
+				found = readDataByOffset(tableName, row->second[offsetIndex]);
+			}
+			if (!isExpired(expiryColumn, found))
+			{
+				Cursor currentRow(row, end, (int)offsetIndex, keyName);
+				connections[connection.getConnectionId()][tableName] = currentRow;
+				return projectRow(found, projection);
+			}
+		}
+		throw DatabaseException("Key value not found", ErrorCode::KEY_VALUE_NOT_FOUND);
+	}
+
+	json Database::getRowInSortedTable(const std::string& tableName, const std::string& keyName, 
+		bool isReversed, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::GET_ROW_IN_SORTED_TABLE, tableName);
+		timer.setKey(keyName);
+		ensureIsConnected(connection);
+		warmIndex(tableName, keyName);
+		std::shared_lock lock(mutex_);
+
+		Indexes::iterator row;
+		int offsetIndex;
+
+		if (isReversed)
+		{
+			row = --tablesIndexes[tableName][keyName].end();
+			ensureTableIsNotEmpty(row, tablesIndexes[tableName][keyName].end());
+			offsetIndex = row->second.size() - 1;
+		}
+		else 
+		{
+			row = tablesIndexes[tableName][keyName].begin();
+			ensureTableIsNotEmpty(row, tablesIndexes[tableName][keyName].end());
+			offsetIndex = 0;
+		}
+		Offset offset = row->second[offsetIndex];
+
+		Cursor currentRow(row, tablesIndexes[tableName][keyName].end(), offsetIndex, keyName);
+		connections[connection.getConnectionId()][tableName] = currentRow;
+
+		// A table whose rows have all expired is as empty as one without rows.
+		try
+		{
+			return skipExpiredRows(tableName, offset, !isReversed, connection);
+		}
+		catch (const DatabaseException& ex)
+		{
+			if (ex.getErrorNumber() != ErrorCode::NO_MORE_DATA_AVAILABLE)
+			{
+				throw;
+			}
+			throw DatabaseException("Table is empty", ErrorCode::TABLE_IS_EMPTY);
+		}
+	}
+
+	json Database::getNextRow(const std::string& tableName, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::GET_NEXT_ROW, tableName);
+		std::shared_lock lock(mutex_);
+		Offset offset = shiftCursorForward(tableName, connection);
+
+		return skipExpiredRows(tableName, offset, true, connection);
+	}
+
+	json Database::getPrevRow(const std::string& tableName, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::GET_PREV_ROW, tableName);
+		std::shared_lock lock(mutex_);
+		Offset offset = shiftCursorBack(tableName, connection);
+
+		return skipExpiredRows(tableName, offset, false, connection);
+	}
+
+	CursorId Database::openCursor(const std::string& tableName, const std::string& keyName, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::OPEN_CURSOR, tableName);
+		timer.setKey(keyName);
+		ensureIsConnected(connection);
+		warmIndex(tableName, keyName);
+		std::unique_lock lock(mutex_);
+		getLoadedIndex(tableName, keyName);
+		return addScanCursor(tableName, keyName, json(), json(), connection);
+	}
+
+	std::vector<CursorId> Database::splitScan(const std::string& tableName, const std::string& keyName, unsigned parts,
+		Connection connection)
+	{
+		OperationTimer timer(stats, Operation::SPLIT_SCAN, tableName);
+		timer.setKey(keyName);
+		ensureIsConnected(connection);
+		warmIndex(tableName, keyName);
+		std::unique_lock lock(mutex_);
+		Indexes& index = getLoadedIndex(tableName, keyName);
+
+		// Parts are cut at key values, so rows sharing a key value never span two
+		// cursors; with few distinct keys fewer than the requested parts are returned.
+		Offset rowCount = indexRowCounts[tableName][keyName];
+		std::vector<json> bounds;
+		Offset seen = 0;
+		for (auto& entry : index)
+		{
+			if (bounds.size() + 1 < parts && seen >= rowCount * (bounds.size() + 1) / parts && seen > 0)
+			{
+				bounds.push_back(entry.first);
+			}
+			seen += entry.second.size();
+		}
+
+		std::vector<CursorId> cursorIds;
+		json lowerBound;
+		for (auto& bound : bounds)
+		{
+			cursorIds.push_back(addScanCursor(tableName, keyName, lowerBound, bound, connection));
+			lowerBound = bound;
+		}
+		cursorIds.push_back(addScanCursor(tableName, keyName, lowerBound, json(), connection));
+		return cursorIds;
+	}
+
+	json Database::fetchRow(CursorId cursorId, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::FETCH_ROW);
+		ensureIsConnected(connection);
+		std::shared_lock lock(mutex_);
+		ScanCursor& cursor = getScanCursor(cursorId, connection);
+		Indexes& index = getLoadedIndex(cursor.tableName, cursor.keyName);
+		std::string expiryColumn = getExpiryColumn(cursor.tableName);
+
+		while (true)
+		{
+			Indexes::iterator row;
+			size_t offsetIndex = 0;
+			if (!cursor.isStarted)
+			{
+				row = cursor.lowerBound.is_null() ? index.begin() : index.lower_bound(cursor.lowerBound);
+			}
+			else
+			{
+				row = index.find(cursor.currentKey);
+				if (row != index.end() && cursor.offsetIndex + 1 < row->second.size())
+				{
+					offsetIndex = cursor.offsetIndex + 1;
+				}
+				else
+				{
+					row = index.upper_bound(cursor.currentKey);
+				}
+			}
+			if (row == index.end() || (!cursor.upperBound.is_null() && !JsonComparator()(row->first, cursor.upperBound)))
+			{
+				throw DatabaseException("No more data available", ErrorCode::NO_MORE_DATA_AVAILABLE);
+			}
+
+			cursor.isStarted = true;
+			cursor.currentKey = row->first;
+			cursor.offsetIndex = offsetIndex;
+			json found = readDataByOffset(cursor.tableName, row->second[offsetIndex]);
+			if (!isExpired(expiryColumn, found))
+			{
+				return found;
+			}
+		}
+	}
+
+	void Database::closeCursor(CursorId cursorId, Connection connection)
+	{
+		ensureIsConnected(connection);
+		std::unique_lock lock(mutex_);
+		getScanCursor(cursorId, connection);
+		openCursors[connection.getConnectionId()].erase(cursorId);
+	}
+
+	json Database::getPage(const std::string& tableName, const std::string& keyName, unsigned pageSize,
+		const std::string& continuationToken, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::GET_PAGE, tableName);
+		timer.setKey(keyName);
+		ensureIsConnected(connection);
+		if (pageSize == 0)
+		{
+			throw DatabaseException("Page size must be positive", ErrorCode::INVALID_OPTIONS);
+		}
+		ContinuationToken position;
+		if (!continuationToken.empty())
+		{
+			position = ContinuationToken::decode(continuationToken);
+			if (position.keyName != keyName)
+			{
+				throw DatabaseException("Continuation token belongs to key " + position.keyName,
+					ErrorCode::INVALID_CONTINUATION_TOKEN);
+			}
+		}
+		warmIndex(tableName, keyName);
+		std::shared_lock lock(mutex_);
+		Indexes& index = getLoadedIndex(tableName, keyName);
+
+		// A token keeps no reference into the index, so the page starts with a
+		// seek; if its key value was removed meanwhile, paging goes on from the
+		// next key value.
+		Indexes::iterator row = index.begin();
+		size_t offsetIndex = 0;
+		if (!continuationToken.empty())
+		{
+			row = index.lower_bound(position.keyValue);
+			if (row != index.end() && !JsonComparator()(position.keyValue, row->first))
+			{
+				offsetIndex = position.offsetIndex;
+			}
+		}
+
+		std::string expiryColumn = getExpiryColumn(tableName);
+		json rows = json::array();
+		while (row != index.end() && rows.size() < pageSize)
+		{
+			if (offsetIndex >= row->second.size())
+			{
+				row++;
+				offsetIndex = 0;
+				continue;
+			}
+			json found = readDataByOffset(tableName, row->second[offsetIndex++]);
+			if (!isExpired(expiryColumn, found))
+			{
+				rows.push_back(std::move(found));
+			}
+		}
+		if (row != index.end() && offsetIndex >= row->second.size())
+		{
+			row++;
+			offsetIndex = 0;
+		}
+
+		json page = { {"rows", std::move(rows)}, {"continuationToken", ""} };
+		if (row != index.end())
+		{
+			position.keyName = keyName;
+			position.keyValue = row->first;
+			position.offsetIndex = offsetIndex;
+			page["continuationToken"] = position.encode();
+		}
+		return page;
+	}
+
+	json Database::find(const std::string& tableName, const json& predicateJson, const json& projection,
+		unsigned limit, Connection connection)
+	{
+		return find(tableName, predicateJson, projection, limit, "", connection)["rows"];
+	}
+
+	json Database::find(const std::string& tableName, const json& predicateJson, const json& projection,
+		unsigned limit, const std::string& continuationToken, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::FIND, tableName);
+		ensureIsConnected(connection);
+		Predicate predicate(predicateJson);
+		ContinuationToken position;
+		if (!continuationToken.empty())
+		{
+			position = ContinuationToken::decode(continuationToken);
+		}
+		std::vector<std::string> coveringColumns;
+		if (projection.is_array() && !projection.empty())
+		{
+			coveringColumns = projection.get<std::vector<std::string>>();
+			for (auto& condition : predicateJson.items())
+			{
+				coveringColumns.push_back(condition.key());
+			}
+		}
+		json tableMeta;
+		std::string keyName;
+		std::vector<std::string> keyColumns;
+		size_t prefixLength = 0;
+		bool hasRange = false;
+		std::string expiryColumn;
+		bool isLoaded = false;
+		{
+			std::shared_lock lock(mutex_);
+			ensureTableExists(tableName, catalog);
+			tableMeta = catalog[tableName];
+			expiryColumn = getExpiryColumn(tableName);
+			isLoaded = deletedRows.find(tableName) != deletedRows.end()
+				&& tablesColumns.find(tableName) != tablesColumns.end();
+		}
+		if (!coveringColumns.empty() && !expiryColumn.empty())
+		{
+			coveringColumns.push_back(expiryColumn);
+		}
+
+		// Prefer the key whose leading columns (in comparison order) are
+		// fixed by equalities, then one that bounds the next column.
+		for (auto key : tableMeta["keys"].items())
+		{
+			std::vector<std::string> columns = key.value();
+			std::sort(columns.begin(), columns.end());
+			size_t equalities = 0;
+			while (equalities < columns.size() && predicate.isEquality(columns[equalities]))
+			{
+				equalities++;
+			}
+			bool range = equalities < columns.size() && predicate.hasRange(columns[equalities]);
+			if (equalities * 2 + range > prefixLength * 2 + hasRange)
+			{
+				keyName = key.key();
+				keyColumns = columns;
+				prefixLength = equalities;
+				hasRange = range;
+			}
+		}
+		if (!continuationToken.empty() && position.keyName != keyName)
+		{
+			throw DatabaseException("Continuation token belongs to key " + position.keyName,
+				ErrorCode::INVALID_CONTINUATION_TOKEN);
+		}
+		if (!keyName.empty())
+		{
+			warmIndex(tableName, keyName);
+		}
+		if (!isLoaded)
+		{
+			std::unique_lock lock(mutex_);
+			ensureTableExists(tableName, catalog);
+			loadColumns(tableName);
+			loadDeletedRows(tableName);
+		}
+
+		std::shared_lock lock(mutex_);
+		ensureTableExists(tableName, catalog);
+		json rows = json::array();
+		auto collect = [&](json row)
+		{
+			if (!isExpired(expiryColumn, row) && predicate.matches(row))
+			{
+				rows.push_back(projectRow(row, projection));
+			}
+			return limit == 0 || rows.size() < limit;
+		};
+		// The token holds the position of the row after the last one collected.
+		auto makePage = [&](bool isStopped)
+		{
+			return json({ {"rows", std::move(rows)}, {"continuationToken", isStopped ? position.encode() : ""} });
+		};
+
+		if (!keyName.empty())
+		{
+			json lowerKey = json::object();
+			for (size_t i = 0; i < prefixLength; i++)
+			{
+				lowerKey[keyColumns[i]] = predicate.getEqualityValue(keyColumns[i]);
+			}
+			if (hasRange && !predicate.getLowerBound(keyColumns[prefixLength]).is_null())
+			{
+				lowerKey[keyColumns[prefixLength]] = predicate.getLowerBound(keyColumns[prefixLength]);
+			}
+
+			// As in getPage, a removed key value of the token resumes at the next one.
+			Indexes& index = getLoadedIndex(tableName, keyName);
+			auto entry = index.lower_bound(continuationToken.empty() ? lowerKey : position.keyValue);
+			size_t offsetIndex = 0;
+			if (!continuationToken.empty() && entry != index.end() && !JsonComparator()(position.keyValue, entry->first))
+			{
+				offsetIndex = position.offsetIndex;
+			}
+			for (; entry != index.end(); entry++, offsetIndex = 0)
+			{
+				bool isOutside = false;
+				for (size_t i = 0; i < prefixLength && !isOutside; i++)
+				{
+					isOutside = entry->first.value(keyColumns[i], json()) != lowerKey[keyColumns[i]];
+				}
+				if (isOutside || (hasRange && predicate.exceedsUpperBound(keyColumns[prefixLength],
+					entry->first.value(keyColumns[prefixLength], json()))))
+				{
+					break;
+				}
+				while (offsetIndex < entry->second.size())
+				{
+					size_t i = offsetIndex++;
+					json row = coveringColumns.empty() ? json() : readCoveredRow(tableName, keyName, entry, i, coveringColumns);
+					if (!collect(row.is_null() ? readDataByOffset(tableName, entry->second[i]) : row))
+					{
+						position.keyName = keyName;
+						position.keyValue = entry->first;
+						position.offsetIndex = offsetIndex;
+						return makePage(true);
+					}
+				}
+			}
+			return makePage(false);
+		}
+
+		// A scan token holds the location of the last row collected, which is
+		// only valid until the table is rewritten.
+		auto rewrites = tableRewrites.find(tableName);
+		unsigned generation = rewrites == tableRewrites.end() ? 0 : rewrites->second;
+		Offset lastLocation = 0;
+		if (!continuationToken.empty())
+		{
+			if (!position.keyValue.is_array() || position.keyValue.size() != 2 || position.keyValue[0] != generation
+				|| !position.keyValue[1].is_number_unsigned())
+			{
+				throw DatabaseException("Table was rewritten since the continuation token was made: " + tableName,
+					ErrorCode::TABLE_REWRITTEN);
+			}
+			lastLocation = position.keyValue[1].get<Offset>();
+		}
+		auto& deleted = deletedRows.at(tableName);
+		unsigned partitionCount = getPartitionCount(tableMeta);
+		for (unsigned partition = getPartition(lastLocation); partition < partitionCount; partition++)
+		{
+			TableScanner scanner(*storage, getTableFileName(tableName, partition), &stats);
+			if (!continuationToken.empty() && partition == getPartition(lastLocation))
+			{
+				scanner.seek(getPosition(lastLocation));
+			}
+			std::vector<ScannedRow> scanned;
+			while (scanner.nextBatch(scanned))
+			{
+				for (auto& row : scanned)
+				{
+					Offset location = toLocation(partition, row.position);
+					if ((!continuationToken.empty() && location == lastLocation)
+						|| deleted.find(location) != deleted.end() || !predicate.mayMatch(row.line))
+					{
+						continue;
+					}
+					if (!collect(decodeRow(tableName, row.line)))
+					{
+						position.keyName = "";
+						position.keyValue = json::array({ generation, location });
+						position.offsetIndex = 0;
+						return makePage(true);
+					}
+				}
+			}
+		}
+		return makePage(false);
+	}
+
+	Offset Database::count(const std::string& tableName, const std::string& keyName, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::COUNT, tableName);
+		timer.setKey(keyName);
+		ensureIsConnected(connection);
+		warmIndex(tableName, keyName);
+		std::shared_lock lock(mutex_);
+
+		return indexRowCounts.at(tableName).at(keyName);
+	}
+
+	Offset Database::count(const std::string& tableName, const std::string& keyName, const json& from,
+		const json& to, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::COUNT, tableName);
+		timer.setKey(keyName);
+		ensureIsConnected(connection);
+		warmIndex(tableName, keyName);
+		std::shared_lock lock(mutex_);
+
+		if (!from.is_null() && !to.is_null() && JsonComparator()(to, from))
+		{
+			return 0;
+		}
+		Indexes& index = tablesIndexes.at(tableName).at(keyName);
+		auto entry = from.is_null() ? index.begin() : index.lower_bound(from);
+		auto end = to.is_null() ? index.end() : index.upper_bound(to);
+		Offset rowCount = 0;
+		for (; entry != end; entry++)
+		{
+			rowCount += entry->second.size();
+		}
+		return rowCount;
+	}
+
+	json Database::minKey(const std::string& tableName, const std::string& keyName, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::MIN_KEY, tableName);
+		timer.setKey(keyName);
+		ensureIsConnected(connection);
+		warmIndex(tableName, keyName);
+		std::shared_lock lock(mutex_);
+
+		Indexes& index = tablesIndexes.at(tableName).at(keyName);
+		ensureTableIsNotEmpty(index.begin(), index.end());
+		return index.begin()->first;
+	}
+
+	json Database::maxKey(const std::string& tableName, const std::string& keyName, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::MAX_KEY, tableName);
+		timer.setKey(keyName);
+		ensureIsConnected(connection);
+		warmIndex(tableName, keyName);
+		std::shared_lock lock(mutex_);
+
+		Indexes& index = tablesIndexes.at(tableName).at(keyName);
+		ensureTableIsNotEmpty(index.begin(), index.end());
+		return index.rbegin()->first;
+	}
+
+	void Database::join(const std::string& leftTableName, const std::string& rightTableName,
+		const std::string& rightKeyName, unsigned batchSize, std::function<bool(json)> onBatch, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::JOIN, leftTableName);
+		ensureIsConnected(connection);
+		std::vector<std::string> joinColumns;
+		std::string leftKeyName;
+		unsigned leftPartitionCount = 1;
+		std::string leftExpiryColumn, rightExpiryColumn;
+		unsigned leftGeneration = 0;
+		{
+			std::unique_lock lock(mutex_);
+			const json& tablesMeta = catalog;
+			ensureTableExists(leftTableName, tablesMeta);
+			ensureTableExists(rightTableName, tablesMeta);
+			leftExpiryColumn = getExpiryColumn(leftTableName);
+			rightExpiryColumn = getExpiryColumn(rightTableName);
+			if (!tablesMeta[rightTableName]["keys"].contains(rightKeyName))
+			{
+				throw DatabaseException("Key not found: " + rightKeyName, ErrorCode::KEY_NOT_FOUND);
+			}
+			joinColumns = tablesMeta[rightTableName]["keys"][rightKeyName].get<std::vector<std::string>>();
+			leftPartitionCount = getPartitionCount(tablesMeta[leftTableName]);
+			std::sort(joinColumns.begin(), joinColumns.end());
+
+			for (auto key : tablesMeta[leftTableName]["keys"].items())
+			{
+				std::vector<std::string> keyColumns = key.value();
+				std::sort(keyColumns.begin(), keyColumns.end());
+				if (keyColumns == joinColumns)
+				{
+					leftKeyName = key.key();
+					loadIndex(leftTableName, leftKeyName);
+					break;
+				}
+			}
+			loadIndex(rightTableName, rightKeyName);
+			loadColumns(leftTableName);
+			loadColumns(rightTableName);
+			loadDeletedRows(leftTableName);
+			leftGeneration = tableRewrites[leftTableName];
+		}
+
+		// Joined rows are handed out in batches; the lock is released while the
+		// caller consumes a batch, so positions are re-resolved by key value.
+		std::shared_lock lock(mutex_);
+		json batch = json::array();
+		auto flush = [&]()
+		{
+			lock.unlock();
+			bool isContinued = onBatch(batch);
+			batch = json::array();
+			lock.lock();
+			return isContinued;
+		};
+
+		if (!leftKeyName.empty())
+		{
+			JsonComparator comparator;
+			Indexes* left = &getLoadedIndex(leftTableName, leftKeyName);
+			Indexes* right = &getLoadedIndex(rightTableName, rightKeyName);
+			auto leftEntry = left->begin();
+			auto rightEntry = right->begin();
+			while (leftEntry != left->end() && rightEntry != right->end())
+			{
+				if (comparator(leftEntry->first, rightEntry->first))
+				{
+					leftEntry = left->lower_bound(rightEntry->first);
+					continue;
+				}
+				if (comparator(rightEntry->first, leftEntry->first))
+				{
+					rightEntry = right->lower_bound(leftEntry->first);
+					continue;
+				}
+
+				std::vector<json> rightRows;
+				for (Offset offset : rightEntry->second)
+				{
+					json rightRow = readDataByOffset(rightTableName, offset);
+					if (!isExpired(rightExpiryColumn, rightRow))
+					{
+						rightRows.push_back(std::move(rightRow));
+					}
+				}
+				for (Offset offset : leftEntry->second)
+				{
+					json leftRow = readDataByOffset(leftTableName, offset);
+					if (isExpired(leftExpiryColumn, leftRow))
+					{
+						continue;
+					}
+					for (auto& rightRow : rightRows)
+					{
+						batch.push_back(json::array({ leftRow, rightRow }));
+					}
+				}
+
+				json joinedKey = leftEntry->first;
+				leftEntry++;
+				rightEntry++;
+				if (batch.size() >= batchSize)
+				{
+					if (!flush())
+					{
+						return;
+					}
+					left = &getLoadedIndex(leftTableName, leftKeyName);
+					right = &getLoadedIndex(rightTableName, rightKeyName);
+					leftEntry = left->upper_bound(joinedKey);
+					rightEntry = right->upper_bound(joinedKey);
+				}
+			}
+		}
+		else
+		{
+			for (unsigned partition = 0; partition < leftPartitionCount; partition++)
+			{
+				TableScanner scanner(*storage, getTableFileName(leftTableName, partition), &stats);
+				std::vector<ScannedRow> rows;
+				while (scanner.nextBatch(rows))
+				{
+					for (auto& row : rows)
+					{
+						auto& deleted = deletedRows.at(leftTableName);
+						if (deleted.find(toLocation(partition, row.position)) != deleted.end())
+						{
+							continue;
+						}
+						Indexes& right = getLoadedIndex(rightTableName, rightKeyName);
+						auto rightEntry = right.find(extractKey(leftTableName, row.line, joinColumns));
+						if (rightEntry == right.end())
+						{
+							continue;
+						}
+						json leftRow = decodeRow(leftTableName, row.line);
+						if (isExpired(leftExpiryColumn, leftRow))
+						{
+							continue;
+						}
+						for (Offset offset : rightEntry->second)
+						{
+							json rightRow = readDataByOffset(rightTableName, offset);
+							if (!isExpired(rightExpiryColumn, rightRow))
+							{
+								batch.push_back(json::array({ leftRow, std::move(rightRow) }));
+							}
+						}
+						if (batch.size() >= batchSize && !flush())
+						{
+							return;
+						}
+						// The scan position cannot be carried over a rewrite of the left table.
+						auto rewrites = tableRewrites.find(leftTableName);
+						if (rewrites == tableRewrites.end() || rewrites->second != leftGeneration)
+						{
+							throw DatabaseException("Table was rewritten during the join: " + leftTableName,
+								ErrorCode::TABLE_REWRITTEN);
+						}
+					}
+				}
+			}
+		}
+
+		if (!batch.empty())
+		{
+			lock.unlock();
+			onBatch(batch);
+		}
+	}
+
+	json Database::sum(const std::string& tableName, const std::string& column, const json& predicate,
+		Connection connection)
+	{
+		OperationTimer timer(stats, Operation::SUM, tableName);
+		return sumColumn(tableName, column, predicate, connection).first;
+	}
+
+	json Database::avg(const std::string& tableName, const std::string& column, const json& predicate,
+		Connection connection)
+	{
+		OperationTimer timer(stats, Operation::AVG, tableName);
+		auto [total, rowCount] = sumColumn(tableName, column, predicate, connection);
+		return rowCount == 0 ? json() : json(total / rowCount);
+	}
+
+	void Database::appendRow(const std::string& tableName, const json& keyJson, json value, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::APPEND_ROW, tableName);
+		std::unique_lock lock(mutex_);
+		ensureIsConnected(connection);
+		insertRow(tableName, keyJson, std::move(value));
+	}
+
+	void Database::updateRow(const std::string& tableName, const json& fields, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::UPDATE_ROW, tableName);
+		std::unique_lock lock(mutex_);
+		Cursor& cursor = getCurrentCursor(tableName, connection);
+		ensureDataIsAvailable(cursor.currentRow, cursor.end);
+		rewriteRow(tableName, cursor, fields);
+	}
+
+	void Database::upsert(const std::string& tableName, const json& keyJson, json value, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::UPSERT, tableName);
+		std::unique_lock lock(mutex_);
+		ensureIsConnected(connection);
+		ensureTableExists(tableName, catalog);
+
+		// The row is identified by the first key given; when its value is
+		// already indexed that row is updated and the cursor moved onto it.
+		auto identifyingKey = keyJson.items().begin();
+		std::string keyName = identifyingKey.key();
+		timer.setKey(keyName);
+		if (!catalog[tableName]["keys"].contains(keyName))
+		{
+			throw DatabaseException("Key not found: " + keyName, ErrorCode::KEY_NOT_FOUND);
+		}
+		loadIndex(tableName, keyName);
+		Indexes& index = tablesIndexes[tableName][keyName];
+		auto row = index.find(identifyingKey.value());
+		// Expired rows only wait for the reaper, so the first live one is updated.
+		std::string expiryColumn = getExpiryColumn(tableName);
+		size_t offsetIndex = 0;
+		while (row != index.end() && !expiryColumn.empty() && offsetIndex < row->second.size()
+			&& isExpired(expiryColumn, readDataByOffset(tableName, row->second[offsetIndex])))
+		{
+			offsetIndex++;
+		}
+		if (row == index.end() || offsetIndex == row->second.size())
+		{
+			insertRow(tableName, keyJson, std::move(value));
+			return;
+		}
+
+		for (auto key : keyJson.items())
+		{
+			for (auto field : key.value().items())
+			{
+				value[field.key()] = field.value();
+			}
+		}
+		// An upserted row lives for another default time to live.
+		applyDefaultTtl(catalog[tableName], value);
+		Cursor& cursor = connections[connection.getConnectionId()][tableName];
+		cursor = Cursor(row, index.end(), (int)offsetIndex, keyName);
+		rewriteRow(tableName, cursor, value);
+	}
+
+	void Database::insertRow(const std::string& tableName, const json& keyJson, json value)
+	{
+		ensureTableExists(tableName, catalog);
+		json& tableMeta = catalog[tableName];
+
+		bool isDeferred = isWriteDeferred(tableMeta);
+
+		for (auto key : keyJson.items())
+		{
+			for (auto field : key.value().items())
+			{
+				value[field.key()] = field.value();
+			}
+		}
+		applyDefaultTtl(tableMeta, value);
+
+		unsigned partition = choosePartition(tableMeta, value);
+		std::string tableFileName = getTableFileName(tableName, partition);
+		Offset position = storage->size(tableFileName);
+		Offset location = toLocation(partition, position);
+
+		for (auto key : keyJson.items())
+		{
+			std::string keyName = key.key();
+			loadIndex(tableName, keyName);
+
+			json included;
+			for (auto& column : getIncludedColumns(tableMeta, keyName))
+			{
+				included[column] = value.value(column, json());
+			}
+			insertIntoIndex(tablesIndexes[tableName][keyName], tablesIncludedValues[tableName][keyName],
+				key.value(), location, included);
+			indexRowCounts[tableName][keyName]++;
+
+			if (isDeferred)
+			{
+				appendIndexLog(tableName, keyName, "+", key.value(), location, included);
+			}
+			else
+			{
+				dumpIndex(tableName, keyName);
+			}
+		}
+
+		std::string encoded = encodeRow(tableName, value);
+		encoded.push_back('\n');
+		storage->writeAt(tableFileName, position, encoded);
+		stats.increment(Counter::BYTES_WRITTEN, encoded.size());
+		if (isRecordingChanges())
+		{
+			recordChange({ {"operation", "appendRow"}, {"table", tableName}, {"keys", keyJson}, {"value", value} });
+		}
+
+		// Rows of a clustered table are appended to an unsorted tail which is merged
+		// into the sorted part once it outgrows it, so every byte is rewritten O(1) times.
+		if (!getClusterKey(tableMeta).empty())
+		{
+			json sortedLengths = tableMeta.value("sortedLengths", json::array());
+			Offset sortedLength = partition < sortedLengths.size() ? sortedLengths[partition].get<Offset>() : 0;
+			Offset tailLength = position + encoded.size() - sortedLength;
+			if (tailLength > std::max(sortedLength, CLUSTER_TAIL_MIN_SIZE) && maintenance != nullptr)
+			{
+				scheduleRewrite(tableName);
+			}
+			else if (tailLength > std::max(sortedLength, CLUSTER_TAIL_MIN_SIZE))
+			{
+				rewriteTable(tableName, catalog);
+				saveCatalog();
+			}
+		}
+	}
+
+	void Database::removeRow(const std::string& tableName, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::REMOVE_ROW, tableName);
+		std::unique_lock lock(mutex_);
+		const Cursor& cursor = getCurrentCursor(tableName, connection);
+
+		Offset offsetToRemove = cursor.currentRow->second[cursor.offsetIndex];
+		Offset removedLength = 0;
+		unsigned partition = getPartition(offsetToRemove);
+		std::string tableFileName = getTableFileName(tableName, partition);
+		std::string toRemoveStr = storage->readLine(tableFileName, getPosition(offsetToRemove));
+		stats.increment(Counter::BYTES_READ, toRemoveStr.size() + 1);
+		removedLength = toRemoveStr.size() + 1;
+		loadColumns(tableName);
+		json toRemove = decodeRow(tableName, toRemoveStr);
+		if (isRecordingChanges())
+		{
+			recordChange({ {"operation", "removeRow"}, {"table", tableName}, {"keyName", cursor.keyName},
+				{"keyValue", getKeyValue(catalog[tableName], cursor.keyName, toRemove)}, {"row", toRemove} });
+		}
+
+		const json& associatedKeys = catalog[tableName]["keys"];
+		bool isDeferred = isWriteDeferred(catalog[tableName]);
+		for (auto key : associatedKeys.items())
+		{
+			std::string keyName = key.key();
+			json keyValue;
+			for (std::string keyColumn : key.value()) 
+			{
+				keyValue[keyColumn] = toRemove[keyColumn];
+			}
+			if (removeFromIndex(tableName, keyName, keyValue, offsetToRemove))
+			{
+				indexRowCounts[tableName][keyName]--;
+			}
+
+			if (isDeferred)
+			{
+				appendIndexLog(tableName, keyName, "-", keyValue, offsetToRemove, json());
+				continue;
+			}
+			for (auto& entry : tablesIndexes[tableName][keyName])
+			{
+				for (auto& offset : entry.second) {
+					if (getPartition(offset) == partition && offset > offsetToRemove)
+					{
+						offset -= removedLength;
+					}
+				}
+			}
+			dumpIndex(tableName, keyName);
+		}
+
+		// Log tables leave the row in place and only record it as deleted, as do
+		// file tables while maintenance runs in the background.
+		if (isDeferred)
+		{
+			markRowDeleted(tableName, offsetToRemove, removedLength);
+			compactDeletedRows(tableName);
+			return;
+		}
+
+		TableScanner scanner(*storage, tableFileName, &stats);
+		std::vector<ScannedRow> rows;
+		std::string rest;
+		while (scanner.nextBatch(rows))
+		{
+			for (auto& row : rows)
+			{
+				if (row.position != getPosition(offsetToRemove))
+				{
+					rest.append(row.line);
+					rest.append("\n");
+				}
+			}
+		}
+
+		storage->write(tableFileName, rest);
+		stats.increment(Counter::BYTES_WRITTEN, rest.size());
+		tableRewrites[tableName]++;
+
+		// Slots left behind by relocated updates shift along with the rows.
+		loadDeletedRows(tableName);
+		auto& deleted = deletedRows[tableName];
+		if (!deleted.empty())
+		{
+			std::unordered_map<Offset, Offset> shifted;
+			for (auto& [offset, length] : deleted)
+			{
+				bool isShifted = getPartition(offset) == partition && offset > offsetToRemove;
+				shifted[isShifted ? offset - removedLength : offset] = length;
+			}
+			deleted = std::move(shifted);
+			writeDeletedRows(tableName, tableName + DEL_EXT);
+		}
+	}
+
+	void Database::rewriteRow(const std::string& tableName, Cursor& cursor, const json& fields)
+	{
+		Offset location = cursor.currentRow->second[cursor.offsetIndex];
+		unsigned partition = getPartition(location);
+		std::string tableFileName = getTableFileName(tableName, partition);
+		std::string line = storage->readLine(tableFileName, getPosition(location));
+		stats.increment(Counter::BYTES_READ, line.size() + 1);
+		loadColumns(tableName);
+		json oldRow = decodeRow(tableName, line);
+		json newRow = oldRow;
+		newRow.update(fields);
+		if (isRecordingChanges())
+		{
+			recordChange({ {"operation", "updateRow"}, {"table", tableName}, {"keyName", cursor.keyName},
+				{"keyValue", getKeyValue(catalog[tableName], cursor.keyName, oldRow)}, {"row", oldRow},
+				{"fields", fields} });
+		}
+
+		// A row whose new encoding fits its slot is overwritten in place and padded
+		// with spaces, so no offsets move; a longer row is appended and its old
+		// slot recorded as deleted until the table is rewritten.
+		const json& tableMeta = catalog[tableName];
+		std::string encoded = encodeRow(tableName, newRow);
+		unsigned newPartition = choosePartition(tableMeta, newRow);
+		Offset newLocation = location;
+		if (encoded.size() <= line.size() && newPartition == partition)
+		{
+			encoded.append(line.size() - encoded.size(), ' ');
+			storage->writeAt(tableFileName, getPosition(location), encoded);
+			tableOverwrites[tableName]++;
+			auto rewrite = overwrittenDuringRewrite.find(tableName);
+			if (rewrite != overwrittenDuringRewrite.end())
+			{
+				rewrite->second.insert(location);
+			}
+		}
+		else
+		{
+			encoded.push_back('\n');
+			newLocation = toLocation(newPartition, storage->append(getTableFileName(tableName, newPartition), encoded));
+			markRowDeleted(tableName, location, line.size() + 1);
+		}
+		stats.increment(Counter::BYTES_WRITTEN, encoded.size());
+
+		// Only indexes whose key or included columns changed are touched, unless
+		// the row moved, in which case every index gets the new offset.
+		auto isChanged = [&](const std::string& column)
+		{
+			return oldRow.value(column, json()) != newRow.value(column, json());
+		};
+		bool isDeferred = isWriteDeferred(tableMeta);
+		json cursorKey;
+		for (auto key : tableMeta["keys"].items())
+		{
+			std::string keyName = key.key();
+			std::vector<std::string> keyColumns = key.value();
+			std::vector<std::string> includedColumns = getIncludedColumns(tableMeta, keyName);
+			bool isKeyChanged = std::any_of(keyColumns.begin(), keyColumns.end(), isChanged);
+			bool isIncludedChanged = std::any_of(includedColumns.begin(), includedColumns.end(), isChanged);
+			json oldKey, newKey, included;
+			for (auto& keyColumn : keyColumns)
+			{
+				oldKey[keyColumn] = oldRow[keyColumn];
+				newKey[keyColumn] = newRow[keyColumn];
+			}
+			if (keyName == cursor.keyName)
+			{
+				cursorKey = newKey;
+			}
+			if (!isKeyChanged && !isIncludedChanged && newLocation == location)
+			{
+				continue;
+			}
+			for (auto& column : includedColumns)
+			{
+				included[column] = newRow.value(column, json());
+			}
+
+			loadIndex(tableName, keyName);
+			Indexes& index = tablesIndexes[tableName][keyName];
+			IncludedValues& includedValues = tablesIncludedValues[tableName][keyName];
+			if (isKeyChanged)
+			{
+				removeFromIndex(tableName, keyName, oldKey, location);
+				insertIntoIndex(index, includedValues, newKey, newLocation, included);
+			}
+			else
+			{
+				// The row keeps its position among rows with the same key value.
+				auto entry = index.find(oldKey);
+				size_t position = std::find(entry->second.begin(), entry->second.end(), location) - entry->second.begin();
+				entry->second[position] = newLocation;
+				if (!included.is_null())
+				{
+					includedValues[oldKey][position] = included;
+				}
+			}
+
+			if (isDeferred)
+			{
+				appendIndexLog(tableName, keyName, "-", oldKey, location, json());
+				appendIndexLog(tableName, keyName, "+", newKey, newLocation, included);
+			}
+			else
+			{
+				dumpIndex(tableName, keyName);
+			}
+		}
+
+		Indexes& cursorIndex = tablesIndexes[tableName][cursor.keyName];
+		cursor.currentRow = cursorIndex.find(cursorKey);
+		cursor.end = cursorIndex.end();
+		cursor.offsetIndex = (int)(std::find(cursor.currentRow->second.begin(), cursor.currentRow->second.end(),
+			newLocation) - cursor.currentRow->second.begin());
+
+		if (newLocation != location && isDeferred)
+		{
+			compactDeletedRows(tableName);
+		}
+	}
+
+	void Database::compactDeletedRows(const std::string& tableName)
+	{
+		// Log tables leave removed rows in place; the file is compacted once
+		// dead rows make up half of it.
+		Offset deletedLength = 0, tableLength = 0;
+		for (auto& deleted : deletedRows[tableName])
+		{
+			deletedLength += deleted.second;
+		}
+		unsigned partitionCount = getPartitionCount(catalog[tableName]);
+		for (unsigned partition = 0; partition < partitionCount; partition++)
+		{
+			tableLength += storage->size(getTableFileName(tableName, partition));
+		}
+		if (deletedLength > DELETED_ROWS_MIN_SIZE && deletedLength * 2 > tableLength && maintenance != nullptr)
+		{
+			scheduleRewrite(tableName);
+		}
+		else if (deletedLength > DELETED_ROWS_MIN_SIZE && deletedLength * 2 > tableLength)
+		{
+			rewriteTable(tableName, catalog);
+			saveCatalog();
+		}
+	}
+
+	Offset Database::reapExpiredRows(const std::string& tableName, unsigned batchSize, Connection connection)
+	{
+		OperationTimer timer(stats, Operation::REAP_EXPIRED_ROWS, tableName);
+		ensureIsConnected(connection);
+		std::string expiryColumn;
+		unsigned generation = 0;
+		unsigned partitionCount = 1;
+		{
+			std::unique_lock lock(mutex_);
+			ensureTableExists(tableName, catalog);
+			expiryColumn = getExpiryColumn(tableName);
+			if (expiryColumn.empty())
+			{
+				return 0;
+			}
+			for (auto key : catalog[tableName]["keys"].items())
+			{
+				loadIndex(tableName, key.key());
+			}
+			loadColumns(tableName);
+			loadDeletedRows(tableName);
+			generation = tableRewrites[tableName];
+			partitionCount = getPartitionCount(catalog[tableName]);
+		}
+
+		// Expired rows are looked for under the shared lock; the batch is then
+		// dropped with one rewrite of the table file and of each index.
+		std::vector<Offset> expired;
+		{
+			std::shared_lock lock(mutex_);
+			auto& deleted = deletedRows.at(tableName);
+			for (unsigned partition = 0; partition < partitionCount && expired.size() < batchSize; partition++)
+			{
+				TableScanner scanner(*storage, getTableFileName(tableName, partition), &stats);
+				std::vector<ScannedRow> rows;
+				while (expired.size() < batchSize && scanner.nextBatch(rows))
+				{
+					for (auto& row : rows)
+					{
+						Offset location = toLocation(partition, row.position);
+						if (expired.size() < batchSize && deleted.find(location) == deleted.end()
+							&& isExpired(expiryColumn, extractKey(tableName, row.line, { expiryColumn })))
+						{
+							expired.push_back(location);
+						}
+					}
+				}
+			}
+		}
+		if (expired.empty())
+		{
+			return 0;
+		}
+
+		std::unique_lock lock(mutex_);
+		auto rewrites = tableRewrites.find(tableName);
+		if (!catalog.contains(tableName) || rewrites == tableRewrites.end() || rewrites->second != generation)
+		{
+			return 0;
+		}
+
+		const json& tableMeta = catalog[tableName];
+		auto& deleted = deletedRows[tableName];
+		Offset reaped = 0;
+		for (Offset location : expired)
+		{
+			// A row may have been removed or given a later expiry since the scan.
+			if (deleted.find(location) != deleted.end())
+			{
+				continue;
+			}
+			std::string line = storage->readLine(getTableFileName(tableName, getPartition(location)), getPosition(location));
+			stats.increment(Counter::BYTES_READ, line.size() + 1);
+			json row = decodeRow(tableName, line);
+			if (!isExpired(expiryColumn, row))
+			{
+				continue;
+			}
+			if (isRecordingChanges())
+			{
+				std::string keyName = tableMeta["keys"].items().begin().key();
+				recordChange({ {"operation", "removeRow"}, {"table", tableName}, {"keyName", keyName},
+					{"keyValue", getKeyValue(tableMeta, keyName, row)}, {"row", row}, {"isExpired", true} });
+			}
+			for (auto key : tableMeta["keys"].items())
+			{
+				if (removeFromIndex(tableName, key.key(), getKeyValue(tableMeta, key.key(), row), location))
+				{
+					indexRowCounts[tableName][key.key()]--;
+				}
+			}
+			reaped++;
+		}
+		if (reaped == 0)
+		{
+			return 0;
+		}
+		rewriteTable(tableName, catalog);
+		saveCatalog();
+		stats.increment(Counter::EXPIRED_ROWS_REAPED, reaped);
+		return reaped;
+	}
+
+	void Database::enableExpiryReaper(unsigned batchSize, std::uint64_t intervalMilliseconds)
+	{
+		disableExpiryReaper();
+		isExpiryReaperStopping = false;
+
+		// Each table with a time to live loses at most one batch per interval,
+		// which bounds how long the reaper holds the exclusive lock.
+		expiryReaper = std::thread([this, batchSize, intervalMilliseconds]()
+		{
+			Connection connection = connect();
+			std::unique_lock wait(expiryReaperMutex);
+			while (!expiryReaperWakeup.wait_for(wait, std::chrono::milliseconds(intervalMilliseconds),
+				[this]() { return isExpiryReaperStopping; }))
+			{
+				wait.unlock();
+				std::vector<std::string> tableNames;
+				{
+					std::shared_lock lock(mutex_);
+					for (auto& table : catalog.items())
+					{
+						if (!getExpiryColumn(table.key()).empty())
+						{
+							tableNames.push_back(table.key());
+						}
+					}
+				}
+				for (auto& tableName : tableNames)
+				{
+					try
+					{
+						reapExpiredRows(tableName, batchSize, connection);
+					}
+					catch (const std::exception&) {}
+				}
+				wait.lock();
+			}
+			disconnect(connection);
+		});
+	}
+
+	void Database::disableExpiryReaper()
+	{
+		{
+			std::lock_guard lock(expiryReaperMutex);
+			isExpiryReaperStopping = true;
+		}
+		expiryReaperWakeup.notify_all();
+		if (expiryReaper.joinable())
+		{
+			expiryReaper.join();
+		}
+	}
+
+	bool Database::isRecordingChanges()
+	{
+		return changeStream != nullptr || !changeSubscribers.empty();
+	}
+
+	void Database::recordChange(json change)
+	{
+		change["sequence"] = ++changeSequence;
+		if (changeStream != nullptr)
+		{
+			changeStream->append(change);
+		}
+		for (auto& subscriber : changeSubscribers)
+		{
+			subscriber.second(change);
+		}
+	}
+
+	json Database::getKeyValue(const json& tableMeta, const std::string& keyName, const json& row)
+	{
+		json keyValue = json::object();
+		for (std::string column : tableMeta["keys"][keyName])
+		{
+			keyValue[column] = row.value(column, json());
+		}
+		return keyValue;
+	}
+
+	void Database::enableChangeStream(const std::string& fileName)
+	{
+		std::unique_lock lock(mutex_);
+		changeStream = std::make_unique<ChangeStream>(*storage, fileName);
+		changeSequence = std::max(changeSequence, changeStream->getLastSequence());
+	}
+
+	void Database::disableChangeStream()
+	{
+		std::unique_lock lock(mutex_);
+		changeStream.reset();
+	}
+
+	json Database::readChanges(std::uint64_t afterSequence, unsigned limit)
+	{
+		std::shared_lock lock(mutex_);
+		if (changeStream == nullptr)
+		{
+			throw DatabaseException("Change stream is not enabled", ErrorCode::INVALID_OPTIONS);
+		}
+		return changeStream->read(afterSequence, limit);
+	}
+
+	std::uint64_t Database::subscribe(std::function<void(const json&)> onChange)
+	{
+		std::unique_lock lock(mutex_);
+		std::uint64_t subscriptionId = nextSubscriberId++;
+		changeSubscribers[subscriptionId] = std::move(onChange);
+		return subscriptionId;
+	}
+
+	void Database::unsubscribe(std::uint64_t subscriptionId)
+	{
+		std::unique_lock lock(mutex_);
+		changeSubscribers.erase(subscriptionId);
+	}
+
+	std::uint64_t Database::applyChanges(const json& changes, Connection connection)
+	{
+		static const std::unordered_set<std::string> operations = {
+			"createTable", "removeTable", "addKey", "removeKey", "appendRow", "removeRow", "updateRow" };
+
+		std::lock_guard apply(applyMutex);
+		for (auto& change : changes)
+		{
+			std::uint64_t sequence = change["sequence"];
+			if (sequence <= getAppliedSequence())
+			{
+				continue;
+			}
+			if (sequence != getAppliedSequence() + 1)
+			{
+				throw DatabaseException("Changes after " + std::to_string(getAppliedSequence()) + " are missing",
+					ErrorCode::CHANGES_MISSING);
+			}
+			std::string operation = change["operation"];
+			if (operations.find(operation) == operations.end())
+			{
+				throw DatabaseException("Unknown change operation: " + operation, ErrorCode::INVALID_OPTIONS);
+			}
+
+			// A change recorded as being applied when the replica stopped may
+			// already have taken effect.
+			bool isApplied = false;
+			if (applyingChange.is_object() && applyingChange.value("sequence", (std::uint64_t)0) == sequence)
+			{
+				isApplied = isChangeApplied(change, applyingChange.value("matches", (Offset)0));
+			}
+			else
+			{
+				json applying = { {"sequence", sequence}, {"matches", countChangedRows(change)} };
+				std::unique_lock lock(mutex_);
+				storage->write(REPLICA_FILE, json({ {"sequence", appliedSequence}, {"applying", applying} }).dump());
+				applyingChange = applying;
+			}
+
+			if (!isApplied)
+			{
+				applyChange(change, connection);
+			}
+
+			std::unique_lock lock(mutex_);
+			appliedSequence = sequence;
+			applyingChange = json();
+			storage->write(REPLICA_FILE, json({ {"sequence", appliedSequence} }).dump());
+		}
+		return getAppliedSequence();
+	}
+
+	void Database::applyChange(const json& change, Connection connection)
+	{
+		std::string operation = change["operation"];
+		std::string tableName = change["table"];
+		if (operation == "createTable")
+		{
+			createTable(tableName, change["keys"], change["options"], connection);
+		}
+		else if (operation == "removeTable")
+		{
+			removeTable(tableName, connection);
+		}
+		else if (operation == "addKey")
+		{
+			addKey(tableName, change["keys"], change["included"], connection);
+		}
+		else if (operation == "removeKey")
+		{
+			removeKey(tableName, change["key"], connection);
+		}
+		else if (operation == "appendRow")
+		{
+			appendRow(tableName, change["keys"], change["value"], connection);
+		}
+		else if (operation == "removeRow")
+		{
+			try
+			{
+				positionOnRow(tableName, change["keyName"], change["keyValue"], change["row"], connection);
+				removeRow(tableName, connection);
+			}
+			catch (const DatabaseException& ex)
+			{
+				// The replica's own reaper may have dropped an expired row first.
+				if (!change.value("isExpired", false) || ex.getErrorNumber() != ErrorCode::KEY_VALUE_NOT_FOUND)
+				{
+					throw;
+				}
+			}
+		}
+		else if (operation == "updateRow")
+		{
+			positionOnRow(tableName, change["keyName"], change["keyValue"], change["row"], connection);
+			updateRow(tableName, change["fields"], connection);
+		}
+	}
+
+	Offset Database::countMatchingRows(const std::string& tableName, const std::string& keyName, const json& keyValue,
+		const json& fields)
+	{
+		{
+			std::shared_lock lock(mutex_);
+			auto tableMeta = catalog.find(tableName);
+			if (tableMeta == catalog.end() || !(*tableMeta)["keys"].contains(keyName))
+			{
+				return 0;
+			}
+		}
+		warmIndex(tableName, keyName);
+		std::unique_lock lock(mutex_);
+		if (!isIndexLoaded(tableName, keyName))
+		{
+			return 0;
+		}
+		Indexes& index = getLoadedIndex(tableName, keyName);
+		auto entry = index.find(keyValue);
+		Offset matches = 0;
+		for (size_t offsetIndex = 0; entry != index.end() && offsetIndex < entry->second.size(); offsetIndex++)
+		{
+			json row = readDataByOffset(tableName, entry->second[offsetIndex]);
+			bool isMatching = true;
+			for (auto& field : fields.items())
+			{
+				isMatching = isMatching && row.value(field.key(), json()) == field.value();
+			}
+			matches += isMatching;
+		}
+		return matches;
+	}
+
+	Offset Database::countChangedRows(const json& change)
+	{
+		std::string operation = change["operation"];
+		if (operation == "appendRow" && !change["keys"].empty())
+		{
+			json fields = change["value"];
+			for (auto& key : change["keys"].items())
+			{
+				fields.update(key.value());
+			}
+			auto firstKey = change["keys"].items().begin();
+			return countMatchingRows(change["table"], firstKey.key(), firstKey.value(), fields);
+		}
+		if (operation == "removeRow" || operation == "updateRow")
+		{
+			return countMatchingRows(change["table"], change["keyName"], change["keyValue"], change["row"]);
+		}
+		return 0;
+	}
+
+	bool Database::isChangeApplied(const json& change, Offset matches)
+	{
+		std::string operation = change["operation"];
+		std::string tableName = change["table"];
+		if (operation == "appendRow")
+		{
+			return countChangedRows(change) > matches;
+		}
+		if (operation == "removeRow" || operation == "updateRow")
+		{
+			return countChangedRows(change) < matches;
+		}
+
+		std::shared_lock lock(mutex_);
+		auto tableMeta = catalog.find(tableName);
+		if (operation == "createTable")
+		{
+			return tableMeta != catalog.end();
+		}
+		if (operation == "removeTable")
+		{
+			return tableMeta == catalog.end();
+		}
+		if (operation == "addKey")
+		{
+			bool isAdded = tableMeta != catalog.end();
+			for (auto& key : change["keys"].items())
+			{
+				isAdded = isAdded && (*tableMeta)["keys"].contains(key.key());
+			}
+			return isAdded;
+		}
+		return tableMeta == catalog.end() || !(*tableMeta)["keys"].contains(change["key"].get<std::string>());
+	}
+
+	std::uint64_t Database::getAppliedSequence()
+	{
+		std::shared_lock lock(mutex_);
+		return appliedSequence;
+	}
+
+	void Database::positionOnRow(const std::string& tableName, const std::string& keyName, const json& keyValue,
+		const json& row, Connection connection)
+	{
+		warmIndex(tableName, keyName);
+		std::unique_lock lock(mutex_);
+		ensureIsConnected(connection);
+		// Rows sharing the key value are told apart by their content. Expired
+		// rows are looked at too, since the leader may change them before
+		// they are reaped.
+		Indexes& index = getLoadedIndex(tableName, keyName);
+		auto entry = index.find(keyValue);
+		for (size_t offsetIndex = 0; entry != index.end() && offsetIndex < entry->second.size(); offsetIndex++)
+		{
+			if (readDataByOffset(tableName, entry->second[offsetIndex]) == row)
+			{
+				connections[connection.getConnectionId()][tableName] = Cursor(entry, index.end(), (int)offsetIndex, keyName);
+				return;
+			}
+		}
+		throw DatabaseException("Changed row not found", ErrorCode::KEY_VALUE_NOT_FOUND);
+	}
+
+	void Database::enableMaintenance(const json& options)
+	{
+		unsigned workerCount = options.value("workers", 1u);
+		Offset bytesPerSecond = options.value("bytesPerSecond", (Offset)0);
+		double cpuShare = options.value("cpuShare", 0.0);
+		if (workerCount == 0 || cpuShare < 0)
+		{
+			throw DatabaseException("Invalid maintenance options: " + options.dump(), ErrorCode::INVALID_OPTIONS);
+		}
+		disableMaintenance();
+		std::unique_lock lock(mutex_);
+		maintenance = std::make_unique<MaintenanceScheduler>(workerCount, bytesPerSecond, cpuShare);
+		maintenanceBytesPerSecond = bytesPerSecond;
+	}
+
+	void Database::disableMaintenance()
+	{
+		// Queued work is finished outside the lock, since the tasks take it.
+		std::unique_ptr<MaintenanceScheduler> stopped;
+		{
+			std::unique_lock lock(mutex_);
+			stopped = std::move(maintenance);
+		}
+		stopped.reset();
+	}
+
+	void Database::scheduleCheckpoint(const std::string& directory)
+	{
+		std::unique_lock lock(mutex_);
+		if (maintenance == nullptr)
+		{
+			throw DatabaseException("Maintenance is not enabled", ErrorCode::INVALID_OPTIONS);
+		}
+		Offset bytesPerSecond = maintenanceBytesPerSecond;
+		maintenance->schedule("checkpoint " + directory, MaintenancePriority::LOW, [this, directory, bytesPerSecond](MaintenanceTask&)
+		{
+			Connection connection = connect();
+			try
+			{
+				checkpoint(directory, bytesPerSecond, connection);
+			}
+			catch (...)
+			{
+				disconnect(connection);
+				throw;
+			}
+			disconnect(connection);
+		});
+	}
+
+	json Database::getMaintenanceProgress()
+	{
+		std::shared_lock lock(mutex_);
+		if (maintenance == nullptr)
+		{
+			return { {"enabled", false} };
+		}
+		json progress = maintenance->getProgress();
+		progress["enabled"] = true;
+		return progress;
+	}
+
+	json Database::getStats()
+	{
+		return stats.toJson();
+	}
+
+	void Database::enableSlowOperationLog(const std::string& fileName, std::uint64_t thresholdMicroseconds)
+	{
+		stats.setSlowOperationLog(fileName, std::chrono::microseconds(thresholdMicroseconds));
+	}
+
+	void Database::disableSlowOperationLog()
+	{
+		stats.setSlowOperationLog("", std::chrono::nanoseconds(0));
+	}
+
+	void Database::enableLockProfiler(bool isEnabled)
+	{
+		stats.setLockProfiling(isEnabled);
+	}
+
+	json Database::getLockProfile()
+	{
+		return stats.getLockProfile();
+	}
+
+	void Database::loadCatalog()
+	{
+		catalog = readJsonFromFile(META_FILE);
+		if (catalog.is_null())
+		{
+			catalog = json::object();
+		}
+	}
+
+	void Database::saveCatalog()
+	{
+		storage->write(META_FILE, catalog.dump());
+	}
+
+	json Database::readJsonFromFile(const std::string& fileName)
+	{
+		if (fileName == META_FILE)
+		{
+			stats.increment(Counter::CATALOG_READS);
+		}
+		json result;
+		std::string content;
+		if (storage->read(fileName, content))
+		{
+			result = json::parse(content);
+			stats.increment(Counter::BYTES_READ, content.size());
+		}
+		return result;
+	}
+
+	json Database::readDataByOffset(const std::string& tableName, Offset offset)
+	{
+		std::string value = storage->readLine(getTableFileName(tableName, getPartition(offset)), getPosition(offset));
+		stats.increment(Counter::BYTES_READ, value.size() + 1);
+		return decodeRow(tableName, value);
+	}
+
+	void Database::loadColumns(const std::string& tableName)
+	{
+		if (tablesColumns.find(tableName) == tablesColumns.end())
+		{
+			tablesColumns[tableName] = readJsonFromFile(tableName + COLUMNS_EXT);
+		}
+	}
+
+	bool Database::isCompressed(const std::string& tableName)
+	{
+		loadColumns(tableName);
+		return tablesColumns[tableName].is_array();
+	}
+
+	std::string Database::encodeRow(const std::string& tableName, const json& value)
+	{
+		if (!isCompressed(tableName))
+		{
+			return value.dump();
+		}
+
+		// Compressed rows are stored as [column, value, ...] pairs, where column
+		// is a position in the table's column dictionary.
+		json& columns = tablesColumns[tableName];
+		json encoded = json::array();
+		bool hasNewColumns = false;
+		for (auto field : value.items())
+		{
+			auto column = std::find(columns.begin(), columns.end(), field.key());
+			size_t columnIndex = column - columns.begin();
+			if (column == columns.end())
+			{
+				columns.push_back(field.key());
+				hasNewColumns = true;
+			}
+			encoded.push_back(columnIndex);
+			encoded.push_back(field.value());
+		}
+
+		if (hasNewColumns)
+		{
+			storage->write(tableName + COLUMNS_EXT, columns.dump());
+		}
+		return encoded.dump();
+	}
+
+	json Database::decodeRow(const std::string& tableName, std::string_view line)
+	{
+		json row = json::parse(line.begin(), line.end());
+		if (!row.is_array())
+		{
+			return row;
+		}
+
+		const json& columns = tablesColumns.at(tableName);
+		json decoded = json::object();
+		for (size_t i = 0; i + 1 < row.size(); i += 2)
+		{
+			decoded[columns[row[i].get<size_t>()].get<std::string>()] = row[i + 1];
+		}
+		return decoded;
+	}
+
+	json Database::extractKey(const std::string& tableName, std::string_view line,
+		const std::vector<std::string>& keyColumns)
+	{
+		json key = TableScanner::extractFields(line, keyColumns);
+		if (key.is_null())
+		{
+			json entry = decodeRow(tableName, line);
+			key = json::object();
+			for (auto& keyColumn : keyColumns)
+			{
+				key[keyColumn] = entry.value(keyColumn, json());
+			}
+		}
+		return key;
+	}
+
+	std::pair<double, Offset> Database::sumColumn(const std::string& tableName, const std::string& column,
+		const json& predicateJson, Connection connection)
+	{
+		ensureIsConnected(connection);
+		Predicate predicate(predicateJson);
+		std::vector<std::string> columns = { column };
+		if (predicateJson.is_object())
+		{
+			for (auto& condition : predicateJson.items())
+			{
+				columns.push_back(condition.key());
+			}
+		}
+
+		json tableMeta;
+		std::string keyName;
+		std::string expiryColumn;
+		{
+			std::unique_lock lock(mutex_);
+			ensureTableExists(tableName, catalog);
+			tableMeta = catalog[tableName];
+			expiryColumn = getExpiryColumn(tableName);
+			if (!expiryColumn.empty())
+			{
+				columns.push_back(expiryColumn);
+			}
+
+			// A key holding every referenced column answers the query from the
+			// index alone, weighting each key value by its number of rows.
+			for (auto key : tableMeta["keys"].items())
+			{
+				std::vector<std::string> keyColumns = key.value();
+				if (std::all_of(columns.begin(), columns.end(), [&](const std::string& name)
+					{ return std::find(keyColumns.begin(), keyColumns.end(), name) != keyColumns.end(); }))
+				{
+					keyName = key.key();
+					break;
+				}
+			}
+			if (!keyName.empty())
+			{
+				loadIndex(tableName, keyName);
+			}
+			loadColumns(tableName);
+			loadDeletedRows(tableName);
+		}
+
+		std::shared_lock lock(mutex_);
+		double total = 0;
+		Offset rowCount = 0;
+		auto accumulate = [&](const json& fields, Offset rows)
+		{
+			json value = fields.value(column, json());
+			if (value.is_number() && !isExpired(expiryColumn, fields) && predicate.matches(fields))
+			{
+				total += value.get<double>() * rows;
+				rowCount += rows;
+			}
+		};
+
+		if (!keyName.empty())
+		{
+			for (auto& entry : tablesIndexes.at(tableName).at(keyName))
+			{
+				accumulate(entry.first, entry.second.size());
+			}
+			return { total, rowCount };
+		}
+
+		auto& deleted = deletedRows.at(tableName);
+		unsigned partitionCount = getPartitionCount(tableMeta);
+		for (unsigned partition = 0; partition < partitionCount; partition++)
+		{
+			TableScanner scanner(*storage, getTableFileName(tableName, partition), &stats);
+			std::vector<ScannedRow> rows;
+			while (scanner.nextBatch(rows))
+			{
+				for (auto& row : rows)
+				{
+					if (deleted.find(toLocation(partition, row.position)) == deleted.end()
+						&& predicate.mayMatch(row.line))
+					{
+						accumulate(extractKey(tableName, row.line, columns), 1);
+					}
+				}
+			}
+		}
+		return { total, rowCount };
+	}
+
+	void Database::loadIndex(const std::string& tableName, const std::string& keyName)
+	{
+		if (isIndexLoaded(tableName, keyName))
+		{
+			stats.increment(Counter::INDEX_CACHE_HITS);
+			return;
+		}
+		installIndex(tableName, keyName, readIndex(tableName, keyName));
+	}
+
+	bool Database::isIndexLoaded(const std::string& tableName, const std::string& keyName)
+	{
+		auto table = tablesIndexes.find(tableName);
+		return table != tablesIndexes.end() && table->second.find(keyName) != table->second.end();
+	}
+
+	LoadedIndex Database::readIndex(const std::string& tableName, const std::string& keyName)
+	{
+		OperationTimer timer(stats, Operation::LOAD_INDEX, tableName);
+		timer.setKey(keyName);
+		std::string content;
+		if (!storage->read(tableName + "_" + keyName + JSON_EXT, content))
+		{
+			throw DatabaseException("Table or key not found: " + tableName + ", " + keyName, ErrorCode::NOT_FOUND);
+		}
+		stats.increment(Counter::INDEX_CACHE_MISSES);
+		stats.increment(Counter::BYTES_READ, content.size());
+		json indexes = !content.empty() && content[0] != '[' ? json::from_msgpack(content) : json::parse(content);
+
+		// Index files are written in key order, so every entry is placed at the
+		// end hint and the map is built in linear time.
+		LoadedIndex loaded;
+		Indexes& index = loaded.index;
+		for (auto& entry : indexes)
+		{
+			if (entry.is_array())
+			{
+				index.emplace_hint(index.end(), std::move(entry[0]), OffsetsCodec::decode(entry[1].get_binary()));
+				if (entry.size() > 2)
+				{
+					loaded.includedValues.emplace_hint(loaded.includedValues.end(), index.rbegin()->first,
+						entry[2].get<std::vector<json>>());
+				}
+			}
+			else
+			{
+				index.emplace_hint(index.end(), std::move(entry[keyName]), entry["offsets"].get<std::vector<Offset>>());
+				if (entry.contains("included"))
+				{
+					loaded.includedValues.emplace_hint(loaded.includedValues.end(), index.rbegin()->first,
+						entry["included"].get<std::vector<json>>());
+				}
+			}
+		}
+
+		std::string logContent;
+		storage->read(tableName + "_" + keyName + LOG_EXT, logContent);
+		std::istringstream indexLog(logContent);
+		std::string line;
+		while (std::getline(indexLog, line))
+		{
+			json record = json::parse(line);
+			Offset offset = record[2];
+			auto entry = index.find(record[1]);
+			bool isFound = entry != index.end()
+				&& std::find(entry->second.begin(), entry->second.end(), offset) != entry->second.end();
+			if (record[0] == "+" && !isFound)
+			{
+				insertIntoIndex(index, loaded.includedValues, record[1], offset, record.size() > 3 ? record[3] : json());
+			}
+			else if (record[0] == "-" && isFound)
+			{
+				removeFromIndex(index, loaded.includedValues, record[1], offset);
+			}
+			loaded.logSize++;
+		}
+		return loaded;
+	}
+
+	void Database::installIndex(const std::string& tableName, const std::string& keyName, LoadedIndex loaded)
+	{
+		Offset rowCount = 0;
+		for (auto& entry : loaded.index)
+		{
+			rowCount += entry.second.size();
+		}
+		tablesIndexes[tableName][keyName] = std::move(loaded.index);
+		if (!loaded.includedValues.empty())
+		{
+			tablesIncludedValues[tableName][keyName] = std::move(loaded.includedValues);
+		}
+		indexLogSizes[tableName][keyName] = loaded.logSize;
+		indexRowCounts[tableName][keyName] = rowCount;
+	}
+
+	void Database::warmIndex(const std::string& tableName, const std::string& keyName)
+	{
+		{
+			std::shared_lock lock(mutex_);
+			if (isIndexLoaded(tableName, keyName) && tablesColumns.find(tableName) != tablesColumns.end())
+			{
+				stats.increment(Counter::INDEX_CACHE_HITS);
+				return;
+			}
+		}
+
+		// The index file is parsed under the shared lock, which keeps writers
+		// from rewriting it, so readers of other tables are not blocked.
+		LoadedIndex loaded;
+		bool isRead = false;
+		{
+			std::shared_lock lock(mutex_);
+			if (!isIndexLoaded(tableName, keyName))
+			{
+				loaded = readIndex(tableName, keyName);
+				isRead = true;
+			}
+		}
+
+		std::unique_lock lock(mutex_);
+		if (isRead && !isIndexLoaded(tableName, keyName)
+			&& storage->exists(tableName + "_" + keyName + JSON_EXT))
+		{
+			installIndex(tableName, keyName, std::move(loaded));
+		}
+		else if (!isIndexLoaded(tableName, keyName))
+		{
+			installIndex(tableName, keyName, readIndex(tableName, keyName));
+		}
+		loadColumns(tableName);
+	}
+
+	unsigned Database::getContentGeneration(const std::string& tableName)
+	{
+		// Both counters only grow, so their sum changes whenever the table file
+		// was rewritten or a row in it was overwritten in place.
+		auto rewrites = tableRewrites.find(tableName);
+		auto overwrites = tableOverwrites.find(tableName);
+		return (rewrites == tableRewrites.end() ? 0 : rewrites->second)
+			+ (overwrites == tableOverwrites.end() ? 0 : overwrites->second);
+	}
+
+	bool Database::copyTableFiles(const std::string& tableName, const std::vector<Offset>& lengths,
+		const std::string& directory, unsigned generation, bool isLocked, Offset bytesPerSecond,
+		std::chrono::steady_clock::time_point started, Offset& copied)
+	{
+		std::vector<char> chunk(CHECKPOINT_CHUNK_SIZE);
+		for (unsigned partition = 0; partition < lengths.size(); partition++)
+		{
+			std::string tableFileName = getTableFileName(tableName, partition);
+			std::string copyFileName = directory + "/" + tableFileName;
+			storage->write(copyFileName, "");
+			Offset length = lengths[partition];
+			for (Offset position = 0; position < length; )
+			{
+				Offset size = std::min(CHECKPOINT_CHUNK_SIZE, length - position);
+				{
+					std::shared_lock lock(mutex_, std::defer_lock);
+					if (!isLocked)
+					{
+						lock.lock();
+					}
+					if (!catalog.contains(tableName) || getContentGeneration(tableName) != generation)
+					{
+						return false;
+					}
+					size = storage->readAt(tableFileName, position, chunk.data(), size);
+				}
+				if (size == 0)
+				{
+					break;
+				}
+				storage->append(copyFileName, std::string_view(chunk.data(), size));
+				stats.increment(Counter::BYTES_READ, size);
+				stats.increment(Counter::BYTES_WRITTEN, size);
+				position += size;
+
+				copied += size;
+				if (bytesPerSecond != 0 && !isLocked)
+				{
+					std::this_thread::sleep_until(started + std::chrono::microseconds(copied * 1000000 / bytesPerSecond));
+				}
+			}
+		}
+		return true;
+	}
+
+	void Database::writeIndex(const std::string& tableName, const std::string& keyName, const std::string& fileName)
+	{
+		std::string content = serializeIndex(tableName, keyName);
+		storage->write(fileName, content);
+		stats.increment(Counter::BYTES_WRITTEN, content.size());
+	}
+
+	std::string Database::serializeIndex(const std::string& tableName, const std::string& keyName)
+	{
+		auto tableIncluded = tablesIncludedValues.find(tableName);
+		const IncludedValues* included = nullptr;
+		if (tableIncluded != tablesIncludedValues.end() && tableIncluded->second.find(keyName) != tableIncluded->second.end())
+		{
+			included = &tableIncluded->second.find(keyName)->second;
+		}
+		return serializeIndex(keyName, getLoadedIndex(tableName, keyName), included, isCompressed(tableName));
+	}
+
+	std::string Database::serializeIndex(const std::string& keyName, const Indexes& index,
+		const IncludedValues* included, bool isCompressed)
+	{
+		json entries = json::array();
+		bool hasIncluded = included != nullptr && !included->empty();
+		auto getIncluded = [&](const json& keyValue)
+		{
+			auto values = included->find(keyValue);
+			return values == included->end() ? json::array() : json(values->second);
+		};
+		if (isCompressed)
+		{
+			for (auto& kv : index)
+			{
+				json entry = json::array({ kv.first, json::binary(OffsetsCodec::encode(kv.second)) });
+				if (hasIncluded)
+				{
+					entry.push_back(getIncluded(kv.first));
+				}
+				entries.push_back(entry);
+			}
+			std::vector<std::uint8_t> content = json::to_msgpack(entries);
+			return std::string((const char*)content.data(), content.size());
+		}
+		else
+		{
+			for (auto& kv : index)
+			{
+				json entry = { { keyName, kv.first }, { "offsets", kv.second } };
+				if (hasIncluded)
+				{
+					entry["included"] = getIncluded(kv.first);
+				}
+				entries.push_back(entry);
+			}
+			return entries.dump();
+		}
+	}
+
+	void Database::foldIndex(const std::string& tableName, const std::string& keyName, MaintenanceTask& task)
+	{
+		OperationTimer timer(stats, Operation::DUMP_INDEX, tableName);
+		timer.setKey(keyName);
+		auto getDumpCount = [&]()
+		{
+			auto table = indexDumps.find(tableName);
+			if (table == indexDumps.end() || table->second.find(keyName) == table->second.end())
+			{
+				return 0u;
+			}
+			return table->second.find(keyName)->second;
+		};
+
+		// The index is copied with the length of its log, then serialized and
+		// written while writers go on logging; the log keeps only what came
+		// after the copy.
+		std::string indexFileName = tableName + "_" + keyName + JSON_EXT;
+		std::string logFileName = tableName + "_" + keyName + LOG_EXT;
+		Indexes index;
+		IncludedValues included;
+		bool isIndexCompressed = false;
+		Offset logLength = 0;
+		unsigned dumpCount = 0;
+		{
+			std::shared_lock lock(mutex_);
+			if (!isIndexLoaded(tableName, keyName))
+			{
+				return;
+			}
+			index = getLoadedIndex(tableName, keyName);
+			auto tableIncluded = tablesIncludedValues.find(tableName);
+			if (tableIncluded != tablesIncludedValues.end() && tableIncluded->second.find(keyName) != tableIncluded->second.end())
+			{
+				included = tableIncluded->second.find(keyName)->second;
+			}
+			auto columns = tablesColumns.find(tableName);
+			isIndexCompressed = columns != tablesColumns.end() && columns->second.is_array();
+			logLength = storage->size(logFileName);
+			dumpCount = getDumpCount();
+		}
+		std::string content = serializeIndex(keyName, index, &included, isIndexCompressed);
+		index.clear();
+		included.clear();
+		task.setProgress(0, content.size());
+		task.throttle(content.size());
+		storage->write(indexFileName + TMP_EXT, content);
+		stats.increment(Counter::BYTES_WRITTEN, content.size());
+
+		std::unique_lock lock(mutex_);
+		if (!isIndexLoaded(tableName, keyName) || getDumpCount() != dumpCount)
+		{
+			storage->remove(indexFileName + TMP_EXT);
+			return;
+		}
+		std::string logTail(storage->size(logFileName) - logLength, '\0');
+		storage->readAt(logFileName, logLength, logTail.data(), logTail.size());
+		storage->rename(indexFileName + TMP_EXT, indexFileName);
+		if (logTail.empty())
+		{
+			storage->remove(logFileName);
+		}
+		else
+		{
+			storage->write(logFileName, logTail);
+		}
+		indexLogSizes[tableName][keyName] = (unsigned)std::count(logTail.begin(), logTail.end(), '\n');
+		indexDumps[tableName][keyName]++;
+		task.setProgress(content.size(), content.size());
+	}
+
+	void Database::scheduleRewrite(const std::string& tableName)
+	{
+		maintenance->schedule("rewriteTable " + tableName, MaintenancePriority::NORMAL, [this, tableName](MaintenanceTask& task)
+		{
+			rewriteInBackground(tableName, task);
+		});
+	}
+
+	void Database::rewriteInBackground(const std::string& tableName, MaintenanceTask& task)
+	{
+		// Live rows are copied a chunk at a time under the shared lock and the
+		// task is throttled between chunks without any lock. The new files are
+		// installed under the unique lock, after copying the rows appended and
+		// again the rows overwritten meanwhile, and recording the copied rows
+		// removed meanwhile as deleted. Any other rewrite abandons this one.
+		std::vector<Offset> order;
+		std::string clusterKey;
+		unsigned partitionCount = 1;
+		unsigned generation = 0;
+		{
+			std::unique_lock lock(mutex_);
+			if (!catalog.contains(tableName))
+			{
+				return;
+			}
+			order = getRewriteOrder(tableName, catalog);
+			clusterKey = getClusterKey(catalog[tableName]);
+			partitionCount = getPartitionCount(catalog[tableName]);
+			generation = tableRewrites[tableName];
+			overwrittenDuringRewrite[tableName].clear();
+		}
+
+		std::vector<std::string> tmpFileNames;
+		for (unsigned partition = 0; partition < partitionCount; partition++)
+		{
+			tmpFileNames.push_back(getTableFileName(tableName, partition) + ".rewrite" + TMP_EXT);
+			storage->write(tmpFileNames.back(), "");
+		}
+		auto abandon = [&]()
+		{
+			for (auto& tmpFileName : tmpFileNames)
+			{
+				storage->remove(tmpFileName);
+			}
+			overwrittenDuringRewrite.erase(tableName);
+		};
+
+		// Each copied row keeps its new location and length.
+		std::unordered_map<Offset, std::pair<Offset, Offset>> copies;
+		std::vector<std::string> pendingOut(partitionCount);
+		std::vector<Offset> lengthsOut(partitionCount, 0);
+		auto copyRow = [&](Offset offset)
+		{
+			unsigned partition = getPartition(offset);
+			std::string value = storage->readLine(getTableFileName(tableName, partition), getPosition(offset));
+			stats.increment(Counter::BYTES_READ, value.size() + 1);
+			copies[offset] = { toLocation(partition, lengthsOut[partition]), value.size() + 1 };
+			pendingOut[partition].append(value);
+			pendingOut[partition].push_back('\n');
+			lengthsOut[partition] += value.size() + 1;
+			return value.size() + 1;
+		};
+		auto flush = [&]()
+		{
+			for (unsigned partition = 0; partition < partitionCount; partition++)
+			{
+				storage->append(tmpFileNames[partition], pendingOut[partition]);
+				stats.increment(Counter::BYTES_WRITTEN, pendingOut[partition].size());
+				pendingOut[partition].clear();
+			}
+		};
+
+		try
+		{
+			for (size_t copied = 0; copied < order.size(); )
+			{
+				Offset chunkLength = 0;
+				{
+					std::shared_lock lock(mutex_);
+					auto rewrites = tableRewrites.find(tableName);
+					if (!catalog.contains(tableName) || rewrites == tableRewrites.end() || rewrites->second != generation)
+					{
+						lock.unlock();
+						std::unique_lock exclusive(mutex_);
+						abandon();
+						return;
+					}
+					for (; copied < order.size() && chunkLength < CHECKPOINT_CHUNK_SIZE; copied++)
+					{
+						chunkLength += copyRow(order[copied]);
+					}
+				}
+				flush();
+				task.setProgress(copied, order.size());
+				task.throttle(chunkLength * 2);
+			}
+		}
+		catch (...)
+		{
+			std::unique_lock lock(mutex_);
+			abandon();
+			throw;
+		}
+		json sortedLengths = lengthsOut;
+
+		std::unique_lock lock(mutex_);
+		auto rewrites = tableRewrites.find(tableName);
+		if (!catalog.contains(tableName) || rewrites == tableRewrites.end() || rewrites->second != generation)
+		{
+			abandon();
+			return;
+		}
+
+		json keysJson = catalog[tableName]["keys"];
+		std::unordered_set<Offset> liveOffsets;
+		for (auto key : keysJson.items())
+		{
+			loadIndex(tableName, key.key());
+			for (auto& entry : tablesIndexes[tableName][key.key()])
+			{
+				liveOffsets.insert(entry.second.begin(), entry.second.end());
+			}
+		}
+		std::vector<Offset> appended;
+		for (Offset offset : liveOffsets)
+		{
+			if (copies.find(offset) == copies.end())
+			{
+				appended.push_back(offset);
+			}
+		}
+		std::sort(appended.begin(), appended.end());
+		for (Offset offset : appended)
+		{
+			copyRow(offset);
+		}
+		flush();
+
+		// An in-place write keeps the length of the row, so the copy is
+		// overwritten at the same place.
+		for (Offset offset : overwrittenDuringRewrite[tableName])
+		{
+			auto copy = copies.find(offset);
+			if (copy != copies.end() && liveOffsets.find(offset) != liveOffsets.end())
+			{
+				unsigned partition = getPartition(offset);
+				std::string value = storage->readLine(getTableFileName(tableName, partition), getPosition(offset));
+				storage->writeAt(tmpFileNames[partition], getPosition(copy->second.first), value);
+				stats.increment(Counter::BYTES_WRITTEN, value.size());
+			}
+		}
+		overwrittenDuringRewrite.erase(tableName);
+
+		loadDeletedRows(tableName);
+		auto& deleted = deletedRows[tableName];
+		deleted.clear();
+		for (auto& copy : copies)
+		{
+			if (liveOffsets.find(copy.first) == liveOffsets.end())
+			{
+				deleted[copy.second.first] = copy.second.second;
+			}
+		}
+		for (unsigned partition = 0; partition < partitionCount; partition++)
+		{
+			storage->rename(tmpFileNames[partition], getTableFileName(tableName, partition));
+		}
+		if (deleted.empty())
+		{
+			storage->remove(tableName + DEL_EXT);
+		}
+		else
+		{
+			writeDeletedRows(tableName, tableName + DEL_EXT);
+		}
+
+		for (auto key : keysJson.items())
+		{
+			for (auto& entry : tablesIndexes[tableName][key.key()])
+			{
+				for (auto& offset : entry.second)
+				{
+					offset = copies[offset].first;
+				}
+			}
+			dumpIndex(tableName, key.key());
+		}
+		tableRewrites[tableName]++;
+
+		if (!clusterKey.empty())
+		{
+			catalog[tableName]["sortedLengths"] = sortedLengths;
+		}
+		saveCatalog();
+	}
+
+	void Database::dumpIndex(const std::string& tableName, const std::string& keyName)
+	{
+		OperationTimer timer(stats, Operation::DUMP_INDEX, tableName);
+		timer.setKey(keyName);
+		writeIndex(tableName, keyName, tableName + "_" + keyName + JSON_EXT);
+		storage->remove(tableName + "_" + keyName + LOG_EXT);
+		indexLogSizes[tableName][keyName] = 0;
+		indexDumps[tableName][keyName]++;
 	}
 
-	void Database::disconnect(Connection connection) 
+	void Database::appendIndexLog(const std::string& tableName, const std::string& keyName,
+		const std::string& operation, const json& keyValue, Offset offset, const json& included)
 	{
-		if (!connections.erase(connection.getConnectionId()))
+		unsigned& logSize = indexLogSizes[tableName][keyName];
+		if (++logSize > std::max((unsigned)tablesIndexes[tableName][keyName].size(), INDEX_LOG_MIN_SIZE))
 		{
-			throw DatabaseException("You havent't been connected", ErrorCode::NO_CONNECTION);
+			if (maintenance == nullptr)
+			{
+				dumpIndex(tableName, keyName);
+				return;
+			}
+			maintenance->schedule("foldIndex " + tableName + "." + keyName, MaintenancePriority::HIGH,
+				[this, tableName, keyName](MaintenanceTask& task) { foldIndex(tableName, keyName, task); });
+		}
+		json record = json::array({ operation, keyValue, offset });
+		if (!included.is_null())
+		{
+			record.push_back(included);
 		}
+		std::string line = record.dump();
+		line.push_back('\n');
+		storage->append(tableName + "_" + keyName + LOG_EXT, line);
+		stats.increment(Counter::BYTES_WRITTEN, line.size());
 	}
 
-	void Database::createTable(std::string tableName, json keysJson, Connection connection)
+	void Database::insertIntoIndex(Indexes& index, IncludedValues& includedValues, const json& keyValue, Offset offset,
+		const json& included)
 	{
-		std::unique_lock lock(mutex_);
-		ensureIsConnected(connection);
-		json tablesMeta = readJsonFromFile(META_FILE);
-		tablesMeta = tablesMeta.is_null() ? json::object() : tablesMeta;
- 		tablesMeta[tableName]["keys"] = keysJson;
-
-		for (auto key : keysJson.items())
+		index[keyValue].push_back(offset);
+		if (!included.is_null())
 		{
-			std::ofstream tableIndexFile(tableName + "_" + key.key() + JSON_EXT);
-			tableIndexFile << json::array().dump();
+			includedValues[keyValue].push_back(included);
 		}
-
-		std::ofstream tablesMetaFile(META_FILE);
-		tablesMetaFile << tablesMeta.dump();
 	}
 
-	void Database::removeTable(std::string tableName, Connection connection)
+	bool Database::removeFromIndex(Indexes& index, IncludedValues& includedValues, const json& keyValue, Offset offset)
 	{
-		std::unique_lock lock(mutex_);
-		ensureIsConnected(connection);
-		json tablesMeta = readJsonFromFile(META_FILE);
-		ensureTableExists(tableName, tablesMeta);
-
-		json keysJson = tablesMeta[tableName]["keys"];
-		for (auto key : keysJson.items())
+		auto entry = index.find(keyValue);
+		if (entry == index.end())
 		{
-			remove((tableName + "_" + key.key() + JSON_EXT).c_str());
+			return false;
+		}
+		auto found = std::find(entry->second.begin(), entry->second.end(), offset);
+		if (found == entry->second.end())
+		{
+			return false;
 		}
 
-		tablesMeta.erase(tableName);
-		std::ofstream tableFile(META_FILE);
-		tableFile << tablesMeta.dump();
-
-		remove((tableName + TXT_EXT).c_str());
+		// Included values are kept parallel to the offsets of their key value.
+		auto values = includedValues.find(keyValue);
+		if (values != includedValues.end())
+		{
+			values->second.erase(values->second.begin() + (found - entry->second.begin()));
+			if (values->second.empty())
+			{
+				includedValues.erase(values);
+			}
+		}
+		entry->second.erase(found);
+		if (entry->second.empty())
+		{
+			index.erase(entry);
+		}
+		return true;
 	}
 
-	void Database::addKey(std::string tableName, json keysJson, Connection connection)
+	bool Database::removeFromIndex(const std::string& tableName, const std::string& keyName, const json& keyValue,
+		Offset offset)
 	{
-		std::unique_lock lock(mutex_);
-		ensureIsConnected(connection);
-		json tablesMeta = readJsonFromFile(META_FILE);
-		auto newKey = keysJson.items().begin();
-		std::string keyName = newKey.key();
-		tablesMeta[tableName]["keys"][keyName] = newKey.value();
+		Indexes& index = tablesIndexes[tableName][keyName];
+		auto entry = index.find(keyValue);
+		if (entry == index.end())
+		{
+			return false;
+		}
+		auto found = std::find(entry->second.begin(), entry->second.end(), offset);
+		if (found == entry->second.end())
+		{
+			return false;
+		}
+		int position = (int)(found - entry->second.begin());
+		int lastPosition = (int)entry->second.size() - 1;
 
-		std::ifstream tableFileIn(tableName + TXT_EXT);
-		std::string value;
-		auto pos = tableFileIn.tellg();
-		while (std::getline(tableFileIn, value))
+		for (auto& tableCursors : connections)
 		{
-			json entry = json::parse(value), key;
-			for (std::string keyColumn : newKey.value())
+			auto cursor = tableCursors.second.find(tableName);
+			if (cursor == tableCursors.second.end() || cursor->second.keyName != keyName
+				|| cursor->second.offsetIndex == -1 || cursor->second.currentRow != entry)
+			{
+				continue;
+			}
+			Cursor& moved = cursor->second;
+			if (moved.offsetIndex > position)
+			{
+				moved.offsetIndex--;
+			}
+			else if (moved.offsetIndex < position || position < lastPosition)
+			{
+				continue;
+			}
+			else if (std::next(entry) != index.end())
+			{
+				moved.currentRow = std::next(entry);
+				moved.offsetIndex = 0;
+			}
+			else if (position > 0)
 			{
-				key[keyColumn] = entry[keyColumn];
+				moved.offsetIndex--;
 			}
-			auto curr = tablesIndexes[tableName][keyName].find(key);
-			auto end = tablesIndexes[tableName][keyName].end();
-			if (curr == end)
+			else if (entry != index.begin())
 			{
-				tablesIndexes[tableName][keyName][key] = { (unsigned)pos };
+				moved.currentRow = std::prev(entry);
+				moved.offsetIndex = (int)moved.currentRow->second.size() - 1;
 			}
 			else
 			{
-				curr->second.push_back((unsigned)pos);
+				moved.offsetIndex = -1;
 			}
-			pos = tableFileIn.tellg();
 		}
-		tableFileIn.close();
 
-		dumpIndex(tableName, keyName);
+		// Scan cursors hold the position of the row they returned last, and fetch
+		// the one after it.
+		for (auto& connectionCursors : openCursors)
+		{
+			for (auto& [cursorId, cursor] : connectionCursors.second)
+			{
+				if (cursor.tableName != tableName || cursor.keyName != keyName || !cursor.isStarted
+					|| JsonComparator()(cursor.currentKey, entry->first) || JsonComparator()(entry->first, cursor.currentKey)
+					|| cursor.offsetIndex < (size_t)position)
+				{
+					continue;
+				}
+				if (cursor.offsetIndex > 0)
+				{
+					cursor.offsetIndex--;
+				}
+				else if (entry != index.begin())
+				{
+					cursor.currentKey = std::prev(entry)->first;
+					cursor.offsetIndex = std::prev(entry)->second.size() - 1;
+				}
+				else
+				{
+					cursor.isStarted = false;
+				}
+			}
+		}
 
-		std::ofstream tablesMetaFile(META_FILE);
-		tablesMetaFile << tablesMeta.dump();
+		return removeFromIndex(index, tablesIncludedValues[tableName][keyName], keyValue, offset);
 	}
 
-	void Database::removeKey(std::string tableName, std::string keyName, Connection connection)
+	std::vector<std::string> Database::getIncludedColumns(const json& tableMeta, const std::string& keyName)
 	{
-		std::unique_lock lock(mutex_);
-		ensureIsConnected(connection);
-		json tablesMeta = readJsonFromFile(META_FILE);
-		tablesMeta[tableName]["keys"].erase(keyName);
-		std::ofstream tablesMetaFile(META_FILE);
-		tablesMetaFile << tablesMeta.dump();
-
-		tablesIndexes[tableName].erase(keyName);
-
-		std::remove((tableName + "_" + keyName + JSON_EXT).c_str());
+		if (!tableMeta.contains("options") || !tableMeta["options"].contains("include"))
+		{
+			return {};
+		}
+		return tableMeta["options"]["include"].value(keyName, std::vector<std::string>());
 	}
 
-	json Database::getRowByKey(std::string tableName, json keyJson, Connection connection)
+	json Database::readCoveredRow(const std::string& tableName, const std::string& keyName,
+		Indexes::iterator entry, size_t offsetIndex, const std::vector<std::string>& columns)
 	{
-		ensureIsConnected(connection);
-		auto properties = keyJson.items().begin();
-		std::string keyName = properties.key();
+		auto tableIncluded = tablesIncludedValues.find(tableName);
+		if (tableIncluded == tablesIncludedValues.end())
 		{
-			std::unique_lock lock(mutex_);
-			loadIndex(tableName, keyName);
+			return json();
 		}
-
-		std::shared_lock lock(mutex_);
-
-		auto row = tablesIndexes[tableName][keyName].find(properties.value());
-		auto end = tablesIndexes[tableName][keyName].end();
-		if (row == end)
+		auto keyIncluded = tableIncluded->second.find(keyName);
+		if (keyIncluded == tableIncluded->second.end())
 		{
-			throw DatabaseException("Key value not found", ErrorCode::KEY_VALUE_NOT_FOUND);
+			return json();
 		}
-
-		unsigned offset = row->second[0];
-		Cursor currentRow (row, end, 0, keyName);
-		connections[connection.getConnectionId()][tableName] = currentRow;
-
-		return readDataByOffset(tableName, offset);
-	}
-
-	json Database::getRowInSortedTable(std::string tableName, std::string keyName, 
-		bool isReversed, Connection connection)
-	{
-		ensureIsConnected(connection);
+		auto values = keyIncluded->second.find(entry->first);
+		if (values == keyIncluded->second.end() || offsetIndex >= values->second.size())
 		{
-			std::unique_lock lock(mutex_);
-			loadIndex(tableName, keyName);
+			return json();
 		}
-		std::shared_lock lock(mutex_);
 
-		Indexes::iterator row;
-		int offsetIndex;
-
-		if (isReversed)
+		const json& included = values->second[offsetIndex];
+		for (auto& column : columns)
 		{
-			row = --tablesIndexes[tableName][keyName].end();
-			ensureTableIsNotEmpty(row, tablesIndexes[tableName][keyName].end());
-			offsetIndex = row->second.size() - 1;
+			if (!entry->first.contains(column) && !included.contains(column))
+			{
+				return json();
+			}
 		}
-		else 
+		json row = entry->first;
+		for (auto& field : included.items())
 		{
-			row = tablesIndexes[tableName][keyName].begin();
-			ensureTableIsNotEmpty(row, tablesIndexes[tableName][keyName].end());
-			offsetIndex = 0;
+			if (!field.value().is_null())
+			{
+				row[field.key()] = field.value();
+			}
 		}
-		unsigned offset = row->second[offsetIndex];
-
-		Cursor currentRow(row, tablesIndexes[tableName][keyName].end(), offsetIndex, keyName);
-		connections[connection.getConnectionId()][tableName] = currentRow;
-
-		return readDataByOffset(tableName, offset);
+		return row;
 	}
 
-	json Database::getNextRow(std::string tableName, Connection connection)
+	void Database::loadDeletedRows(const std::string& tableName)
 	{
-		std::shared_lock lock(mutex_);
-		unsigned offset = shiftCursorForward(tableName, connection);
-
-		return readDataByOffset(tableName, offset);
+		if (deletedRows.find(tableName) == deletedRows.end())
+		{
+			auto& deleted = deletedRows[tableName];
+			std::string content;
+			storage->read(tableName + DEL_EXT, content);
+			std::istringstream deletedFile(content);
+			Offset offset, length;
+			while (deletedFile >> offset >> length)
+			{
+				deleted[offset] = length;
+			}
+		}
 	}
 
-	json Database::getPrevRow(std::string tableName, Connection connection)
+	void Database::markRowDeleted(const std::string& tableName, Offset offset, Offset length)
 	{
-		std::shared_lock lock(mutex_);
-		unsigned offset = shiftCursorBack(tableName, connection);
-
-		return readDataByOffset(tableName, offset);
+		loadDeletedRows(tableName);
+		deletedRows[tableName][offset] = length;
+		storage->append(tableName + DEL_EXT, std::to_string(offset) + " " + std::to_string(length) + "\n");
 	}
 
-	void Database::appendRow(std::string tableName, json keyJson, json value, Connection connection)
+	void Database::writeDeletedRows(const std::string& tableName, const std::string& fileName)
 	{
-		std::unique_lock lock(mutex_);
-		ensureIsConnected(connection);
-		json tablesMeta = readJsonFromFile(META_FILE);
-		ensureTableExists(tableName, tablesMeta);
+		std::string content;
+		for (auto& [offset, length] : deletedRows[tableName])
+		{
+			content += std::to_string(offset) + " " + std::to_string(length) + "\n";
+		}
+		storage->write(fileName, content);
+	}
 
-		std::ofstream tableFile(tableName + TXT_EXT, std::ios_base::app);
-		tableFile.seekp(0, std::ios::end);
-		auto pos = tableFile.tellp();
+	std::vector<Offset> Database::getRewriteOrder(const std::string& tableName, json& tablesMeta)
+	{
+		json keysJson = tablesMeta[tableName]["keys"];
+		std::string clusterKey = getClusterKey(tablesMeta[tableName]);
 
-		for (auto key : keyJson.items())
+		std::unordered_set<Offset> liveOffsets;
+		for (auto key : keysJson.items())
 		{
-			std::string keyName = key.key();
-			loadIndex(tableName, keyName);
-
-			auto curr = tablesIndexes[tableName][keyName].find(key.value());
-			auto end = tablesIndexes[tableName][keyName].end();
-			if (curr == end)
-			{
-				tablesIndexes[tableName][keyName].insert({ {key.value(), { (unsigned)pos }} });
-			}
-			else
+			loadIndex(tableName, key.key());
+			for (auto& entry : tablesIndexes[tableName][key.key()])
 			{
-				curr->second.push_back((unsigned)pos);
+				liveOffsets.insert(entry.second.begin(), entry.second.end());
 			}
+		}
 
-			dumpIndex(tableName, keyName);
-
-			for (auto field : key.value().items())
+		std::vector<Offset> order;
+		if (!clusterKey.empty())
+		{
+			for (auto& entry : tablesIndexes[tableName][clusterKey])
 			{
-				value[field.key()] = field.value();
+				for (Offset offset : entry.second)
+				{
+					if (liveOffsets.erase(offset))
+					{
+						order.push_back(offset);
+					}
+				}
 			}
 		}
-
-		tableFile << value.dump() << std::endl;
+		std::vector<Offset> unclustered(liveOffsets.begin(), liveOffsets.end());
+		std::sort(unclustered.begin(), unclustered.end());
+		order.insert(order.end(), unclustered.begin(), unclustered.end());
+		return order;
 	}
 
-	void Database::removeRow(std::string tableName, Connection connection)
+	void Database::rewriteTable(const std::string& tableName, json& tablesMeta)
 	{
-		std::unique_lock lock(mutex_);
-		Cursor cursor = getCurrentCursor(tableName, connection);
-
-		unsigned offsetToRemove = cursor.currentRow->second[cursor.offsetIndex];
-		unsigned removedLength = 0;
-		std::ifstream tableFile(tableName + TXT_EXT);
-		tableFile.seekg(offsetToRemove, std::ios::beg);
-		std::string toRemoveStr;
-		std::getline(tableFile, toRemoveStr);
-		unsigned nextEntryOffset = tableFile.tellg();
-		tableFile.close();
-		removedLength = nextEntryOffset - offsetToRemove;
-		json toRemove = json::parse(toRemoveStr);
+		json keysJson = tablesMeta[tableName]["keys"];
+		std::string clusterKey = getClusterKey(tablesMeta[tableName]);
+		std::vector<Offset> order = getRewriteOrder(tableName, tablesMeta);
+		std::unordered_set<Offset> liveOffsets;
+		if (clusterKey.empty())
+		{
+			liveOffsets.insert(order.begin(), order.end());
+		}
 
-		try
+		unsigned partitionCount = getPartitionCount(tablesMeta[tableName]);
+		std::vector<std::string> pendingOut(partitionCount);
+		std::vector<Offset> lengthsOut(partitionCount, 0);
+		for (unsigned partition = 0; partition < partitionCount; partition++)
 		{
-			shiftCursorForward(tableName, connection);
+			storage->write(getTableFileName(tableName, partition) + TMP_EXT, "");
 		}
-		catch (DatabaseLib::DatabaseException ex)
+		auto writeOut = [&](unsigned partition, std::string_view line)
 		{
-			try
+			pendingOut[partition].append(line);
+			pendingOut[partition].push_back('\n');
+			lengthsOut[partition] += line.size() + 1;
+			if (pendingOut[partition].size() >= CHECKPOINT_CHUNK_SIZE)
 			{
-				shiftCursorBack(tableName, connection);
+				storage->append(getTableFileName(tableName, partition) + TMP_EXT, pendingOut[partition]);
+				pendingOut[partition].clear();
 			}
-			catch (DatabaseLib::DatabaseException ex) {}
-		}
+		};
 
-		json tablesMeta = readJsonFromFile(META_FILE);
-		json associatedKeys = tablesMeta[tableName]["keys"];
-		for (auto key : associatedKeys.items())
+		// Without a clustering key rows keep their file order, so each partition
+		// is streamed sequentially instead of seeking row by row.
+		std::unordered_map<Offset, Offset> newOffsets;
+		if (clusterKey.empty())
 		{
-			std::string keyName = key.key();
-			json keyValue;
-			for (std::string keyColumn : key.value()) 
-			{
-				keyValue[keyColumn] = toRemove[keyColumn];
-			}
-			auto entry = tablesIndexes[tableName][keyName][keyValue];
-			if (entry.size() == 1)
-			{
-				tablesIndexes[tableName][keyName].erase(keyValue);
-			}
-			else
-			{
-				entry.erase(std::remove(entry.begin(), entry.end(), offsetToRemove), entry.end());
-			}
-			for (auto& entry : tablesIndexes[tableName][keyName])
+			for (unsigned partition = 0; partition < partitionCount; partition++)
 			{
-				for (auto& offset : entry.second) {
-					if (offset > offsetToRemove)
+				TableScanner scanner(*storage, getTableFileName(tableName, partition), &stats);
+				std::vector<ScannedRow> rows;
+				while (scanner.nextBatch(rows))
+				{
+					for (auto& row : rows)
 					{
-						offset -= removedLength;
+						Offset location = toLocation(partition, row.position);
+						if (liveOffsets.find(location) != liveOffsets.end())
+						{
+							newOffsets[location] = toLocation(partition, lengthsOut[partition]);
+							writeOut(partition, row.line);
+						}
 					}
 				}
 			}
-			dumpIndex(tableName, keyName);
+		}
+		else
+		{
+			for (Offset offset : order)
+			{
+				unsigned partition = getPartition(offset);
+				newOffsets[offset] = toLocation(partition, lengthsOut[partition]);
+				std::string value = storage->readLine(getTableFileName(tableName, partition), getPosition(offset));
+				stats.increment(Counter::BYTES_READ, value.size() + 1);
+				writeOut(partition, value);
+			}
 		}
 
-		std::ifstream tableFileIn(tableName + TXT_EXT);
-		std::string value, rest;
-		auto currOffset = tableFileIn.tellg();
-		while (std::getline(tableFileIn, value))
+		json sortedLengths = json::array();
+		for (unsigned partition = 0; partition < partitionCount; partition++)
+		{
+			sortedLengths.push_back(lengthsOut[partition]);
+			storage->append(getTableFileName(tableName, partition) + TMP_EXT, pendingOut[partition]);
+			storage->rename(getTableFileName(tableName, partition) + TMP_EXT, getTableFileName(tableName, partition));
+		}
+
+		for (auto key : keysJson.items())
 		{
-			if ((unsigned)currOffset != offsetToRemove)
+			for (auto& entry : tablesIndexes[tableName][key.key()])
 			{
-				rest.append(value);
-				rest.append("\n");
+				for (auto& offset : entry.second)
+				{
+					offset = newOffsets[offset];
+				}
 			}
-			currOffset = (unsigned)tableFileIn.tellg();
+			dumpIndex(tableName, key.key());
 		}
-		tableFileIn.close();
 
-		std::ofstream tableFileOut(tableName + TXT_EXT);
-		tableFileOut << rest;
+		deletedRows[tableName].clear();
+		storage->remove(tableName + DEL_EXT);
+		tableRewrites[tableName]++;
+
+		if (!clusterKey.empty())
+		{
+			tablesMeta[tableName]["sortedLengths"] = sortedLengths;
+		}
 	}
 
-	json Database::readJsonFromFile(std::string fileName)
+	std::string Database::getExpiryColumn(const std::string& tableName)
 	{
-		json result;
-		std::ifstream file(fileName);
+		auto tableMeta = catalog.find(tableName);
+		if (tableMeta == catalog.end() || !tableMeta->contains("options") || !(*tableMeta)["options"].contains("ttl"))
+		{
+			return "";
+		}
+		return (*tableMeta)["options"]["ttl"].value("column", "expiresAt");
+	}
 
-		if (file.is_open())
+	void Database::applyDefaultTtl(const json& tableMeta, json& value)
+	{
+		if (!tableMeta.contains("options") || !tableMeta["options"].contains("ttl"))
 		{
-			std::stringstream fileContent;
-			fileContent << file.rdbuf();
-			result = json::parse(fileContent.str());
+			return;
+		}
+		const json& ttl = tableMeta["options"]["ttl"];
+		std::string column = ttl.value("column", "expiresAt");
+		if (ttl.contains("seconds") && !value.contains(column))
+		{
+			auto now = std::chrono::system_clock::now().time_since_epoch();
+			value[column] = std::chrono::duration_cast<std::chrono::seconds>(now).count() + ttl["seconds"].get<double>();
 		}
-		return result;
 	}
 
-	json Database::readDataByOffset(std::string tableName, unsigned offset)	
+	bool Database::isExpired(const std::string& expiryColumn, const json& row)
 	{
-		std::ifstream tableFile(tableName + TXT_EXT);
-		tableFile.seekg(offset, std::ios::beg);
-		std::string value;
-		std::getline(tableFile, value);
-		return json::parse(value);
+		if (expiryColumn.empty())
+		{
+			return false;
+		}
+		auto expiresAt = row.find(expiryColumn);
+		return expiresAt != row.end() && expiresAt->is_number()
+			&& expiresAt->get<double>() <= std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
 	}
 
-	void Database::loadIndex(std::string tableName, std::string keyName)
+	json Database::skipExpiredRows(const std::string& tableName, Offset offset, bool isForward, Connection connection)
 	{
-		if (tablesIndexes.find(tableName) == tablesIndexes.end() || 
-			tablesIndexes[tableName].find(keyName) == tablesIndexes[tableName].end())
+		std::string expiryColumn = getExpiryColumn(tableName);
+		json row = readDataByOffset(tableName, offset);
+		while (isExpired(expiryColumn, row))
 		{
-			json indexes = readJsonFromFile(tableName + "_" + keyName + JSON_EXT);
-			if (indexes.is_null())
-			{
-				throw DatabaseException("Table or key not found: " + tableName + ", " + keyName, ErrorCode::NOT_FOUND);
-			}
-			std::unordered_map<std::string, std::map<json, std::vector<unsigned>, JsonComparator>> keysMap;
+			offset = isForward ? shiftCursorForward(tableName, connection) : shiftCursorBack(tableName, connection);
+			row = readDataByOffset(tableName, offset);
+		}
+		return row;
+	}
+
+	std::string Database::getClusterKey(const json& tableMeta)
+	{
+		if (tableMeta.contains("options") && tableMeta["options"].contains("clusterKey"))
+		{
+			return tableMeta["options"]["clusterKey"];
+		}
+		return "";
+	}
+
+	unsigned Database::getPartitionCount(const json& tableMeta)
+	{
+		if (!tableMeta.contains("options") || !tableMeta["options"].contains("partitioning"))
+		{
+			return 1;
+		}
+		json partitioning = tableMeta["options"]["partitioning"];
+		if (partitioning.value("type", "hash") == "range")
+		{
+			return (unsigned)partitioning.value("bounds", json::array()).size() + 1;
+		}
+		return partitioning.value("count", 1u);
+	}
+
+	unsigned Database::choosePartition(const json& tableMeta, const json& row)
+	{
+		unsigned partitionCount = getPartitionCount(tableMeta);
+		if (partitionCount == 1)
+		{
+			return 0;
+		}
+		const json& partitioning = tableMeta.at("options").at("partitioning");
+		json value = row.value(partitioning.at("column").get<std::string>(), json());
+		if (partitioning.value("type", "hash") == "range")
+		{
+			const json& bounds = partitioning.at("bounds");
+			return (unsigned)(std::upper_bound(bounds.begin(), bounds.end(), value) - bounds.begin());
+		}
+		return std::hash<json>{}(value) % partitionCount;
+	}
+
+	std::string Database::getTableFileName(const std::string& tableName, unsigned partition)
+	{
+		return partition == 0 ? tableName + TXT_EXT : tableName + "." + std::to_string(partition) + TXT_EXT;
+	}
 
-			for (auto& index : indexes)
+	Offset Database::toLocation(unsigned partition, Offset position)
+	{
+		return ((Offset)partition << PARTITION_SHIFT) | position;
+	}
+
+	unsigned Database::getPartition(Offset location)
+	{
+		return (unsigned)(location >> PARTITION_SHIFT);
+	}
+
+	Offset Database::getPosition(Offset location)
+	{
+		return location & (((Offset)1 << PARTITION_SHIFT) - 1);
+	}
+
+	json Database::projectRow(json row, const json& projection)
+	{
+		if (!projection.is_array() || projection.empty())
+		{
+			return row;
+		}
+		json projected = json::object();
+		for (std::string column : projection)
+		{
+			if (row.contains(column))
 			{
-				auto keyValue = index.items().begin();
-				keysMap[keyValue.key()][keyValue.value()] = index["offsets"].get<std::vector<unsigned>>();		
+				projected[column] = row[column];
 			}
-			tablesIndexes[tableName][keyName] = keysMap[keyName];
 		}
+		return projected;
+	}
+
+	bool Database::isLogEngine(const json& tableMeta)
+	{
+		return tableMeta.contains("options") && tableMeta["options"].value("engine", "file") == "log";
 	}
 
-	void Database::dumpIndex(std::string tableName, std::string keyName)
+	bool Database::isWriteDeferred(const json& tableMeta)
 	{
-		json index = json::array();
-		for (auto kv : tablesIndexes[tableName][keyName])
+		return isLogEngine(tableMeta) || maintenance != nullptr;
+	}
+
+	Indexes& Database::getLoadedIndex(const std::string& tableName, const std::string& keyName)
+	{
+		auto table = tablesIndexes.find(tableName);
+		if (table == tablesIndexes.end() || table->second.find(keyName) == table->second.end())
 		{
-			index.push_back({ { keyName, kv.first }, { "offsets", kv.second } });
+			throw DatabaseException("Key not found: " + keyName, ErrorCode::KEY_NOT_FOUND);
 		}
-		std::ofstream indexFile(tableName + "_" + keyName + JSON_EXT);
-		indexFile << index.dump();
+		return table->second.find(keyName)->second;
 	}
 
-	void Database::ensureKeyIsFound(std::string tableName, std::string key)
+	void Database::ensureKeyIsFound(const std::string& tableName, const std::string& key)
 	{
 		if (tablesIndexes[tableName].find(key) == tablesIndexes[tableName].end())
 		{
@@ -366,9 +3247,9 @@ namespace DatabaseLib
 		}
 	}
 
-	void Database::ensureDataIsAvailable(Cursor cursor)
+	void Database::ensureDataIsAvailable(Indexes::iterator row, Indexes::iterator end)
 	{
-		if (cursor.currentRow == cursor.end)
+		if (row == end)
 		{
 			throw DatabaseException("No more data available", ErrorCode::NO_MORE_DATA_AVAILABLE);
 		}
@@ -382,7 +3263,7 @@ namespace DatabaseLib
 		}
 	}
 
-	void Database::ensureTableExists(std::string tableName, json tablesMeta)
+	void Database::ensureTableExists(const std::string& tableName, const json& tablesMeta)
 	{
 		if (tablesMeta.is_null() || tablesMeta.empty() || !tablesMeta.contains(tableName))
 		{
@@ -398,13 +3279,12 @@ namespace DatabaseLib
 		}
 	}
 
-	Cursor Database::getCurrentCursor(std::string tableName, Connection connection)
+	Cursor& Database::getCurrentCursor(const std::string& tableName, Connection connection)
 	{
 		ensureIsConnected(connection);
-		json tablesMeta = readJsonFromFile(META_FILE);
-		ensureTableExists(tableName, tablesMeta);
+		ensureTableExists(tableName, catalog);
 		
-		Cursor cursor = connections[connection.getConnectionId()][tableName];
+		Cursor& cursor = connections[connection.getConnectionId()][tableName];
 		if (cursor.offsetIndex == -1)
 		{
 			throw DatabaseException("Cursor wasn't opened", ErrorCode::CURSOR_NOT_OPENED);
@@ -414,40 +3294,64 @@ namespace DatabaseLib
 		return cursor;
 	}
 
-	unsigned Database::shiftCursorBack(std::string tableName, Connection connection)
+	ScanCursor& Database::getScanCursor(CursorId cursorId, Connection connection)
+	{
+		auto cursors = openCursors.find(connection.getConnectionId());
+		if (cursors == openCursors.end() || cursors->second.find(cursorId) == cursors->second.end())
+		{
+			throw DatabaseException("Cursor wasn't opened", ErrorCode::CURSOR_NOT_OPENED);
+		}
+		return cursors->second.find(cursorId)->second;
+	}
+
+	CursorId Database::addScanCursor(const std::string& tableName, const std::string& keyName, json lowerBound,
+		json upperBound, Connection connection)
+	{
+		CursorId cursorId = nextCursorId++;
+		ScanCursor& cursor = openCursors[connection.getConnectionId()][cursorId];
+		cursor.tableName = tableName;
+		cursor.keyName = keyName;
+		cursor.lowerBound = std::move(lowerBound);
+		cursor.upperBound = std::move(upperBound);
+		return cursorId;
+	}
+
+	Offset Database::shiftCursorBack(const std::string& tableName, Connection connection)
 	{
-		Cursor cursor = getCurrentCursor(tableName, connection);
+		Cursor& cursor = getCurrentCursor(tableName, connection);
 
 		if (cursor.offsetIndex == 0)
 		{
-			cursor.currentRow--;
-			ensureDataIsAvailable(cursor);
-			auto offsets = cursor.currentRow->second;
-			cursor.offsetIndex = offsets.size() - 1;
+			if (cursor.currentRow == getLoadedIndex(tableName, cursor.keyName).begin())
+			{
+				throw DatabaseException("No more data available", ErrorCode::NO_MORE_DATA_AVAILABLE);
+			}
+			auto previousRow = std::prev(cursor.currentRow);
+			cursor.currentRow = previousRow;
+			cursor.offsetIndex = (int)cursor.currentRow->second.size() - 1;
 		}
 		else
 		{
 			cursor.offsetIndex--;
 		}
-		connections[connection.getConnectionId()][tableName] = cursor;
 		return cursor.currentRow->second[cursor.offsetIndex];
 	}
 
-	unsigned Database::shiftCursorForward(std::string tableName, Connection connection)
+	Offset Database::shiftCursorForward(const std::string& tableName, Connection connection)
 	{
-		Cursor cursor = getCurrentCursor(tableName, connection);
+		Cursor& cursor = getCurrentCursor(tableName, connection);
 
 		if ((unsigned)cursor.offsetIndex >= cursor.currentRow->second.size() - 1)
 		{
-			cursor.currentRow++;
-			ensureDataIsAvailable(cursor);
-			cursor.offsetIndex = 0u;
+			auto nextRow = std::next(cursor.currentRow);
+			ensureDataIsAvailable(nextRow, cursor.end);
+			cursor.currentRow = nextRow;
+			cursor.offsetIndex = 0;
 		}
 		else
 		{
 			cursor.offsetIndex++;
 		}
-		connections[connection.getConnectionId()][tableName] = cursor;
-		return (cursor.currentRow->second)[cursor.offsetIndex];
+		return cursor.currentRow->second[cursor.offsetIndex];
 	}
 }
\ No newline at end of file
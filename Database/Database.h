@@ -2,53 +2,282 @@
 #include <map>
 #include <vector>
 #include <shared_mutex>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <unordered_set>
 #include "Connection.h"
 #include "JsonComparator.h"
+#include "OffsetsCodec.h"
 #include "Cursor.h"
+#include "ContinuationToken.h"
 #include "DatabaseException.h"
+#include "Predicate.h"
+#include "TableScanner.h"
+#include "ChangeStream.h"
+#include "MaintenanceScheduler.h"
+#include "Stats.h"
 
 namespace DatabaseLib
 {
+	struct LoadedIndex
+	{
+		Indexes index;
+		IncludedValues includedValues;
+		unsigned logSize = 0;
+	};
+
 	class DATABASE_API Database
 	{
 	private:
-		mutable std::shared_mutex mutex_;
+		mutable Stats stats;
+		mutable InstrumentedMutex mutex_{ stats };
 
 		std::string META_FILE = "tables_meta.json";
 		std::string TXT_EXT = ".txt";
 		std::string JSON_EXT = ".json";
+		std::string TMP_EXT = ".tmp";
+		std::string LOG_EXT = ".log";
+		std::string DEL_EXT = ".del";
+		std::string COLUMNS_EXT = ".columns";
+		std::string REPLICA_FILE = "replica.json";
+
+		Offset CLUSTER_TAIL_MIN_SIZE = 1u << 20;
+		unsigned INDEX_LOG_MIN_SIZE = 1u << 12;
+		Offset DELETED_ROWS_MIN_SIZE = 1u << 20;
+		unsigned PARTITION_SHIFT = 56;
+		unsigned MAX_PARTITIONS = 256;
+		Offset CHECKPOINT_CHUNK_SIZE = 1u << 20;
+		unsigned CHECKPOINT_MAX_ATTEMPTS = 3;
+
+		std::shared_ptr<Storage> storage;
 
 		std::unordered_map<unsigned, std::unordered_map<std::string, Cursor>> connections;
+		std::unordered_map<unsigned, std::unordered_map<CursorId, ScanCursor>> openCursors;
+		CursorId nextCursorId = 1;
 
 		std::unordered_map<std::string, std::unordered_map<std::string, Indexes>> tablesIndexes;
+		std::unordered_map<std::string, std::unordered_map<std::string, unsigned>> indexLogSizes;
+		std::unordered_map<std::string, std::unordered_map<std::string, Offset>> indexRowCounts;
+		std::unordered_map<std::string, std::unordered_map<Offset, Offset>> deletedRows;
+		std::unordered_map<std::string, json> tablesColumns;
+		std::unordered_map<std::string, std::unordered_map<std::string, IncludedValues>> tablesIncludedValues;
+		std::unordered_map<std::string, unsigned> tableRewrites;
+		std::unordered_map<std::string, unsigned> tableOverwrites;
+
+		std::unique_ptr<ChangeStream> changeStream;
+		std::map<std::uint64_t, std::function<void(const json&)>> changeSubscribers;
+		std::uint64_t nextSubscriberId = 1;
+		std::uint64_t changeSequence = 0;
+		std::uint64_t appliedSequence = 0;
+		// Serializes applyChanges callers. The change being applied is recorded
+		// with how many rows matched it beforehand, so after a crash it is only
+		// applied again when its effect is missing.
+		std::mutex applyMutex;
+		json applyingChange;
+
+		std::thread expiryReaper;
+		std::mutex expiryReaperMutex;
+		std::condition_variable expiryReaperWakeup;
+		bool isExpiryReaperStopping = false;
+
+		std::unique_ptr<MaintenanceScheduler> maintenance;
+		Offset maintenanceBytesPerSecond = 0;
+		// Counts writes of each index file, so a background fold that started
+		// from an older index drops its result.
+		std::unordered_map<std::string, std::unordered_map<std::string, unsigned>> indexDumps;
+		// Rows overwritten in place while a background rewrite of their table
+		// copies it; they are copied again before the new file is installed.
+		std::unordered_map<std::string, std::unordered_set<Offset>> overwrittenDuringRewrite;
 
-		json readJsonFromFile(std::string fileName);
-		void loadIndex(std::string tableName, std::string keyName);
-		void dumpIndex(std::string tableName, std::string keyName);
-		json readDataByOffset(std::string tableName, unsigned offset);
-		void ensureKeyIsFound(std::string tableName, std::string key);
-		void ensureDataIsAvailable(Cursor cursor);
+		// Tables meta is read once at construction and written through on every
+		// change, so a data directory should be opened by one Database at a time.
+		json catalog;
+
+		json readJsonFromFile(const std::string& fileName);
+		void loadCatalog();
+		void saveCatalog();
+		void loadIndex(const std::string& tableName, const std::string& keyName);
+		bool isIndexLoaded(const std::string& tableName, const std::string& keyName);
+		LoadedIndex readIndex(const std::string& tableName, const std::string& keyName);
+		void installIndex(const std::string& tableName, const std::string& keyName, LoadedIndex loaded);
+		void warmIndex(const std::string& tableName, const std::string& keyName);
+		void dumpIndex(const std::string& tableName, const std::string& keyName);
+		void writeIndex(const std::string& tableName, const std::string& keyName, const std::string& fileName);
+		std::string serializeIndex(const std::string& tableName, const std::string& keyName);
+		static std::string serializeIndex(const std::string& keyName, const Indexes& index,
+			const IncludedValues* included, bool isCompressed);
+		void foldIndex(const std::string& tableName, const std::string& keyName, MaintenanceTask& task);
+		void scheduleRewrite(const std::string& tableName);
+		void rewriteInBackground(const std::string& tableName, MaintenanceTask& task);
+		unsigned getContentGeneration(const std::string& tableName);
+		bool copyTableFiles(const std::string& tableName, const std::vector<Offset>& lengths,
+			const std::string& directory, unsigned generation, bool isLocked, Offset bytesPerSecond,
+			std::chrono::steady_clock::time_point started, Offset& copied);
+		void appendIndexLog(const std::string& tableName, const std::string& keyName, const std::string& operation,
+			const json& keyValue, Offset offset, const json& included);
+		static void insertIntoIndex(Indexes& index, IncludedValues& includedValues, const json& keyValue, Offset offset,
+			const json& included);
+		// Returns false when the offset was not indexed under keyValue.
+		static bool removeFromIndex(Indexes& index, IncludedValues& includedValues, const json& keyValue, Offset offset);
+		// Removes the offset from a loaded index and first moves every cursor in
+		// its key value, so they keep their place; a cursor on the removed row
+		// goes to the next row, or to the previous one at the end of the index.
+		bool removeFromIndex(const std::string& tableName, const std::string& keyName, const json& keyValue, Offset offset);
+		std::vector<std::string> getIncludedColumns(const json& tableMeta, const std::string& keyName);
+		json readCoveredRow(const std::string& tableName, const std::string& keyName, Indexes::iterator entry,
+			size_t offsetIndex, const std::vector<std::string>& columns);
+		void loadDeletedRows(const std::string& tableName);
+		void markRowDeleted(const std::string& tableName, Offset offset, Offset length);
+		void writeDeletedRows(const std::string& tableName, const std::string& fileName);
+		std::vector<Offset> getRewriteOrder(const std::string& tableName, json& tablesMeta);
+		void rewriteTable(const std::string& tableName, json& tablesMeta);
+		void insertRow(const std::string& tableName, const json& keys, json value);
+		void rewriteRow(const std::string& tableName, Cursor& cursor, const json& fields);
+		void compactDeletedRows(const std::string& tableName);
+		bool isRecordingChanges();
+		void recordChange(json change);
+		json getKeyValue(const json& tableMeta, const std::string& keyName, const json& row);
+		void positionOnRow(const std::string& tableName, const std::string& keyName, const json& keyValue,
+			const json& row, Connection connection);
+		void applyChange(const json& change, Connection connection);
+		Offset countMatchingRows(const std::string& tableName, const std::string& keyName, const json& keyValue,
+			const json& fields);
+		Offset countChangedRows(const json& change);
+		bool isChangeApplied(const json& change, Offset matches);
+		std::string getExpiryColumn(const std::string& tableName);
+		void applyDefaultTtl(const json& tableMeta, json& value);
+		bool isExpired(const std::string& expiryColumn, const json& row);
+		json skipExpiredRows(const std::string& tableName, Offset offset, bool isForward, Connection connection);
+		std::string getClusterKey(const json& tableMeta);
+		// Each partition has its own data file, but writers to any partition
+		// still take the database lock, since the indexes, deleted rows and
+		// catalog entry they update are shared by the whole table.
+		unsigned getPartitionCount(const json& tableMeta);
+		unsigned choosePartition(const json& tableMeta, const json& row);
+		std::string getTableFileName(const std::string& tableName, unsigned partition);
+		Offset toLocation(unsigned partition, Offset position);
+		unsigned getPartition(Offset location);
+		Offset getPosition(Offset location);
+		json projectRow(json row, const json& projection);
+		bool isLogEngine(const json& tableMeta);
+		bool isWriteDeferred(const json& tableMeta);
+		json readDataByOffset(const std::string& tableName, Offset offset);
+		void loadColumns(const std::string& tableName);
+		bool isCompressed(const std::string& tableName);
+		std::string encodeRow(const std::string& tableName, const json& value);
+		json decodeRow(const std::string& tableName, std::string_view line);
+		json extractKey(const std::string& tableName, std::string_view line,
+			const std::vector<std::string>& keyColumns);
+		std::pair<double, Offset> sumColumn(const std::string& tableName, const std::string& column,
+			const json& predicateJson, Connection connection);
+		Indexes& getLoadedIndex(const std::string& tableName, const std::string& keyName);
+		void ensureKeyIsFound(const std::string& tableName, const std::string& key);
+		void ensureDataIsAvailable(Indexes::iterator row, Indexes::iterator end);
 		void ensureIsConnected(Connection connection);
-		void ensureTableExists(std::string tableName, json tablesMeta);
+		void ensureTableExists(const std::string& tableName, const json& tablesMeta);
 		void ensureTableIsNotEmpty(Indexes::iterator row, Indexes::iterator end);
-		Cursor getCurrentCursor(std::string tableName, Connection connection);
-		unsigned shiftCursorBack(std::string tableName, Connection connection);
-		unsigned shiftCursorForward(std::string tableName, Connection connection);
+		Cursor& getCurrentCursor(const std::string& tableName, Connection connection);
+		ScanCursor& getScanCursor(CursorId cursorId, Connection connection);
+		CursorId addScanCursor(const std::string& tableName, const std::string& keyName, json lowerBound,
+			json upperBound, Connection connection);
+		Offset shiftCursorBack(const std::string& tableName, Connection connection);
+		Offset shiftCursorForward(const std::string& tableName, Connection connection);
 	public:
+		Database();
+		explicit Database(bool isWarmedUp);
+		explicit Database(std::shared_ptr<Storage> storage, bool isWarmedUp = false);
+		~Database();
+
 		Connection connect();
 		void disconnect(Connection connection);
-		void createTable(std::string tableName, json keysJson, Connection connection);
-		void removeTable(std::string tableName, Connection connection);
-		void addKey(std::string tableName, json keysJson, Connection connection);
-		void removeKey(std::string tableName, std::string keyName, Connection connection);
+		void createTable(const std::string& tableName, const json& keysJson, Connection connection);
+		void createTable(const std::string& tableName, const json& keysJson, const json& options,
+			Connection connection);
+		void removeTable(const std::string& tableName, Connection connection);
+		void addKey(const std::string& tableName, const json& keysJson, Connection connection);
+		void addKey(const std::string& tableName, const json& keysJson, const json& includedColumns,
+			Connection connection);
+		void removeKey(const std::string& tableName, const std::string& keyName, Connection connection);
+		void reorganizeTable(const std::string& tableName, Connection connection);
+		void checkpoint(const std::string& directory, Offset bytesPerSecond, Connection connection);
 
-		json getRowByKey(std::string tableName, json keyJson, Connection connection);
-		json getRowInSortedTable(std::string tableName, std::string keyName,
+		json getRowByKey(const std::string& tableName, const json& keyJson, Connection connection);
+		json getRowByKey(const std::string& tableName, const json& keyJson, const json& projection,
+			Connection connection);
+		json getRowInSortedTable(const std::string& tableName, const std::string& keyName,
 			bool isReversed, Connection connection);
-		json getNextRow(std::string tableName, Connection connection);
-		json getPrevRow(std::string tableName, Connection connection);
+		json getNextRow(const std::string& tableName, Connection connection);
+		json getPrevRow(const std::string& tableName, Connection connection);
+		CursorId openCursor(const std::string& tableName, const std::string& keyName, Connection connection);
+		std::vector<CursorId> splitScan(const std::string& tableName, const std::string& keyName, unsigned parts,
+			Connection connection);
+		json fetchRow(CursorId cursorId, Connection connection);
+		void closeCursor(CursorId cursorId, Connection connection);
+		json getPage(const std::string& tableName, const std::string& keyName, unsigned pageSize,
+			const std::string& continuationToken, Connection connection);
+		json find(const std::string& tableName, const json& predicate, const json& projection, unsigned limit,
+			Connection connection);
+		// Returns {"rows", "continuationToken"}; the token resumes the search after
+		// the limit was reached and is empty once there are no more rows.
+		json find(const std::string& tableName, const json& predicate, const json& projection, unsigned limit,
+			const std::string& continuationToken, Connection connection);
+
+		Offset count(const std::string& tableName, const std::string& keyName, Connection connection);
+		Offset count(const std::string& tableName, const std::string& keyName, const json& from, const json& to,
+			Connection connection);
+		json minKey(const std::string& tableName, const std::string& keyName, Connection connection);
+		json maxKey(const std::string& tableName, const std::string& keyName, Connection connection);
+		void join(const std::string& leftTableName, const std::string& rightTableName,
+			const std::string& rightKeyName, unsigned batchSize, std::function<bool(json)> onBatch,
+			Connection connection);
+		json sum(const std::string& tableName, const std::string& column, const json& predicate,
+			Connection connection);
+		json avg(const std::string& tableName, const std::string& column, const json& predicate,
+			Connection connection);
+
+		void appendRow(const std::string& tableName, const json& keys, json value, Connection connection);
+		void removeRow(const std::string& tableName, Connection connection);
+		void updateRow(const std::string& tableName, const json& fields, Connection connection);
+		void upsert(const std::string& tableName, const json& keys, json value, Connection connection);
+
+		// Rows of a table created with the "ttl" option expire once the time in
+		// its expiry column, in seconds since the Unix epoch, has passed. Reads
+		// skip expired rows; count, minKey and maxKey include them until reaped.
+		Offset reapExpiredRows(const std::string& tableName, unsigned batchSize, Connection connection);
+		void enableExpiryReaper(unsigned batchSize, std::uint64_t intervalMilliseconds);
+		void disableExpiryReaper();
+
+		// Changes are recorded to the stream file and passed to subscribers once a
+		// stream is enabled or a subscriber is added. Subscribers are called under
+		// the exclusive lock and must not call back into the database.
+		void enableChangeStream(const std::string& fileName);
+		void disableChangeStream();
+		json readChanges(std::uint64_t afterSequence, unsigned limit);
+		std::uint64_t subscribe(std::function<void(const json&)> onChange);
+		void unsubscribe(std::uint64_t subscriptionId);
+		// Applies changes read from another database's stream, skipping those
+		// already applied; the last applied sequence survives restarts, and a
+		// change interrupted by a crash is not applied twice. Callers are
+		// serialized. An unknown operation throws INVALID_OPTIONS.
+		std::uint64_t applyChanges(const json& changes, Connection connection);
+		std::uint64_t getAppliedSequence();
+
+		// With maintenance enabled, tables of both engines log index changes and
+		// leave removed rows in place, as log tables do; folding index logs,
+		// compacting tables and merging clustered tails run on the scheduler's
+		// workers. Options: "workers", "bytesPerSecond" and "cpuShare".
+		void enableMaintenance(const json& options);
+		void disableMaintenance();
+		void scheduleCheckpoint(const std::string& directory);
+		json getMaintenanceProgress();
 
-		void appendRow(std::string tableName, json keys, json value, Connection connection);
-		void removeRow(std::string tableName, Connection connection);
+		json getStats();
+		void enableSlowOperationLog(const std::string& fileName, std::uint64_t thresholdMicroseconds);
+		void disableSlowOperationLog();
+		void enableLockProfiler(bool isEnabled);
+		json getLockProfile();
 	};
 }
\ No newline at end of file
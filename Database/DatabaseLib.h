@@ -1,8 +1,12 @@
 #pragma once
+#ifdef _MSC_VER
 #pragma warning (disable : 4251)
 #pragma warning (disable: 4275)
+#endif
 
-#ifdef DATABASE_EXPORTS
+#if !defined(_WIN32)
+#define DATABASE_API
+#elif defined(DATABASE_EXPORTS)
 #define DATABASE_API __declspec(dllexport)
 #else
 #define DATABASE_API __declspec(dllimport)
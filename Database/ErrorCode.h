@@ -12,6 +12,11 @@ namespace DatabaseLib
 		KEY_VALUE_NOT_FOUND,
 		TABLE_IS_EMPTY,
 		CURSOR_NOT_OPENED,
-		NO_MORE_DATA_AVAILABLE
+		NO_MORE_DATA_AVAILABLE,
+		INVALID_OPTIONS,
+		INVALID_PREDICATE,
+		INVALID_CONTINUATION_TOKEN,
+		CHANGES_MISSING,
+		TABLE_REWRITTEN
 	};
 }
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include "pch.h"
+#include "MaintenanceScheduler.h"
+#include <algorithm>
+#include <exception>
+
+namespace DatabaseLib
+{
+	TokenBucket::TokenBucket(double rate)
+		: rate(rate), tokens(rate), refilled(std::chrono::steady_clock::now())
+	{}
+
+	std::chrono::microseconds TokenBucket::spend(double amount)
+	{
+		if (rate <= 0)
+		{
+			return std::chrono::microseconds(0);
+		}
+		std::lock_guard lock(mutex);
+		auto now = std::chrono::steady_clock::now();
+		tokens = std::min(rate, tokens + rate * std::chrono::duration<double>(now - refilled).count());
+		refilled = now;
+		tokens -= amount;
+		if (tokens >= 0)
+		{
+			return std::chrono::microseconds(0);
+		}
+		return std::chrono::microseconds((long long)(-tokens / rate * 1000000));
+	}
+
+	MaintenanceTask::MaintenanceTask(MaintenanceScheduler& scheduler, std::string name, MaintenancePriority priority,
+		std::function<void(MaintenanceTask&)> work)
+		: scheduler(scheduler), name(std::move(name)), priority(priority), work(std::move(work))
+	{}
+
+	void MaintenanceTask::throttle(Offset bytes)
+	{
+		auto now = std::chrono::steady_clock::now();
+		auto ran = std::chrono::duration_cast<std::chrono::microseconds>(now - charged);
+		auto delay = std::max(scheduler.diskBudget.spend((double)bytes), scheduler.cpuBudget.spend((double)ran.count()));
+		scheduler.wait(delay);
+		charged = std::chrono::steady_clock::now();
+	}
+
+	void MaintenanceTask::setProgress(Offset done, Offset total)
+	{
+		this->done = done;
+		this->total = total;
+	}
+
+	MaintenanceScheduler::MaintenanceScheduler(unsigned workerCount, Offset bytesPerSecond, double cpuShare)
+		: diskBudget((double)bytesPerSecond), cpuBudget(cpuShare * 1000000)
+	{
+		for (unsigned i = 0; i < workerCount; i++)
+		{
+			workers.emplace_back(&MaintenanceScheduler::runWorker, this);
+		}
+	}
+
+	MaintenanceScheduler::~MaintenanceScheduler()
+	{
+		{
+			std::lock_guard lock(mutex);
+			isStopping = true;
+		}
+		wakeup.notify_all();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	bool MaintenanceScheduler::schedule(const std::string& name, MaintenancePriority priority,
+		std::function<void(MaintenanceTask&)> work)
+	{
+		{
+			std::lock_guard lock(mutex);
+			for (auto& task : queued)
+			{
+				if (task.second->name == name)
+				{
+					return false;
+				}
+			}
+			queued.emplace(priority, std::make_shared<MaintenanceTask>(*this, name, priority, std::move(work)));
+		}
+		wakeup.notify_all();
+		return true;
+	}
+
+	json MaintenanceScheduler::getProgress()
+	{
+		static const char* priorities[] = { "high", "normal", "low" };
+		std::lock_guard lock(mutex);
+		json waiting = json::array();
+		for (auto& task : queued)
+		{
+			waiting.push_back({ {"name", task.second->name}, {"priority", priorities[(size_t)task.first]} });
+		}
+		json active = json::array();
+		auto now = std::chrono::steady_clock::now();
+		for (auto& task : running)
+		{
+			active.push_back({
+				{"name", task->name},
+				{"priority", priorities[(size_t)task->priority]},
+				{"done", task->done.load()},
+				{"total", task->total.load()},
+				{"elapsedMilliseconds", std::chrono::duration_cast<std::chrono::milliseconds>(now - task->started).count()}
+			});
+		}
+		return {
+			{"queued", waiting},
+			{"running", active},
+			{"completed", completed},
+			{"failed", failed},
+			{"lastError", lastError}
+		};
+	}
+
+	void MaintenanceScheduler::runWorker()
+	{
+		while (std::shared_ptr<MaintenanceTask> task = takeTask())
+		{
+			std::string error;
+			try
+			{
+				task->work(*task);
+				task->throttle(0);
+			}
+			catch (const std::exception& ex)
+			{
+				error = task->name + ": " + ex.what();
+			}
+
+			{
+				std::lock_guard lock(mutex);
+				running.erase(std::find(running.begin(), running.end(), task));
+				if (error.empty())
+				{
+					completed++;
+				}
+				else
+				{
+					failed++;
+					lastError = error;
+				}
+			}
+			wakeup.notify_all();
+		}
+	}
+
+	std::shared_ptr<MaintenanceTask> MaintenanceScheduler::takeTask()
+	{
+		std::unique_lock lock(mutex);
+		while (true)
+		{
+			for (auto task = queued.begin(); task != queued.end(); task++)
+			{
+				bool isNameRunning = std::any_of(running.begin(), running.end(),
+					[&](const std::shared_ptr<MaintenanceTask>& other) { return other->name == task->second->name; });
+				if (!isNameRunning)
+				{
+					std::shared_ptr<MaintenanceTask> taken = task->second;
+					queued.erase(task);
+					taken->started = taken->charged = std::chrono::steady_clock::now();
+					running.push_back(taken);
+					return taken;
+				}
+			}
+			if (isStopping && queued.empty())
+			{
+				return nullptr;
+			}
+			wakeup.wait(lock);
+		}
+	}
+
+	void MaintenanceScheduler::wait(std::chrono::microseconds duration)
+	{
+		if (duration.count() <= 0)
+		{
+			return;
+		}
+		std::unique_lock lock(mutex);
+		wakeup.wait_for(lock, duration, [this]() { return isStopping; });
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <map>
+#include <vector>
+#include "DatabaseLib.h"
+#include "JsonComparator.h"
+#include "Cursor.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace DatabaseLib
+{
+	// Holds up to one second of its rate. Spending more than is available
+	// leaves a debt, and the caller waits until it has been paid back.
+	class DATABASE_API TokenBucket
+	{
+	private:
+		std::mutex mutex;
+		double rate;
+		double tokens;
+		std::chrono::steady_clock::time_point refilled;
+	public:
+		// A rate of zero puts no limit on spending.
+		explicit TokenBucket(double rate);
+
+		// Returns how long the caller has to wait after spending amount.
+		std::chrono::microseconds spend(double amount);
+	};
+
+	enum class MaintenancePriority
+	{
+		HIGH,
+		NORMAL,
+		LOW
+	};
+
+	class MaintenanceScheduler;
+
+	// Passed to a running task to report its progress and pace its work.
+	class DATABASE_API MaintenanceTask
+	{
+		friend class MaintenanceScheduler;
+	private:
+		MaintenanceScheduler& scheduler;
+		std::string name;
+		MaintenancePriority priority;
+		std::function<void(MaintenanceTask&)> work;
+		std::atomic<Offset> done{ 0 };
+		std::atomic<Offset> total{ 0 };
+		std::chrono::steady_clock::time_point started;
+		std::chrono::steady_clock::time_point charged;
+	public:
+		MaintenanceTask(MaintenanceScheduler& scheduler, std::string name, MaintenancePriority priority,
+			std::function<void(MaintenanceTask&)> work);
+
+		// Waits until bytes fit the disk budget and the time run since the last
+		// call fits the CPU budget. Tasks must not hold the database lock here.
+		void throttle(Offset bytes);
+		void setProgress(Offset done, Offset total);
+	};
+
+	// Runs maintenance tasks on its own worker threads, highest priority first
+	// and in order within a priority. Tasks sharing a name never run at the
+	// same time, and a task is not queued twice while it is still waiting.
+	class DATABASE_API MaintenanceScheduler
+	{
+		friend class MaintenanceTask;
+	private:
+		std::mutex mutex;
+		std::condition_variable wakeup;
+		std::multimap<MaintenancePriority, std::shared_ptr<MaintenanceTask>> queued;
+		std::vector<std::shared_ptr<MaintenanceTask>> running;
+		std::vector<std::thread> workers;
+		TokenBucket diskBudget;
+		TokenBucket cpuBudget;
+		bool isStopping = false;
+		Offset completed = 0;
+		Offset failed = 0;
+		std::string lastError;
+
+		void runWorker();
+		std::shared_ptr<MaintenanceTask> takeTask();
+		void wait(std::chrono::microseconds duration);
+	public:
+		// cpuShare is the part of one core the workers may use together; zero
+		// leaves the CPU, and a zero bytesPerSecond the disk, unlimited.
+		MaintenanceScheduler(unsigned workerCount, Offset bytesPerSecond, double cpuShare);
+		// Tasks still queued are run without limits before the workers stop.
+		~MaintenanceScheduler();
+
+		// Returns false when a task with the same name is already queued.
+		bool schedule(const std::string& name, MaintenancePriority priority, std::function<void(MaintenanceTask&)> work);
+		json getProgress();
+	};
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+namespace DatabaseLib
+{
+	struct OffsetsCodec
+	{
+		static std::vector<std::uint8_t> encode(const std::vector<std::uint64_t>& offsets)
+		{
+			std::vector<std::uint8_t> bytes;
+			bytes.reserve(offsets.size() * 2);
+			std::int64_t previous = 0;
+			for (std::uint64_t offset : offsets)
+			{
+				std::int64_t delta = (std::int64_t)offset - previous;
+				std::uint64_t zigzag = ((std::uint64_t)delta << 1) ^ (std::uint64_t)(delta >> 63);
+				while (zigzag >= 0x80)
+				{
+					bytes.push_back((std::uint8_t)(zigzag | 0x80));
+					zigzag >>= 7;
+				}
+				bytes.push_back((std::uint8_t)zigzag);
+				previous = offset;
+			}
+			return bytes;
+		}
+
+		static std::vector<std::uint64_t> decode(const std::vector<std::uint8_t>& bytes)
+		{
+			std::vector<std::uint64_t> offsets;
+			std::int64_t previous = 0;
+			std::uint64_t zigzag = 0;
+			int shift = 0;
+			for (std::uint8_t byte : bytes)
+			{
+				zigzag |= (std::uint64_t)(byte & 0x7f) << shift;
+				shift += 7;
+				if (byte < 0x80)
+				{
+					std::int64_t delta = (std::int64_t)(zigzag >> 1) ^ -(std::int64_t)(zigzag & 1);
+					previous += delta;
+					offsets.push_back((std::uint64_t)previous);
+					zigzag = 0;
+					shift = 0;
+				}
+			}
+			return offsets;
+		}
+	};
+}
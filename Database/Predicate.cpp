@@ -0,0 +1,159 @@
+#include "pch.h"
+#include "Predicate.h"
+#include "DatabaseException.h"
+#include <algorithm>
+
+namespace DatabaseLib
+{
+	Predicate::Predicate(json conditions) : conditions(conditions.is_null() ? json::object() : conditions)
+	{
+		for (auto& condition : this->conditions.items())
+		{
+			if (!isOperatorObject(condition.value()))
+			{
+				if (condition.value().is_string())
+				{
+					requiredSubstrings.push_back(condition.value().dump());
+				}
+				continue;
+			}
+			for (auto& operation : condition.value().items())
+			{
+				static const std::vector<std::string> operations = { "$eq", "$ne", "$gt", "$gte", "$lt", "$lte", "$contains" };
+				if (std::find(operations.begin(), operations.end(), operation.key()) == operations.end())
+				{
+					throw DatabaseException("Unknown operator: " + operation.key(), ErrorCode::INVALID_PREDICATE);
+				}
+				if (operation.key() == "$contains" && operation.value().is_string())
+				{
+					std::string quoted = operation.value().dump();
+					requiredSubstrings.push_back(quoted.substr(1, quoted.size() - 2));
+				}
+				else if (operation.key() == "$eq" && operation.value().is_string())
+				{
+					requiredSubstrings.push_back(operation.value().dump());
+				}
+			}
+		}
+	}
+
+	bool Predicate::matches(const json& row) const
+	{
+		for (auto& condition : conditions.items())
+		{
+			json value = row.value(condition.key(), json());
+			if (!isOperatorObject(condition.value()))
+			{
+				if (value != condition.value())
+				{
+					return false;
+				}
+				continue;
+			}
+			for (auto& operation : condition.value().items())
+			{
+				if (!matchesOperator(operation.key(), value, operation.value()))
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	bool Predicate::mayMatch(std::string_view line) const
+	{
+		for (auto& substring : requiredSubstrings)
+		{
+			if (line.find(substring) == std::string_view::npos)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool Predicate::isEquality(const std::string& column) const
+	{
+		if (!conditions.contains(column))
+		{
+			return false;
+		}
+		const json& condition = conditions[column];
+		return !isOperatorObject(condition) || (condition.size() == 1 && condition.contains("$eq"));
+	}
+
+	bool Predicate::hasRange(const std::string& column) const
+	{
+		if (!conditions.contains(column) || !isOperatorObject(conditions[column]))
+		{
+			return false;
+		}
+		const json& condition = conditions[column];
+		return condition.contains("$gt") || condition.contains("$gte")
+			|| condition.contains("$lt") || condition.contains("$lte");
+	}
+
+	json Predicate::getEqualityValue(const std::string& column) const
+	{
+		const json& condition = conditions[column];
+		return isOperatorObject(condition) ? condition["$eq"] : condition;
+	}
+
+	json Predicate::getLowerBound(const std::string& column) const
+	{
+		const json& condition = conditions[column];
+		if (condition.contains("$gte"))
+		{
+			return condition["$gte"];
+		}
+		return condition.contains("$gt") ? condition["$gt"] : json();
+	}
+
+	bool Predicate::exceedsUpperBound(const std::string& column, const json& value) const
+	{
+		const json& condition = conditions[column];
+		return (condition.contains("$lt") && !(value < condition["$lt"]))
+			|| (condition.contains("$lte") && value > condition["$lte"]);
+	}
+
+	bool Predicate::isOperatorObject(const json& condition)
+	{
+		return condition.is_object() && !condition.empty() && condition.begin().key().rfind("$", 0) == 0;
+	}
+
+	bool Predicate::matchesOperator(const std::string& operation, const json& value, const json& operand)
+	{
+		bool isComparable = (value.is_number() && operand.is_number()) || value.type() == operand.type();
+		if (operation == "$eq")
+		{
+			return value == operand;
+		}
+		if (operation == "$ne")
+		{
+			return value != operand;
+		}
+		if (operation == "$contains")
+		{
+			return value.is_string() && operand.is_string()
+				&& value.get_ref<const std::string&>().find(operand.get_ref<const std::string&>()) != std::string::npos;
+		}
+		if (!isComparable)
+		{
+			return false;
+		}
+		if (operation == "$gt")
+		{
+			return value > operand;
+		}
+		if (operation == "$gte")
+		{
+			return value >= operand;
+		}
+		if (operation == "$lt")
+		{
+			return value < operand;
+		}
+		return value <= operand;
+	}
+}
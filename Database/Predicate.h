@@ -0,0 +1,30 @@
+#pragma once
+#include "DatabaseLib.h"
+#include "JsonComparator.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace DatabaseLib
+{
+	class Predicate
+	{
+	private:
+		json conditions;
+		std::vector<std::string> requiredSubstrings;
+
+		static bool isOperatorObject(const json& condition);
+		static bool matchesOperator(const std::string& operation, const json& value, const json& operand);
+	public:
+		Predicate(json conditions);
+
+		bool matches(const json& row) const;
+		bool mayMatch(std::string_view line) const;
+
+		bool isEquality(const std::string& column) const;
+		bool hasRange(const std::string& column) const;
+		json getEqualityValue(const std::string& column) const;
+		json getLowerBound(const std::string& column) const;
+		bool exceedsUpperBound(const std::string& column, const json& value) const;
+	};
+}
@@ -0,0 +1,446 @@
+#include "pch.h"
+#include "Stats.h"
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+namespace DatabaseLib
+{
+	namespace
+	{
+		// Lock time accumulated by the current thread, used to attribute lock
+		// waits and holds to the operation that is running on it.
+		struct LockState
+		{
+			std::uint64_t waitNs = 0;
+			std::uint64_t holdNs = 0;
+			unsigned depth = 0;
+			std::chrono::steady_clock::time_point acquired;
+			Operation operation = Operation::SIZE;
+			std::string_view tableName;
+		};
+
+		thread_local LockState lockState;
+
+		std::uint64_t toNanoseconds(std::chrono::steady_clock::duration duration)
+		{
+			return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+		}
+	}
+
+	unsigned Histogram::getBucket(std::uint64_t value)
+	{
+		if (value < SUB_BUCKETS)
+		{
+			return (unsigned)value;
+		}
+		unsigned bits = 0;
+		for (std::uint64_t rest = value; rest != 0; rest >>= 1)
+		{
+			bits++;
+		}
+		if (bits > MAX_BITS)
+		{
+			return BUCKET_COUNT - 1;
+		}
+		unsigned shift = bits - SUB_BUCKET_BITS - 1;
+		return (bits - SUB_BUCKET_BITS) * SUB_BUCKETS + (unsigned)((value >> shift) & (SUB_BUCKETS - 1));
+	}
+
+	std::uint64_t Histogram::getBucketValue(unsigned bucket)
+	{
+		unsigned group = bucket / SUB_BUCKETS;
+		std::uint64_t subBucket = bucket % SUB_BUCKETS;
+		if (group == 0)
+		{
+			return subBucket;
+		}
+		return (SUB_BUCKETS + subBucket) << (group - 1);
+	}
+
+	void Histogram::record(std::uint64_t value)
+	{
+		buckets[getBucket(value)].fetch_add(1, std::memory_order_relaxed);
+		total.fetch_add(value, std::memory_order_relaxed);
+		std::uint64_t current = maximum.load(std::memory_order_relaxed);
+		while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	void Histogram::mergeInto(std::vector<std::uint64_t>& counts, std::uint64_t& sum, std::uint64_t& max) const
+	{
+		counts.resize(BUCKET_COUNT);
+		for (unsigned bucket = 0; bucket < BUCKET_COUNT; bucket++)
+		{
+			counts[bucket] += buckets[bucket].load(std::memory_order_relaxed);
+		}
+		sum += total.load(std::memory_order_relaxed);
+		max = std::max(max, maximum.load(std::memory_order_relaxed));
+	}
+
+	json Histogram::toJson() const
+	{
+		std::vector<std::uint64_t> counts;
+		std::uint64_t sum = 0, max = 0;
+		mergeInto(counts, sum, max);
+		return summarize(counts, sum, max);
+	}
+
+	json Histogram::summarize(const std::vector<std::uint64_t>& counts, std::uint64_t sum, std::uint64_t max)
+	{
+		std::uint64_t count = 0;
+		for (std::uint64_t bucketCount : counts)
+		{
+			count += bucketCount;
+		}
+		json summary = { {"count", count}, {"totalNs", sum}, {"maxNs", max} };
+		if (count == 0)
+		{
+			return summary;
+		}
+		summary["meanNs"] = sum / count;
+
+		std::vector<std::pair<std::string, double>> percentiles = { {"p50Ns", 0.5}, {"p90Ns", 0.9}, {"p99Ns", 0.99}, {"p999Ns", 0.999} };
+		std::uint64_t seen = 0;
+		size_t next = 0;
+		for (unsigned bucket = 0; bucket < counts.size() && next < percentiles.size(); bucket++)
+		{
+			seen += counts[bucket];
+			while (next < percentiles.size() && seen >= percentiles[next].second * count)
+			{
+				summary[percentiles[next].first] = std::min(getBucketValue(bucket), max);
+				next++;
+			}
+		}
+		return summary;
+	}
+
+	Stats::~Stats()
+	{
+		for (auto& shard : shards)
+		{
+			delete shard.load();
+		}
+	}
+
+	StatsShard& Stats::getShard()
+	{
+		static thread_local size_t shardIndex = std::hash<std::thread::id>()(std::this_thread::get_id()) % SHARD_COUNT;
+		StatsShard* shard = shards[shardIndex].load(std::memory_order_acquire);
+		if (shard == nullptr)
+		{
+			StatsShard* created = new StatsShard();
+			if (shards[shardIndex].compare_exchange_strong(shard, created, std::memory_order_acq_rel))
+			{
+				shard = created;
+			}
+			else
+			{
+				delete created;
+			}
+		}
+		return *shard;
+	}
+
+	void Stats::recordLatency(Operation operation, std::chrono::steady_clock::duration duration)
+	{
+		getShard().latencies[(size_t)operation].record(toNanoseconds(duration));
+	}
+
+	void Stats::increment(Counter counter, std::uint64_t value)
+	{
+		getShard().counters[(size_t)counter].fetch_add(value, std::memory_order_relaxed);
+	}
+
+	json Stats::toJson() const
+	{
+		json operations = json::object();
+		for (size_t operation = 0; operation < (size_t)Operation::SIZE; operation++)
+		{
+			std::vector<std::uint64_t> counts;
+			std::uint64_t sum = 0, max = 0;
+			for (auto& shard : shards)
+			{
+				StatsShard* current = shard.load(std::memory_order_acquire);
+				if (current != nullptr)
+				{
+					current->latencies[operation].mergeInto(counts, sum, max);
+				}
+			}
+			operations[getOperationName((Operation)operation)] = Histogram::summarize(counts, sum, max);
+		}
+
+		json counters = json::object();
+		for (size_t counter = 0; counter < (size_t)Counter::SIZE; counter++)
+		{
+			std::uint64_t value = 0;
+			for (auto& shard : shards)
+			{
+				StatsShard* current = shard.load(std::memory_order_acquire);
+				if (current != nullptr)
+				{
+					value += current->counters[counter].load(std::memory_order_relaxed);
+				}
+			}
+			counters[getCounterName((Counter)counter)] = value;
+		}
+		return { {"operations", operations}, {"counters", counters} };
+	}
+
+	void Stats::setSlowOperationLog(std::string fileName, std::chrono::nanoseconds threshold)
+	{
+		std::lock_guard<std::mutex> lock(slowLogMutex);
+		if (slowLog.is_open())
+		{
+			slowLog.close();
+		}
+		if (!fileName.empty())
+		{
+			slowLog.open(fileName, std::ios_base::app);
+		}
+		slowThresholdNs.store(fileName.empty() ? 0 : std::max<std::uint64_t>(1, threshold.count()));
+	}
+
+	void Stats::setLockProfiling(bool isEnabled)
+	{
+		isLockProfiling.store(isEnabled);
+	}
+
+	bool Stats::isTracking() const
+	{
+		return isLockProfiling.load(std::memory_order_relaxed) || slowThresholdNs.load(std::memory_order_relaxed) != 0;
+	}
+
+	void Stats::logSlowOperation(Operation operation, std::string_view tableName, std::string_view keyName,
+		std::chrono::nanoseconds duration, std::chrono::nanoseconds lockWait, std::chrono::nanoseconds lockHold)
+	{
+		std::uint64_t threshold = slowThresholdNs.load(std::memory_order_relaxed);
+		if (threshold == 0 || (std::uint64_t)duration.count() < threshold)
+		{
+			return;
+		}
+		json entry = {
+			{"time", std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count()},
+			{"operation", getOperationName(operation)},
+			{"table", std::string(tableName)},
+			{"key", std::string(keyName)},
+			{"durationUs", duration.count() / 1000},
+			{"lockWaitUs", lockWait.count() / 1000},
+			{"lockHoldUs", lockHold.count() / 1000}
+		};
+		std::lock_guard<std::mutex> lock(slowLogMutex);
+		if (slowLog.is_open())
+		{
+			slowLog << entry.dump() << std::endl;
+		}
+	}
+
+	void Stats::onLockWaited(std::chrono::steady_clock::duration duration)
+	{
+		recordLatency(Operation::LOCK_WAIT, duration);
+		if (isTracking())
+		{
+			lockState.waitNs += toNanoseconds(duration);
+		}
+	}
+
+	void Stats::onLockAcquired(bool isExclusive)
+	{
+		if (!isTracking())
+		{
+			return;
+		}
+		if (lockState.depth++ == 0)
+		{
+			lockState.acquired = std::chrono::steady_clock::now();
+		}
+		if (isExclusive && isLockProfiling.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> lock(holderMutex);
+			holder = { true, lockState.operation, std::string(lockState.tableName), std::this_thread::get_id(),
+				lockState.acquired };
+		}
+	}
+
+	void Stats::onLockReleased(bool isExclusive)
+	{
+		if (lockState.depth == 0)
+		{
+			return;
+		}
+		if (--lockState.depth == 0)
+		{
+			std::uint64_t hold = toNanoseconds(std::chrono::steady_clock::now() - lockState.acquired);
+			lockState.holdNs += hold;
+			if (isLockProfiling.load(std::memory_order_relaxed) && lockState.operation != Operation::SIZE)
+			{
+				getShard().lockHolds[(size_t)lockState.operation].record(hold);
+			}
+		}
+		if (isExclusive)
+		{
+			std::lock_guard<std::mutex> lock(holderMutex);
+			if (holder.threadId == std::this_thread::get_id())
+			{
+				holder.isHeld = false;
+			}
+		}
+	}
+
+	json Stats::getLockProfile()
+	{
+		json holds = json::object();
+		for (size_t operation = 0; operation < (size_t)Operation::SIZE; operation++)
+		{
+			std::vector<std::uint64_t> counts;
+			std::uint64_t sum = 0, max = 0;
+			for (auto& shard : shards)
+			{
+				StatsShard* current = shard.load(std::memory_order_acquire);
+				if (current != nullptr)
+				{
+					current->lockHolds[operation].mergeInto(counts, sum, max);
+				}
+			}
+			json summary = Histogram::summarize(counts, sum, max);
+			if (summary["count"] != 0)
+			{
+				holds[getOperationName((Operation)operation)] = summary;
+			}
+		}
+
+		json currentHolder;
+		{
+			std::lock_guard<std::mutex> lock(holderMutex);
+			if (holder.isHeld)
+			{
+				std::stringstream threadId;
+				threadId << holder.threadId;
+				currentHolder = {
+					{"operation", holder.operation == Operation::SIZE ? "" : getOperationName(holder.operation)},
+					{"table", holder.tableName},
+					{"thread", threadId.str()},
+					{"heldNs", toNanoseconds(std::chrono::steady_clock::now() - holder.acquired)}
+				};
+			}
+		}
+		return { {"holdByOperation", holds}, {"holder", currentHolder} };
+	}
+
+	const char* Stats::getOperationName(Operation operation)
+	{
+		static const char* names[] = { "connect", "disconnect", "createTable", "removeTable", "addKey", "removeKey",
+			"reorganizeTable", "checkpoint", "getRowByKey", "getRowInSortedTable", "getNextRow", "getPrevRow",
+			"openCursor", "splitScan", "fetchRow", "getPage", "find",
+			"count", "minKey", "maxKey", "sum", "avg", "join", "appendRow", "removeRow", "updateRow", "upsert",
+			"reapExpiredRows", "loadIndex", "dumpIndex", "lockWait" };
+		return names[(size_t)operation];
+	}
+
+	const char* Stats::getCounterName(Counter counter)
+	{
+		static const char* names[] = { "bytesRead", "bytesWritten", "catalogReads", "indexCacheHits",
+			"indexCacheMisses", "expiredRowsReaped" };
+		return names[(size_t)counter];
+	}
+
+	OperationTimer::OperationTimer(Stats& stats, Operation operation, std::string_view tableName)
+		: stats(stats), operation(operation), tableName(tableName), started(std::chrono::steady_clock::now()),
+		isTracking(stats.isTracking())
+	{
+		if (isTracking)
+		{
+			lockWaitAtStart = lockState.waitNs;
+			lockHoldAtStart = lockState.holdNs;
+			previousOperation = lockState.operation;
+			previousTableName = lockState.tableName;
+			lockState.operation = operation;
+			lockState.tableName = tableName;
+		}
+	}
+
+	OperationTimer::~OperationTimer()
+	{
+		auto duration = std::chrono::steady_clock::now() - started;
+		stats.recordLatency(operation, duration);
+		if (isTracking)
+		{
+			lockState.operation = previousOperation;
+			lockState.tableName = previousTableName;
+			stats.logSlowOperation(operation, tableName, keyName,
+				std::chrono::duration_cast<std::chrono::nanoseconds>(duration),
+				std::chrono::nanoseconds(lockState.waitNs - lockWaitAtStart),
+				std::chrono::nanoseconds(lockState.holdNs - lockHoldAtStart));
+		}
+	}
+
+	void OperationTimer::setKey(std::string_view keyName)
+	{
+		if (isTracking)
+		{
+			this->keyName = std::string(keyName);
+		}
+	}
+
+	InstrumentedMutex::InstrumentedMutex(Stats& stats)
+		: stats(stats)
+	{
+	}
+
+	void InstrumentedMutex::lock()
+	{
+		if (!mutex.try_lock())
+		{
+			auto started = std::chrono::steady_clock::now();
+			mutex.lock();
+			stats.onLockWaited(std::chrono::steady_clock::now() - started);
+		}
+		stats.onLockAcquired(true);
+	}
+
+	bool InstrumentedMutex::try_lock()
+	{
+		if (!mutex.try_lock())
+		{
+			return false;
+		}
+		stats.onLockAcquired(true);
+		return true;
+	}
+
+	void InstrumentedMutex::unlock()
+	{
+		stats.onLockReleased(true);
+		mutex.unlock();
+	}
+
+	void InstrumentedMutex::lock_shared()
+	{
+		if (!mutex.try_lock_shared())
+		{
+			auto started = std::chrono::steady_clock::now();
+			mutex.lock_shared();
+			stats.onLockWaited(std::chrono::steady_clock::now() - started);
+		}
+		stats.onLockAcquired(false);
+	}
+
+	bool InstrumentedMutex::try_lock_shared()
+	{
+		if (!mutex.try_lock_shared())
+		{
+			return false;
+		}
+		stats.onLockAcquired(false);
+		return true;
+	}
+
+	void InstrumentedMutex::unlock_shared()
+	{
+		stats.onLockReleased(false);
+		mutex.unlock_shared();
+	}
+}
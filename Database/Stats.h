@@ -0,0 +1,185 @@
+#pragma once
+#include "DatabaseLib.h"
+#include "JsonComparator.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace DatabaseLib
+{
+	enum class Operation
+	{
+		CONNECT,
+		DISCONNECT,
+		CREATE_TABLE,
+		REMOVE_TABLE,
+		ADD_KEY,
+		REMOVE_KEY,
+		REORGANIZE_TABLE,
+		CHECKPOINT,
+		GET_ROW_BY_KEY,
+		GET_ROW_IN_SORTED_TABLE,
+		GET_NEXT_ROW,
+		GET_PREV_ROW,
+		OPEN_CURSOR,
+		SPLIT_SCAN,
+		FETCH_ROW,
+		GET_PAGE,
+		FIND,
+		COUNT,
+		MIN_KEY,
+		MAX_KEY,
+		SUM,
+		AVG,
+		JOIN,
+		APPEND_ROW,
+		REMOVE_ROW,
+		UPDATE_ROW,
+		UPSERT,
+		REAP_EXPIRED_ROWS,
+		LOAD_INDEX,
+		DUMP_INDEX,
+		LOCK_WAIT,
+		SIZE
+	};
+
+	enum class Counter
+	{
+		BYTES_READ,
+		BYTES_WRITTEN,
+		CATALOG_READS,
+		INDEX_CACHE_HITS,
+		INDEX_CACHE_MISSES,
+		EXPIRED_ROWS_REAPED,
+		SIZE
+	};
+
+	// Log-linear buckets in the spirit of HdrHistogram: every power of two is
+	// split into 16 sub-buckets, so recorded values keep ~6% precision.
+	class DATABASE_API Histogram
+	{
+	private:
+		static const unsigned SUB_BUCKET_BITS = 4;
+		static const unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+		static const unsigned MAX_BITS = 48;
+		static const unsigned BUCKET_COUNT = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+		std::array<std::atomic<std::uint64_t>, BUCKET_COUNT> buckets{};
+		std::atomic<std::uint64_t> total{ 0 };
+		std::atomic<std::uint64_t> maximum{ 0 };
+
+		static unsigned getBucket(std::uint64_t value);
+		static std::uint64_t getBucketValue(unsigned bucket);
+	public:
+		void record(std::uint64_t value);
+		void mergeInto(std::vector<std::uint64_t>& counts, std::uint64_t& sum, std::uint64_t& max) const;
+		json toJson() const;
+		static json summarize(const std::vector<std::uint64_t>& counts, std::uint64_t sum, std::uint64_t max);
+	};
+
+	struct StatsShard
+	{
+		std::array<Histogram, (size_t)Operation::SIZE> latencies;
+		std::array<std::atomic<std::uint64_t>, (size_t)Counter::SIZE> counters{};
+		std::array<Histogram, (size_t)Operation::SIZE> lockHolds;
+	};
+
+	struct LockHolder
+	{
+		bool isHeld = false;
+		Operation operation = Operation::SIZE;
+		std::string tableName;
+		std::thread::id threadId;
+		std::chrono::steady_clock::time_point acquired;
+	};
+
+	// Threads write to one of a few lazily allocated shards picked by thread id,
+	// so recording never takes a lock; shards are merged only by toJson.
+	class DATABASE_API Stats
+	{
+	private:
+		static const unsigned SHARD_COUNT = 16;
+		std::array<std::atomic<StatsShard*>, SHARD_COUNT> shards{};
+
+		std::atomic<bool> isLockProfiling{ false };
+		std::atomic<std::uint64_t> slowThresholdNs{ 0 };
+		std::mutex slowLogMutex;
+		std::ofstream slowLog;
+		std::mutex holderMutex;
+		LockHolder holder;
+
+		StatsShard& getShard();
+	public:
+		Stats() = default;
+		Stats(const Stats&) = delete;
+		Stats& operator=(const Stats&) = delete;
+		~Stats();
+
+		void recordLatency(Operation operation, std::chrono::steady_clock::duration duration);
+		void increment(Counter counter, std::uint64_t value = 1);
+		json toJson() const;
+
+		// Slow-operation logging and lock profiling are off by default; while both
+		// are off, operations and lock acquisitions skip all of the bookkeeping.
+		void setSlowOperationLog(std::string fileName, std::chrono::nanoseconds threshold);
+		void setLockProfiling(bool isEnabled);
+		bool isTracking() const;
+		void logSlowOperation(Operation operation, std::string_view tableName, std::string_view keyName,
+			std::chrono::nanoseconds duration, std::chrono::nanoseconds lockWait, std::chrono::nanoseconds lockHold);
+		void onLockAcquired(bool isExclusive);
+		void onLockReleased(bool isExclusive);
+		void onLockWaited(std::chrono::steady_clock::duration duration);
+		json getLockProfile();
+
+		static const char* getOperationName(Operation operation);
+		static const char* getCounterName(Counter counter);
+	};
+
+	class DATABASE_API OperationTimer
+	{
+	private:
+		Stats& stats;
+		Operation operation;
+		std::string_view tableName;
+		std::string keyName;
+		std::chrono::steady_clock::time_point started;
+		bool isTracking;
+		std::uint64_t lockWaitAtStart = 0;
+		std::uint64_t lockHoldAtStart = 0;
+		Operation previousOperation = Operation::SIZE;
+		std::string_view previousTableName;
+	public:
+		OperationTimer(Stats& stats, Operation operation, std::string_view tableName = std::string_view());
+		OperationTimer(const OperationTimer&) = delete;
+		OperationTimer& operator=(const OperationTimer&) = delete;
+		~OperationTimer();
+
+		void setKey(std::string_view keyName);
+	};
+
+	// Shared mutex that reports the time spent waiting for and holding it; an
+	// uncontended acquisition with tracking disabled never reads the clock.
+	class DATABASE_API InstrumentedMutex
+	{
+	private:
+		std::shared_mutex mutex;
+		Stats& stats;
+	public:
+		explicit InstrumentedMutex(Stats& stats);
+
+		void lock();
+		bool try_lock();
+		void unlock();
+		void lock_shared();
+		bool try_lock_shared();
+		void unlock_shared();
+	};
+}
@@ -0,0 +1,434 @@
+#include "pch.h"
+#include "Storage.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace DatabaseLib
+{
+	namespace
+	{
+		const size_t LINE_CHUNK_SIZE = 512;
+		const std::intptr_t INVALID_HANDLE = -1;
+
+#if defined(_WIN32)
+		std::intptr_t openFile(const std::string& path, bool isCreated, bool isTruncated)
+		{
+			HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+				FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+				isTruncated ? CREATE_ALWAYS : isCreated ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			return file == INVALID_HANDLE_VALUE ? INVALID_HANDLE : (std::intptr_t)file;
+		}
+
+		void closeFile(std::intptr_t handle)
+		{
+			CloseHandle((HANDLE)handle);
+		}
+
+		size_t readFile(std::intptr_t handle, Offset position, char* buffer, size_t size)
+		{
+			size_t total = 0;
+			while (total < size)
+			{
+				OVERLAPPED overlapped{};
+				overlapped.Offset = (DWORD)(position + total);
+				overlapped.OffsetHigh = (DWORD)((position + total) >> 32);
+				DWORD read = 0;
+				DWORD requested = (DWORD)std::min<size_t>(size - total, 1u << 30);
+				if (!ReadFile((HANDLE)handle, buffer + total, requested, &read, &overlapped) || read == 0)
+				{
+					break;
+				}
+				total += read;
+			}
+			return total;
+		}
+
+		void writeFile(std::intptr_t handle, Offset position, std::string_view data)
+		{
+			size_t total = 0;
+			while (total < data.size())
+			{
+				OVERLAPPED overlapped{};
+				overlapped.Offset = (DWORD)(position + total);
+				overlapped.OffsetHigh = (DWORD)((position + total) >> 32);
+				DWORD written = 0;
+				DWORD requested = (DWORD)std::min<size_t>(data.size() - total, 1u << 30);
+				if (!WriteFile((HANDLE)handle, data.data() + total, requested, &written, &overlapped) || written == 0)
+				{
+					break;
+				}
+				total += written;
+			}
+		}
+
+		Offset getFileSize(std::intptr_t handle)
+		{
+			LARGE_INTEGER size;
+			return GetFileSizeEx((HANDLE)handle, &size) ? (Offset)size.QuadPart : 0;
+		}
+#else
+		std::intptr_t openFile(const std::string& path, bool isCreated, bool isTruncated)
+		{
+			int flags = O_RDWR | O_CLOEXEC | (isCreated || isTruncated ? O_CREAT : 0) | (isTruncated ? O_TRUNC : 0);
+			return ::open(path.c_str(), flags, 0644);
+		}
+
+		void closeFile(std::intptr_t handle)
+		{
+			::close((int)handle);
+		}
+
+		size_t readFile(std::intptr_t handle, Offset position, char* buffer, size_t size)
+		{
+			size_t total = 0;
+			while (total < size)
+			{
+				ssize_t read = ::pread((int)handle, buffer + total, size - total, (off_t)(position + total));
+				if (read <= 0)
+				{
+					break;
+				}
+				total += (size_t)read;
+			}
+			return total;
+		}
+
+		void writeFile(std::intptr_t handle, Offset position, std::string_view data)
+		{
+			size_t total = 0;
+			while (total < data.size())
+			{
+				ssize_t written = ::pwrite((int)handle, data.data() + total, data.size() - total,
+					(off_t)(position + total));
+				if (written <= 0)
+				{
+					break;
+				}
+				total += (size_t)written;
+			}
+		}
+
+		Offset getFileSize(std::intptr_t handle)
+		{
+			struct stat status;
+			return ::fstat((int)handle, &status) == 0 ? (Offset)status.st_size : 0;
+		}
+#endif
+	}
+
+	std::string Storage::readLine(const std::string& fileName, Offset position)
+	{
+		std::string line;
+		size_t chunk = LINE_CHUNK_SIZE;
+		while (true)
+		{
+			size_t start = line.size();
+			line.resize(start + chunk);
+			size_t read = readAt(fileName, position + start, &line[start], chunk);
+			const void* newline = std::memchr(line.data() + start, '\n', read);
+			if (newline != nullptr)
+			{
+				line.resize((const char*)newline - line.data());
+				return line;
+			}
+			line.resize(start + read);
+			if (read < chunk)
+			{
+				return line;
+			}
+			chunk *= 2;
+		}
+	}
+
+	FileStorage::FileStorage(std::string directory)
+		: directory(std::move(directory))
+	{}
+
+	FileStorage::~FileStorage()
+	{
+		for (auto& handle : handles)
+		{
+			closeFile(handle.second);
+		}
+	}
+
+	std::string FileStorage::getPath(const std::string& fileName) const
+	{
+		return directory.empty() ? fileName : directory + "/" + fileName;
+	}
+
+	FileStorage::Handle FileStorage::getHandle(const std::string& fileName, bool isCreated, bool isKept)
+	{
+		{
+			std::shared_lock lock(handlesMutex);
+			auto handle = handles.find(fileName);
+			if (handle != handles.end())
+			{
+				return handle->second;
+			}
+		}
+		if (!isKept)
+		{
+			return openFile(getPath(fileName), isCreated, false);
+		}
+
+		std::unique_lock lock(handlesMutex);
+		auto handle = handles.find(fileName);
+		if (handle != handles.end())
+		{
+			return handle->second;
+		}
+		Handle opened = openFile(getPath(fileName), isCreated, false);
+		if (opened != INVALID_HANDLE)
+		{
+			handles[fileName] = opened;
+		}
+		return opened;
+	}
+
+	void FileStorage::releaseHandle(const std::string& fileName, Handle handle)
+	{
+		if (handle == INVALID_HANDLE)
+		{
+			return;
+		}
+		std::shared_lock lock(handlesMutex);
+		auto cached = handles.find(fileName);
+		if (cached == handles.end() || cached->second != handle)
+		{
+			closeFile(handle);
+		}
+	}
+
+	void FileStorage::closeHandle(const std::string& fileName)
+	{
+		std::unique_lock lock(handlesMutex);
+		auto handle = handles.find(fileName);
+		if (handle != handles.end())
+		{
+			closeFile(handle->second);
+			handles.erase(handle);
+		}
+	}
+
+	bool FileStorage::isKeptOpen(const std::string& fileName)
+	{
+		return fileName.find_first_of("/\\") == std::string::npos;
+	}
+
+	bool FileStorage::read(const std::string& fileName, std::string& content)
+	{
+		Handle handle = getHandle(fileName, false, false);
+		if (handle == INVALID_HANDLE)
+		{
+			return false;
+		}
+		content.resize(getFileSize(handle));
+		content.resize(readFile(handle, 0, &content[0], content.size()));
+		releaseHandle(fileName, handle);
+		return true;
+	}
+
+	void FileStorage::write(const std::string& fileName, std::string_view content)
+	{
+		closeHandle(fileName);
+		Handle handle = openFile(getPath(fileName), true, true);
+		if (handle != INVALID_HANDLE)
+		{
+			writeFile(handle, 0, content);
+			closeFile(handle);
+		}
+	}
+
+	size_t FileStorage::readAt(const std::string& fileName, Offset position, char* buffer, size_t size)
+	{
+		Handle handle = getHandle(fileName, false, isKeptOpen(fileName));
+		if (handle == INVALID_HANDLE)
+		{
+			return 0;
+		}
+		size_t read = readFile(handle, position, buffer, size);
+		releaseHandle(fileName, handle);
+		return read;
+	}
+
+	void FileStorage::writeAt(const std::string& fileName, Offset position, std::string_view data)
+	{
+		Handle handle = getHandle(fileName, true, isKeptOpen(fileName));
+		if (handle != INVALID_HANDLE)
+		{
+			writeFile(handle, position, data);
+			releaseHandle(fileName, handle);
+		}
+	}
+
+	Offset FileStorage::append(const std::string& fileName, std::string_view data)
+	{
+		Handle handle = getHandle(fileName, true, isKeptOpen(fileName));
+		if (handle == INVALID_HANDLE)
+		{
+			return 0;
+		}
+		Offset position = getFileSize(handle);
+		writeFile(handle, position, data);
+		releaseHandle(fileName, handle);
+		return position;
+	}
+
+	Offset FileStorage::size(const std::string& fileName)
+	{
+		Handle handle = getHandle(fileName, false, isKeptOpen(fileName));
+		if (handle == INVALID_HANDLE)
+		{
+			return 0;
+		}
+		Offset size = getFileSize(handle);
+		releaseHandle(fileName, handle);
+		return size;
+	}
+
+	bool FileStorage::exists(const std::string& fileName)
+	{
+		{
+			std::shared_lock lock(handlesMutex);
+			if (handles.find(fileName) != handles.end())
+			{
+				return true;
+			}
+		}
+		std::error_code error;
+		return std::filesystem::exists(getPath(fileName), error);
+	}
+
+	void FileStorage::remove(const std::string& fileName)
+	{
+		closeHandle(fileName);
+		std::error_code error;
+		std::filesystem::remove(getPath(fileName), error);
+	}
+
+	void FileStorage::rename(const std::string& from, const std::string& to)
+	{
+		closeHandle(from);
+		closeHandle(to);
+		std::error_code error;
+		std::filesystem::rename(getPath(from), getPath(to), error);
+	}
+
+	void FileStorage::createDirectory(const std::string& directory)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(getPath(directory), error);
+	}
+
+	void FileStorage::adviseSequential(const std::string& fileName)
+	{
+#if defined(POSIX_FADV_SEQUENTIAL)
+		// The advice lasts only as long as the handle, so uncached files get none.
+		if (!isKeptOpen(fileName))
+		{
+			return;
+		}
+		Handle handle = getHandle(fileName, false, true);
+		if (handle != INVALID_HANDLE)
+		{
+			::posix_fadvise((int)handle, 0, 0, POSIX_FADV_SEQUENTIAL);
+		}
+#endif
+	}
+
+	bool MemoryStorage::read(const std::string& fileName, std::string& content)
+	{
+		std::shared_lock lock(filesMutex);
+		auto file = files.find(fileName);
+		if (file == files.end())
+		{
+			return false;
+		}
+		content = file->second;
+		return true;
+	}
+
+	void MemoryStorage::write(const std::string& fileName, std::string_view content)
+	{
+		std::unique_lock lock(filesMutex);
+		files[fileName] = std::string(content);
+	}
+
+	size_t MemoryStorage::readAt(const std::string& fileName, Offset position, char* buffer, size_t size)
+	{
+		std::shared_lock lock(filesMutex);
+		auto file = files.find(fileName);
+		if (file == files.end() || position >= file->second.size())
+		{
+			return 0;
+		}
+		size_t read = std::min<size_t>(size, file->second.size() - (size_t)position);
+		std::memcpy(buffer, file->second.data() + position, read);
+		return read;
+	}
+
+	void MemoryStorage::writeAt(const std::string& fileName, Offset position, std::string_view data)
+	{
+		std::unique_lock lock(filesMutex);
+		std::string& file = files[fileName];
+		if (file.size() < position + data.size())
+		{
+			file.resize((size_t)position + data.size());
+		}
+		file.replace((size_t)position, data.size(), data);
+	}
+
+	Offset MemoryStorage::append(const std::string& fileName, std::string_view data)
+	{
+		std::unique_lock lock(filesMutex);
+		std::string& file = files[fileName];
+		Offset position = file.size();
+		file.append(data);
+		return position;
+	}
+
+	Offset MemoryStorage::size(const std::string& fileName)
+	{
+		std::shared_lock lock(filesMutex);
+		auto file = files.find(fileName);
+		return file == files.end() ? 0 : file->second.size();
+	}
+
+	bool MemoryStorage::exists(const std::string& fileName)
+	{
+		std::shared_lock lock(filesMutex);
+		return files.find(fileName) != files.end();
+	}
+
+	void MemoryStorage::remove(const std::string& fileName)
+	{
+		std::unique_lock lock(filesMutex);
+		files.erase(fileName);
+	}
+
+	void MemoryStorage::rename(const std::string& from, const std::string& to)
+	{
+		std::unique_lock lock(filesMutex);
+		auto file = files.find(from);
+		if (file != files.end())
+		{
+			std::string content = std::move(file->second);
+			files.erase(file);
+			files[to] = std::move(content);
+		}
+	}
+
+	void MemoryStorage::createDirectory(const std::string&)
+	{
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <map>
+#include <vector>
+#include "DatabaseLib.h"
+#include "JsonComparator.h"
+#include "Cursor.h"
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace DatabaseLib
+{
+	// Files of a database: table data, indexes, logs and the catalog. Small
+	// files are read and replaced whole; data files are accessed by position.
+	class DATABASE_API Storage
+	{
+	public:
+		virtual ~Storage() = default;
+
+		virtual bool read(const std::string& fileName, std::string& content) = 0;
+		virtual void write(const std::string& fileName, std::string_view content) = 0;
+		virtual size_t readAt(const std::string& fileName, Offset position, char* buffer, size_t size) = 0;
+		virtual void writeAt(const std::string& fileName, Offset position, std::string_view data) = 0;
+		// Returns the position the data was written at.
+		virtual Offset append(const std::string& fileName, std::string_view data) = 0;
+		virtual Offset size(const std::string& fileName) = 0;
+		virtual bool exists(const std::string& fileName) = 0;
+		virtual void remove(const std::string& fileName) = 0;
+		virtual void rename(const std::string& from, const std::string& to) = 0;
+		virtual void createDirectory(const std::string& directory) = 0;
+		virtual void adviseSequential(const std::string&) {}
+
+		// Reads from position up to the next newline, which is not included.
+		std::string readLine(const std::string& fileName, Offset position);
+	};
+
+	// Files on disk, relative to the working directory or to the given one.
+	// Handles of files accessed by position directly in the directory stay
+	// open until the file is removed, renamed or replaced, so a read is a
+	// single pread. Whole-file reads and files in subdirectories, such as
+	// checkpoint copies, are opened for each call.
+	class DATABASE_API FileStorage : public Storage
+	{
+	private:
+		using Handle = std::intptr_t;
+
+		std::string directory;
+		std::shared_mutex handlesMutex;
+		std::unordered_map<std::string, Handle> handles;
+
+		std::string getPath(const std::string& fileName) const;
+		Handle getHandle(const std::string& fileName, bool isCreated, bool isKept);
+		void releaseHandle(const std::string& fileName, Handle handle);
+		void closeHandle(const std::string& fileName);
+		static bool isKeptOpen(const std::string& fileName);
+	public:
+		explicit FileStorage(std::string directory = "");
+		FileStorage(const FileStorage&) = delete;
+		FileStorage& operator=(const FileStorage&) = delete;
+		~FileStorage();
+
+		bool read(const std::string& fileName, std::string& content) override;
+		void write(const std::string& fileName, std::string_view content) override;
+		size_t readAt(const std::string& fileName, Offset position, char* buffer, size_t size) override;
+		void writeAt(const std::string& fileName, Offset position, std::string_view data) override;
+		Offset append(const std::string& fileName, std::string_view data) override;
+		Offset size(const std::string& fileName) override;
+		bool exists(const std::string& fileName) override;
+		void remove(const std::string& fileName) override;
+		void rename(const std::string& from, const std::string& to) override;
+		void createDirectory(const std::string& directory) override;
+		void adviseSequential(const std::string& fileName) override;
+	};
+
+	// Keeps every file in memory, for ephemeral databases and tests.
+	class DATABASE_API MemoryStorage : public Storage
+	{
+	private:
+		std::shared_mutex filesMutex;
+		std::unordered_map<std::string, std::string> files;
+	public:
+		bool read(const std::string& fileName, std::string& content) override;
+		void write(const std::string& fileName, std::string_view content) override;
+		size_t readAt(const std::string& fileName, Offset position, char* buffer, size_t size) override;
+		void writeAt(const std::string& fileName, Offset position, std::string_view data) override;
+		Offset append(const std::string& fileName, std::string_view data) override;
+		Offset size(const std::string& fileName) override;
+		bool exists(const std::string& fileName) override;
+		void remove(const std::string& fileName) override;
+		void rename(const std::string& from, const std::string& to) override;
+		void createDirectory(const std::string& directory) override;
+	};
+}
@@ -0,0 +1,233 @@
+#include "pch.h"
+#include "TableScanner.h"
+#include <algorithm>
+#include <cstring>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace DatabaseLib
+{
+	namespace
+	{
+		inline unsigned countTrailingZeros(unsigned mask)
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return index;
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+	}
+
+	TableScanner::TableScanner(Storage& storage, std::string fileName, Stats* stats, size_t blockSize)
+		: storage(storage), fileName(std::move(fileName)), stats(stats), buffer(blockSize)
+	{
+		isEof = !this->storage.exists(this->fileName);
+		if (!isEof)
+		{
+			this->storage.adviseSequential(this->fileName);
+		}
+	}
+
+	void TableScanner::seek(Offset position)
+	{
+		bufferPosition = position;
+		dataBegin = 0;
+		dataEnd = 0;
+	}
+
+	void TableScanner::fillBuffer()
+	{
+		size_t remaining = dataEnd - dataBegin;
+		if (remaining == buffer.size())
+		{
+			buffer.resize(buffer.size() * 2);
+		}
+		std::memmove(buffer.data(), buffer.data() + dataBegin, remaining);
+		bufferPosition += dataBegin;
+		dataBegin = 0;
+		dataEnd = remaining;
+
+		size_t requested = buffer.size() - dataEnd;
+		size_t read = storage.readAt(fileName, bufferPosition + dataEnd, buffer.data() + dataEnd, requested);
+		dataEnd += read;
+		if (stats != nullptr)
+		{
+			stats->increment(Counter::BYTES_READ, read);
+		}
+		isEof = read < requested;
+	}
+
+	bool TableScanner::nextBatch(std::vector<ScannedRow>& rows)
+	{
+		rows.clear();
+		while (rows.empty())
+		{
+			if (isEof && dataBegin == dataEnd)
+			{
+				return false;
+			}
+			if (!isEof)
+			{
+				fillBuffer();
+			}
+
+			const char* data = buffer.data();
+			const char* lineBegin = data + dataBegin;
+			const char* blockEnd = data + dataEnd;
+			const char* newline;
+			while ((newline = findNewline(lineBegin, blockEnd)) != blockEnd)
+			{
+				const char* lineEnd = newline > lineBegin && newline[-1] == '\r' ? newline - 1 : newline;
+				rows.push_back({ bufferPosition + (Offset)(lineBegin - data),
+					std::string_view(lineBegin, lineEnd - lineBegin) });
+				lineBegin = newline + 1;
+			}
+			dataBegin = lineBegin - data;
+
+			if (isEof && rows.empty() && dataBegin != dataEnd)
+			{
+				rows.push_back({ bufferPosition + dataBegin, std::string_view(lineBegin, blockEnd - lineBegin) });
+				dataBegin = dataEnd;
+			}
+		}
+		return true;
+	}
+
+	const char* TableScanner::findNewline(const char* begin, const char* end)
+	{
+#if defined(__AVX2__)
+		const __m256i newlines256 = _mm256_set1_epi8('\n');
+		while (end - begin >= 32)
+		{
+			__m256i chunk = _mm256_loadu_si256((const __m256i*)begin);
+			unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newlines256));
+			if (mask)
+			{
+				return begin + countTrailingZeros(mask);
+			}
+			begin += 32;
+		}
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		const __m128i newlines128 = _mm_set1_epi8('\n');
+		while (end - begin >= 16)
+		{
+			__m128i chunk = _mm_loadu_si128((const __m128i*)begin);
+			unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newlines128));
+			if (mask)
+			{
+				return begin + countTrailingZeros(mask);
+			}
+			begin += 16;
+		}
+#endif
+		const void* found = std::memchr(begin, '\n', end - begin);
+		return found ? (const char*)found : end;
+	}
+
+	json TableScanner::extractFields(std::string_view line, const std::vector<std::string>& columns)
+	{
+		json fields = json::object();
+		size_t pos = skipWhitespace(line, 0);
+		if (pos >= line.size() || line[pos] != '{')
+		{
+			return json();
+		}
+		pos = skipWhitespace(line, pos + 1);
+		while (pos < line.size() && line[pos] == '"' && fields.size() < columns.size())
+		{
+			size_t keyEnd = skipValue(line, pos);
+			std::string_view rawKey = line.substr(pos, keyEnd - pos);
+			std::string key = rawKey.find('\\') == std::string_view::npos
+				? std::string(rawKey.substr(1, rawKey.size() - 2))
+				: json::parse(rawKey.begin(), rawKey.end()).get<std::string>();
+
+			pos = skipWhitespace(line, keyEnd);
+			pos = skipWhitespace(line, pos + 1);
+			size_t valueEnd = skipValue(line, pos);
+			if (std::find(columns.begin(), columns.end(), key) != columns.end())
+			{
+				std::string_view value = line.substr(pos, valueEnd - pos);
+				fields[key] = json::parse(value.begin(), value.end());
+			}
+			pos = skipWhitespace(line, valueEnd);
+			if (pos < line.size() && line[pos] == ',')
+			{
+				pos = skipWhitespace(line, pos + 1);
+			}
+		}
+		for (auto& column : columns)
+		{
+			if (!fields.contains(column))
+			{
+				fields[column] = nullptr;
+			}
+		}
+		return fields;
+	}
+
+	size_t TableScanner::skipValue(std::string_view line, size_t pos)
+	{
+		int depth = 0;
+		bool inString = false;
+		for (; pos < line.size(); pos++)
+		{
+			char c = line[pos];
+			if (inString)
+			{
+				if (c == '\\')
+				{
+					pos++;
+				}
+				else if (c == '"')
+				{
+					inString = false;
+					if (depth == 0)
+					{
+						return pos + 1;
+					}
+				}
+				continue;
+			}
+			if (c == '"')
+			{
+				inString = true;
+			}
+			else if (c == '{' || c == '[')
+			{
+				depth++;
+			}
+			else if (c == '}' || c == ']')
+			{
+				if (depth == 0)
+				{
+					return pos;
+				}
+				if (--depth == 0)
+				{
+					return pos + 1;
+				}
+			}
+			else if (depth == 0 && (c == ',' || c == ' ' || c == '\t'))
+			{
+				return pos;
+			}
+		}
+		return pos;
+	}
+
+	size_t TableScanner::skipWhitespace(std::string_view line, size_t pos)
+	{
+		while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t'))
+		{
+			pos++;
+		}
+		return pos;
+	}
+}
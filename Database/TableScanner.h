@@ -0,0 +1,44 @@
+#pragma once
+#include <map>
+#include "JsonComparator.h"
+#include "Cursor.h"
+#include "Stats.h"
+#include "Storage.h"
+#include <string_view>
+#include <vector>
+
+namespace DatabaseLib
+{
+	struct ScannedRow
+	{
+		Offset position;
+		std::string_view line;
+	};
+
+	class TableScanner
+	{
+	private:
+		Storage& storage;
+		std::string fileName;
+		Stats* stats;
+		std::vector<char> buffer;
+		size_t dataBegin = 0;
+		size_t dataEnd = 0;
+		Offset bufferPosition = 0;
+		bool isEof = false;
+
+		void fillBuffer();
+		static size_t skipValue(std::string_view line, size_t pos);
+		static size_t skipWhitespace(std::string_view line, size_t pos);
+	public:
+		TableScanner(Storage& storage, std::string fileName, Stats* stats = nullptr, size_t blockSize = 1 << 20);
+
+		// Starts the scan at position, which must begin a line; call it before the first batch.
+		void seek(Offset position);
+		// Lines handed out point into the scanner's buffer and stay valid until the next call.
+		bool nextBatch(std::vector<ScannedRow>& rows);
+
+		static const char* findNewline(const char* begin, const char* end);
+		static json extractFields(std::string_view line, const std::vector<std::string>& columns);
+	};
+}
@@ -0,0 +1,261 @@
+#pragma once
+#include "Database.h"
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace DatabaseLib
+{
+	template <typename Row, typename T>
+	struct Column
+	{
+		using Type = T;
+		const char* name;
+		T Row::* member;
+	};
+
+	template <typename Row, typename T>
+	constexpr Column<Row, T> column(const char* name, T Row::* member)
+	{
+		return { name, member };
+	}
+
+	// Describes the columns of a row struct; specialize it for every typed table:
+	//
+	//   template <> struct RowTraits<Client>
+	//   {
+	//       static constexpr auto columns = std::make_tuple(
+	//           column("id", &Client::id), column("name", &Client::name), column("email", &Client::email));
+	//   };
+	template <typename Row>
+	struct RowTraits;
+
+	template <typename Row, size_t Index>
+	using ColumnAt = std::remove_cv_t<
+		std::tuple_element_t<Index, std::remove_cv_t<decltype(RowTraits<Row>::columns)>>>;
+
+	// A key over the columns at the given positions of RowTraits<Row>::columns.
+	// Keys are named by deriving from it:
+	//
+	//   struct EmailKey : TypedKey<Client, 2> { static constexpr const char* name = "emailKey"; };
+	template <typename Row, size_t... Columns>
+	struct TypedKey
+	{
+		using Value = std::tuple<typename ColumnAt<Row, Columns>::Type...>;
+
+		// Orders key values as the table's index orders their json form, where
+		// columns are compared in the order of their names, not of Columns.
+		struct Less
+		{
+			bool operator()(const Value& a, const Value& b) const
+			{
+				for (size_t position : getNameOrder())
+				{
+					int result = compareAt(a, b, position, std::index_sequence_for<typename ColumnAt<Row, Columns>::Type...>());
+					if (result != 0)
+					{
+						return result < 0;
+					}
+				}
+				return false;
+			}
+		};
+
+		// Typed counterpart of Indexes: the same offsets in the same order,
+		// without building or comparing json.
+		using Index = std::map<Value, std::vector<Offset>, Less>;
+
+		static Value extract(const Row& row)
+		{
+			return Value(row.*(std::get<Columns>(RowTraits<Row>::columns).member)...);
+		}
+
+		static json toJson(const Value& value)
+		{
+			return toJson(value, std::index_sequence_for<typename ColumnAt<Row, Columns>::Type...>());
+		}
+
+		static json fromRow(const Row& row)
+		{
+			json key = json::object();
+			((key[std::get<Columns>(RowTraits<Row>::columns).name] =
+				row.*(std::get<Columns>(RowTraits<Row>::columns).member)), ...);
+			return key;
+		}
+
+		static json getColumnNames()
+		{
+			return json::array({ std::get<Columns>(RowTraits<Row>::columns).name... });
+		}
+	private:
+		template <size_t... Positions>
+		static json toJson(const Value& value, std::index_sequence<Positions...>)
+		{
+			json key = json::object();
+			((key[std::get<Columns>(RowTraits<Row>::columns).name] = std::get<Positions>(value)), ...);
+			return key;
+		}
+
+		static const std::array<size_t, sizeof...(Columns)>& getNameOrder()
+		{
+			static const std::array<size_t, sizeof...(Columns)> order = []()
+			{
+				std::array<const char*, sizeof...(Columns)> names = { std::get<Columns>(RowTraits<Row>::columns).name... };
+				std::array<size_t, sizeof...(Columns)> positions{};
+				for (size_t i = 0; i < positions.size(); i++)
+				{
+					positions[i] = i;
+				}
+				std::sort(positions.begin(), positions.end(),
+					[&](size_t a, size_t b) { return std::string(names[a]) < std::string(names[b]); });
+				return positions;
+			}();
+			return order;
+		}
+
+		template <typename T>
+		static int compare(const T& a, const T& b)
+		{
+			return a < b ? -1 : (b < a ? 1 : 0);
+		}
+
+		template <size_t... Positions>
+		static int compareAt(const Value& a, const Value& b, size_t position, std::index_sequence<Positions...>)
+		{
+			int result = 0;
+			((Positions == position ? (void)(result = compare(std::get<Positions>(a), std::get<Positions>(b))) : (void)0), ...);
+			return result;
+		}
+	};
+
+	// Statically typed view of a table. Column names, key columns and their
+	// types are fixed at compile time, so rows and key values are built
+	// field by field instead of through string-keyed lookups in user code.
+	// Keys must list every key of the table, since appendRow indexes a row
+	// only under the keys it is given.
+	//
+	// The calls below go through the JSON API: each converts the row or key to
+	// json and back and then runs exactly as the JSON call would. Code that
+	// keeps its own copy of an index can stay typed with Key::extract and
+	// Key::Index instead, which order keys exactly as the table does.
+	template <typename Row, typename... Keys>
+	class TypedTable
+	{
+	private:
+		Database& database;
+		std::string tableName;
+		Connection connection;
+
+		static std::optional<Row> toOptionalRow(std::function<json()> read, ErrorCode missing)
+		{
+			try
+			{
+				return fromJson(read());
+			}
+			catch (const DatabaseException& ex)
+			{
+				if (ex.getErrorNumber() == missing)
+				{
+					return std::nullopt;
+				}
+				throw;
+			}
+		}
+	public:
+		TypedTable(Database& database, std::string tableName, Connection connection)
+			: database(database), tableName(std::move(tableName)), connection(connection)
+		{}
+
+		static json toJson(const Row& row)
+		{
+			json value = json::object();
+			std::apply([&](const auto&... columns) { ((value[columns.name] = row.*(columns.member)), ...); },
+				RowTraits<Row>::columns);
+			return value;
+		}
+
+		static Row fromJson(const json& value)
+		{
+			Row row{};
+			std::apply([&](const auto&... columns)
+			{
+				auto get = [&](const auto& column)
+				{
+					auto field = value.find(column.name);
+					if (field != value.end())
+					{
+						field->get_to(row.*(column.member));
+					}
+				};
+				(get(columns), ...);
+			}, RowTraits<Row>::columns);
+			return row;
+		}
+
+		static json getKeysJson()
+		{
+			json keys = json::object();
+			((keys[Keys::name] = Keys::getColumnNames()), ...);
+			return keys;
+		}
+
+		void create(const json& options = json::object())
+		{
+			database.createTable(tableName, getKeysJson(), options, connection);
+		}
+
+		void insert(const Row& row)
+		{
+			json keys = json::object();
+			((keys[Keys::name] = Keys::fromRow(row)), ...);
+			database.appendRow(tableName, keys, toJson(row), connection);
+		}
+
+		template <typename Key>
+		std::optional<Row> get(const typename Key::Value& keyValue)
+		{
+			json keyJson = { {Key::name, Key::toJson(keyValue)} };
+			return toOptionalRow([&]() { return database.getRowByKey(tableName, keyJson, connection); },
+				ErrorCode::KEY_VALUE_NOT_FOUND);
+		}
+
+		template <typename Key>
+		std::optional<Row> first(bool isReversed = false)
+		{
+			return toOptionalRow([&]()
+			{
+				return database.getRowInSortedTable(tableName, Key::name, isReversed, connection);
+			}, ErrorCode::TABLE_IS_EMPTY);
+		}
+
+		std::optional<Row> next()
+		{
+			return toOptionalRow([&]() { return database.getNextRow(tableName, connection); },
+				ErrorCode::NO_MORE_DATA_AVAILABLE);
+		}
+
+		std::optional<Row> prev()
+		{
+			return toOptionalRow([&]() { return database.getPrevRow(tableName, connection); },
+				ErrorCode::NO_MORE_DATA_AVAILABLE);
+		}
+
+		void removeCurrent()
+		{
+			database.removeRow(tableName, connection);
+		}
+
+		template <typename Key>
+		Offset count()
+		{
+			return database.count(tableName, Key::name, connection);
+		}
+	};
+}
@@ -0,0 +1,562 @@
+// Standalone benchmarks for the Database API.
+//
+//   DatabaseBenchmarks [--rows 10000,1000000,10000000] [--threads 1,2,4,8,16,32,64]
+//                      [--operations 10000] [--engine log|file] [--storage file|memory]
+//                      [--maintenance off|on] [--dir benchmark_data]
+//                      [--output results.json] [--label <commit>]
+//
+// A summary is printed to stderr and the full report, with latency percentiles
+// and heap allocations per operation for every benchmark, is written as JSON
+// to stdout or to --output.
+
+#include "Database.h"
+#include "Stats.h"
+#include "TypedTable.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using DatabaseLib::json;
+
+namespace
+{
+	std::atomic<std::uint64_t> allocations(0);
+}
+
+// Every heap allocation made by the process is counted, so a benchmark can
+// report how many allocations one operation costs. GCC sees the free of
+// memory from operator new once these are inlined and warns about it.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void* operator new(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* memory = std::malloc(size == 0 ? 1 : size))
+	{
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace
+{
+	struct ClientRow
+	{
+		std::uint64_t id = 0;
+		std::string name;
+		std::string email;
+		std::string message;
+	};
+}
+
+template <>
+struct DatabaseLib::RowTraits<ClientRow>
+{
+	static constexpr auto columns = std::make_tuple(DatabaseLib::column("id", &ClientRow::id),
+		DatabaseLib::column("name", &ClientRow::name), DatabaseLib::column("email", &ClientRow::email),
+		DatabaseLib::column("message", &ClientRow::message));
+};
+
+namespace
+{
+	struct IdNameKey : DatabaseLib::TypedKey<ClientRow, 0, 1> { static constexpr const char* name = "idNameKey"; };
+
+	struct Options
+	{
+		std::vector<size_t> rowCounts = { 10000 };
+		std::vector<unsigned> threadCounts = { 1, 2, 4, 8, 16, 32, 64 };
+		size_t operations = 10000;
+		std::string engine = "log";
+		std::string storage = "file";
+		std::string maintenance = "off";
+		std::string directory = "benchmark_data";
+		std::string output;
+		std::string label;
+	};
+
+	const std::string TABLE_NAME = "clients";
+
+	template <typename Number>
+	std::vector<Number> parseList(std::string text)
+	{
+		std::vector<Number> values;
+		std::stringstream stream(text);
+		std::string item;
+		while (std::getline(stream, item, ','))
+		{
+			values.push_back((Number)std::stoull(item));
+		}
+		return values;
+	}
+
+	Options parseOptions(int argc, char** argv)
+	{
+		Options options;
+		for (int i = 1; i + 1 < argc; i += 2)
+		{
+			std::string name = argv[i];
+			std::string value = argv[i + 1];
+			if (name == "--rows")
+			{
+				options.rowCounts = parseList<size_t>(value);
+			}
+			else if (name == "--threads")
+			{
+				options.threadCounts = parseList<unsigned>(value);
+			}
+			else if (name == "--operations")
+			{
+				options.operations = std::stoull(value);
+			}
+			else if (name == "--engine")
+			{
+				options.engine = value;
+			}
+			else if (name == "--storage")
+			{
+				options.storage = value;
+			}
+			else if (name == "--maintenance")
+			{
+				options.maintenance = value;
+			}
+			else if (name == "--dir")
+			{
+				options.directory = value;
+			}
+			else if (name == "--output")
+			{
+				options.output = value;
+			}
+			else if (name == "--label")
+			{
+				options.label = value;
+			}
+			else
+			{
+				throw std::invalid_argument("Unknown option: " + name);
+			}
+		}
+		return options;
+	}
+
+	std::string getEmail(size_t row)
+	{
+		return "user" + std::to_string(row) + "@mail.com";
+	}
+
+	json getEmailKey(size_t row)
+	{
+		return { {"email", getEmail(row)} };
+	}
+
+	json getIdNameKey(size_t row)
+	{
+		return { {"id", row / 4}, {"name", "user" + std::to_string(row)} };
+	}
+
+	json getClientKeys(size_t row)
+	{
+		return { {"emailKey", getEmailKey(row)}, {"idNameKey", getIdNameKey(row)} };
+	}
+
+	json getClientValue(size_t row)
+	{
+		return { {"message", "message " + std::to_string(row % 100)} };
+	}
+
+	void appendClient(DatabaseLib::Database& database, size_t row, DatabaseLib::Connection connection)
+	{
+		database.appendRow(TABLE_NAME, getClientKeys(row), getClientValue(row), connection);
+	}
+
+	std::uint64_t elapsedNanoseconds(std::chrono::steady_clock::time_point started)
+	{
+		return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - started).count();
+	}
+
+	class Report
+	{
+	private:
+		json results = json::array();
+	public:
+		void add(std::string name, size_t rows, unsigned threads, std::uint64_t operations,
+			std::uint64_t nanoseconds, const DatabaseLib::Histogram& latency, std::uint64_t allocated)
+		{
+			double seconds = nanoseconds / 1e9;
+			double allocationsPerOperation = operations > 0 ? (double)allocated / operations : 0.0;
+			json latencySummary = latency.toJson();
+			results.push_back({ {"name", name}, {"rows", rows}, {"threads", threads}, {"operations", operations},
+				{"seconds", seconds}, {"operationsPerSecond", seconds > 0 ? operations / seconds : 0.0},
+				{"allocationsPerOperation", allocationsPerOperation}, {"latency", latencySummary} });
+
+			std::cerr << name << " rows=" << rows << " threads=" << threads << " ops=" << operations
+				<< " ops/s=" << (seconds > 0 ? (std::uint64_t)(operations / seconds) : 0)
+				<< " allocs/op=" << allocationsPerOperation
+				<< " p50=" << latencySummary.value("p50Ns", 0ull) << "ns"
+				<< " p99=" << latencySummary.value("p99Ns", 0ull) << "ns"
+				<< " max=" << latencySummary.value("maxNs", 0ull) << "ns" << std::endl;
+		}
+
+		json toJson(const Options& options) const
+		{
+			return { {"label", options.label}, {"engine", options.engine}, {"storage", options.storage},
+				{"maintenance", options.maintenance}, {"results", results} };
+		}
+	};
+
+	void runInsert(DatabaseLib::Database& database, size_t rows, Report& report, DatabaseLib::Connection connection)
+	{
+		DatabaseLib::Histogram latency;
+		std::uint64_t allocated = 0;
+		auto started = std::chrono::steady_clock::now();
+		for (size_t row = 0; row < rows; row++)
+		{
+			json keys = getClientKeys(row);
+			json value = getClientValue(row);
+			std::uint64_t allocatedBefore = allocations.load(std::memory_order_relaxed);
+			auto appended = std::chrono::steady_clock::now();
+			database.appendRow(TABLE_NAME, keys, std::move(value), connection);
+			latency.record(elapsedNanoseconds(appended));
+			allocated += allocations.load(std::memory_order_relaxed) - allocatedBefore;
+		}
+		report.add("insert", rows, 1, rows, elapsedNanoseconds(started), latency, allocated);
+	}
+
+	void runLookups(DatabaseLib::Database& database, size_t rows, size_t operations, Report& report,
+		DatabaseLib::Connection connection)
+	{
+		std::mt19937_64 random(rows);
+		for (std::string keyName : { "emailKey", "idNameKey" })
+		{
+			DatabaseLib::Histogram latency;
+			std::uint64_t allocated = 0;
+			auto started = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < operations; i++)
+			{
+				size_t row = random() % rows;
+				json key = { {keyName, keyName == "emailKey" ? getEmailKey(row) : getIdNameKey(row)} };
+				std::uint64_t allocatedBefore = allocations.load(std::memory_order_relaxed);
+				auto lookedUp = std::chrono::steady_clock::now();
+				database.getRowByKey(TABLE_NAME, key, connection);
+				latency.record(elapsedNanoseconds(lookedUp));
+				allocated += allocations.load(std::memory_order_relaxed) - allocatedBefore;
+			}
+			report.add(keyName == "emailKey" ? "lookupSingleKey" : "lookupCompositeKey", rows, 1, operations,
+				elapsedNanoseconds(started), latency, allocated);
+		}
+	}
+
+	void runSortedScan(DatabaseLib::Database& database, size_t rows, Report& report, DatabaseLib::Connection connection)
+	{
+		DatabaseLib::Histogram latency;
+		std::uint64_t scanned = 0;
+		std::uint64_t allocatedBefore = allocations.load(std::memory_order_relaxed);
+		auto started = std::chrono::steady_clock::now();
+		database.getRowInSortedTable(TABLE_NAME, "emailKey", false, connection);
+		scanned++;
+		while (true)
+		{
+			auto read = std::chrono::steady_clock::now();
+			try
+			{
+				database.getNextRow(TABLE_NAME, connection);
+			}
+			catch (const DatabaseLib::DatabaseException&)
+			{
+				break;
+			}
+			latency.record(elapsedNanoseconds(read));
+			scanned++;
+		}
+		report.add("sortedScan", rows, 1, scanned, elapsedNanoseconds(started), latency,
+			allocations.load(std::memory_order_relaxed) - allocatedBefore);
+	}
+
+	void runSplitScan(DatabaseLib::Database& database, size_t rows, const Options& options, Report& report)
+	{
+		for (unsigned threadCount : options.threadCounts)
+		{
+			DatabaseLib::Histogram latency;
+			std::atomic<std::uint64_t> scanned(0);
+			DatabaseLib::Connection connection = database.connect();
+			std::uint64_t allocatedBefore = allocations.load(std::memory_order_relaxed);
+			auto started = std::chrono::steady_clock::now();
+			std::vector<DatabaseLib::CursorId> parts = database.splitScan(TABLE_NAME, "emailKey", threadCount, connection);
+			std::vector<std::thread> threads;
+			for (DatabaseLib::CursorId part : parts)
+			{
+				threads.emplace_back([&, part]()
+				{
+					while (true)
+					{
+						auto read = std::chrono::steady_clock::now();
+						try
+						{
+							database.fetchRow(part, connection);
+						}
+						catch (const DatabaseLib::DatabaseException&)
+						{
+							break;
+						}
+						latency.record(elapsedNanoseconds(read));
+						scanned++;
+					}
+				});
+			}
+			for (auto& thread : threads)
+			{
+				thread.join();
+			}
+			report.add("splitScan", rows, threadCount, scanned, elapsedNanoseconds(started), latency,
+				allocations.load(std::memory_order_relaxed) - allocatedBefore);
+			database.disconnect(connection);
+		}
+	}
+
+	void runMixed(DatabaseLib::Database& database, size_t rows, const Options& options, Report& report)
+	{
+		std::atomic<size_t> nextRow(rows * 2);
+		for (unsigned threadCount : options.threadCounts)
+		{
+			DatabaseLib::Histogram latency;
+			size_t operationsPerThread = std::max<size_t>(1, options.operations / threadCount);
+			std::vector<std::thread> threads;
+			std::uint64_t allocatedBefore = allocations.load(std::memory_order_relaxed);
+			auto started = std::chrono::steady_clock::now();
+			for (unsigned thread = 0; thread < threadCount; thread++)
+			{
+				threads.emplace_back([&, thread]()
+				{
+					DatabaseLib::Connection connection = database.connect();
+					std::mt19937_64 random(thread);
+					for (size_t i = 0; i < operationsPerThread; i++)
+					{
+						auto operationStarted = std::chrono::steady_clock::now();
+						if (random() % 10 == 0)
+						{
+							appendClient(database, nextRow++, connection);
+						}
+						else
+						{
+							database.getRowByKey(TABLE_NAME, { {"emailKey", getEmailKey(random() % rows)} }, connection);
+						}
+						latency.record(elapsedNanoseconds(operationStarted));
+					}
+					database.disconnect(connection);
+				});
+			}
+			for (auto& thread : threads)
+			{
+				thread.join();
+			}
+			report.add("mixedReadWrite", rows, threadCount, operationsPerThread * threadCount,
+				elapsedNanoseconds(started), latency, allocations.load(std::memory_order_relaxed) - allocatedBefore);
+		}
+	}
+
+	void runAddKey(DatabaseLib::Database& database, size_t rows, Report& report, DatabaseLib::Connection connection)
+	{
+		DatabaseLib::Histogram latency;
+		std::uint64_t allocatedBefore = allocations.load(std::memory_order_relaxed);
+		auto started = std::chrono::steady_clock::now();
+		database.addKey(TABLE_NAME, { {"messageKey", {"message"}} }, connection);
+		std::uint64_t nanoseconds = elapsedNanoseconds(started);
+		latency.record(nanoseconds);
+		report.add("addKey", rows, 1, 1, nanoseconds, latency,
+			allocations.load(std::memory_order_relaxed) - allocatedBefore);
+	}
+
+	void runUpdate(DatabaseLib::Database& database, size_t rows, size_t operations, Report& report,
+		DatabaseLib::Connection connection)
+	{
+		std::mt19937_64 random(rows + 1);
+		DatabaseLib::Histogram latency;
+		std::uint64_t nanoseconds = 0;
+		std::uint64_t allocated = 0;
+		for (size_t i = 0; i < operations; i++)
+		{
+			database.getRowByKey(TABLE_NAME, { {"emailKey", getEmailKey(random() % rows)} }, connection);
+			json fields = { {"message", "updated " + std::to_string(i % 1000)} };
+			std::uint64_t allocatedBefore = allocations.load(std::memory_order_relaxed);
+			auto started = std::chrono::steady_clock::now();
+			database.updateRow(TABLE_NAME, fields, connection);
+			std::uint64_t elapsed = elapsedNanoseconds(started);
+			latency.record(elapsed);
+			nanoseconds += elapsed;
+			allocated += allocations.load(std::memory_order_relaxed) - allocatedBefore;
+		}
+		report.add("update", rows, 1, operations, nanoseconds, latency, allocated);
+	}
+
+	void runDelete(DatabaseLib::Database& database, size_t rows, size_t operations, Report& report,
+		DatabaseLib::Connection connection)
+	{
+		DatabaseLib::Histogram latency;
+		size_t removals = std::min(operations, rows / 10 + 1);
+		std::uint64_t nanoseconds = 0;
+		std::uint64_t allocated = 0;
+		for (size_t row = 0; row < removals; row++)
+		{
+			database.getRowByKey(TABLE_NAME, { {"emailKey", getEmailKey(row)} }, connection);
+			std::uint64_t allocatedBefore = allocations.load(std::memory_order_relaxed);
+			auto started = std::chrono::steady_clock::now();
+			database.removeRow(TABLE_NAME, connection);
+			std::uint64_t elapsed = elapsedNanoseconds(started);
+			latency.record(elapsed);
+			nanoseconds += elapsed;
+			allocated += allocations.load(std::memory_order_relaxed) - allocatedBefore;
+		}
+		report.add("delete", rows, 1, removals, nanoseconds, latency, allocated);
+	}
+
+	// Builds a copy of the idNameKey index and looks keys up in it, once with
+	// json keys as the table keeps them and once with typed keys.
+	template <typename Index, typename GetKey>
+	void runKeyIndex(const std::string& name, const std::vector<ClientRow>& clientRows, size_t operations,
+		GetKey getKey, Report& report)
+	{
+		DatabaseLib::Histogram latency;
+		Index index;
+		std::mt19937_64 random(clientRows.size());
+		std::uint64_t allocatedBefore = allocations.load(std::memory_order_relaxed);
+		auto started = std::chrono::steady_clock::now();
+		for (size_t row = 0; row < clientRows.size(); row++)
+		{
+			auto inserted = std::chrono::steady_clock::now();
+			index[getKey(clientRows[row])].push_back(row);
+			latency.record(elapsedNanoseconds(inserted));
+		}
+		size_t found = 0;
+		for (size_t i = 0; i < operations; i++)
+		{
+			auto lookedUp = std::chrono::steady_clock::now();
+			found += index.count(getKey(clientRows[random() % clientRows.size()]));
+			latency.record(elapsedNanoseconds(lookedUp));
+		}
+		if (found != operations)
+		{
+			throw std::logic_error(name + " lost keys");
+		}
+		report.add(name, clientRows.size(), 1, clientRows.size() + operations, elapsedNanoseconds(started), latency,
+			allocations.load(std::memory_order_relaxed) - allocatedBefore);
+	}
+
+	void runTypedKeys(size_t rows, size_t operations, Report& report)
+	{
+		std::vector<ClientRow> clientRows;
+		clientRows.reserve(rows);
+		for (size_t row = 0; row < rows; row++)
+		{
+			clientRows.push_back({ row / 4, "user" + std::to_string(row), getEmail(row), "" });
+		}
+		runKeyIndex<DatabaseLib::Indexes>("keyIndexJson", clientRows, operations,
+			[](const ClientRow& row) { return IdNameKey::fromRow(row); }, report);
+		runKeyIndex<IdNameKey::Index>("keyIndexTyped", clientRows, operations,
+			[](const ClientRow& row) { return IdNameKey::extract(row); }, report);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	try
+	{
+		options = parseOptions(argc, argv);
+	}
+	catch (const std::exception& ex)
+	{
+		std::cerr << ex.what() << std::endl;
+		return 2;
+	}
+
+	std::filesystem::path workingDirectory = std::filesystem::current_path();
+	std::filesystem::remove_all(options.directory);
+	std::filesystem::create_directories(options.directory);
+	std::filesystem::current_path(options.directory);
+
+	Report report;
+	try
+	{
+		for (size_t rows : options.rowCounts)
+		{
+			std::shared_ptr<DatabaseLib::Storage> storage;
+			if (options.storage == "memory")
+			{
+				storage = std::make_shared<DatabaseLib::MemoryStorage>();
+			}
+			else
+			{
+				storage = std::make_shared<DatabaseLib::FileStorage>();
+			}
+			DatabaseLib::Database database(storage);
+			if (options.maintenance == "on")
+			{
+				database.enableMaintenance(json::object());
+			}
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable(TABLE_NAME, keys, { {"engine", options.engine} }, connection);
+
+			runInsert(database, rows, report, connection);
+			runLookups(database, rows, options.operations, report, connection);
+			runSortedScan(database, rows, report, connection);
+			runSplitScan(database, rows, options, report);
+			runMixed(database, rows, options, report);
+			runAddKey(database, rows, report, connection);
+			runUpdate(database, rows, options.operations, report, connection);
+			runDelete(database, rows, options.operations, report, connection);
+			runTypedKeys(rows, options.operations, report);
+
+			database.removeTable(TABLE_NAME, connection);
+			database.disconnect(connection);
+		}
+	}
+	catch (const std::exception& ex)
+	{
+		std::cerr << "Benchmark failed: " << ex.what() << std::endl;
+		std::filesystem::current_path(workingDirectory);
+		return 1;
+	}
+
+	std::filesystem::current_path(workingDirectory);
+	std::filesystem::remove_all(options.directory);
+
+	json result = report.toJson(options);
+	if (options.output.empty())
+	{
+		std::cout << result.dump(2) << std::endl;
+	}
+	else
+	{
+		std::ofstream outputFile(options.output);
+		outputFile << result.dump(2) << std::endl;
+	}
+	return 0;
+}
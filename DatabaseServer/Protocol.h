@@ -0,0 +1,124 @@
+#pragma once
+#include "JsonComparator.h"
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace DatabaseLib
+{
+	// Frames are little-endian: a 4-byte payload length, a 4-byte request id, a
+	// 1-byte command (requests) or status (responses), then the payload as
+	// MessagePack. Request payloads are arrays of arguments; a response holds
+	// the result, or the error message when the status is not OK. Responses
+	// come back in request order, so a client may send many requests before
+	// reading any of them. A JOIN answers with a MORE frame per batch followed
+	// by an OK frame, or an error frame, with the same request id.
+	enum class Command : std::uint8_t
+	{
+		CREATE_TABLE = 1,
+		REMOVE_TABLE,
+		ADD_KEY,
+		REMOVE_KEY,
+		REORGANIZE_TABLE,
+		CHECKPOINT,
+		GET_ROW_BY_KEY,
+		GET_ROW_IN_SORTED_TABLE,
+		GET_NEXT_ROW,
+		GET_PREV_ROW,
+		OPEN_CURSOR,
+		SPLIT_SCAN,
+		FETCH_ROW,
+		CLOSE_CURSOR,
+		GET_PAGE,
+		FIND,
+		COUNT,
+		MIN_KEY,
+		MAX_KEY,
+		JOIN,
+		SUM,
+		AVG,
+		APPEND_ROW,
+		REMOVE_ROW,
+		UPDATE_ROW,
+		UPSERT,
+		GET_STATS,
+		GET_LOCK_PROFILE,
+		// Arguments are [[command, arguments], ...]; the result is [[status, result], ...].
+		BATCH,
+		READ_CHANGES,
+		// Arguments are [requestId]; stops a JOIN of the same client early. It
+		// has no response of its own.
+		CANCEL
+	};
+
+	struct Frame
+	{
+		std::uint32_t requestId = 0;
+		std::uint8_t code = 0;
+		json payload;
+	};
+
+	struct Protocol
+	{
+		static constexpr size_t HEADER_SIZE = 9;
+		static constexpr std::uint32_t MAX_PAYLOAD_SIZE = 64u << 20;
+		static constexpr std::uint8_t STATUS_OK = 0;
+		// A part of the result; more frames for the same request follow.
+		static constexpr std::uint8_t STATUS_MORE = 254;
+		// Failures other than DatabaseException; the payload holds the message.
+		static constexpr std::uint8_t STATUS_FAILED = 255;
+
+		static void appendFrame(std::string& output, std::uint32_t requestId, std::uint8_t code, const json& payload)
+		{
+			std::vector<std::uint8_t> encoded = json::to_msgpack(payload);
+			appendInteger(output, (std::uint32_t)encoded.size());
+			appendInteger(output, requestId);
+			output.push_back((char)code);
+			output.append((const char*)encoded.data(), encoded.size());
+		}
+
+		// Returns false until the buffer starting at position holds a whole frame;
+		// throws std::length_error for frames over MAX_PAYLOAD_SIZE.
+		static bool readFrame(const std::string& input, size_t& position, Frame& frame)
+		{
+			if (input.size() - position < HEADER_SIZE)
+			{
+				return false;
+			}
+			std::uint32_t length = readInteger(input, position);
+			if (length > MAX_PAYLOAD_SIZE)
+			{
+				throw std::length_error("Frame of " + std::to_string(length) + " bytes is too large");
+			}
+			if (input.size() - position < HEADER_SIZE + length)
+			{
+				return false;
+			}
+			frame.requestId = readInteger(input, position + 4);
+			frame.code = (std::uint8_t)input[position + 8];
+			const char* payload = input.data() + position + HEADER_SIZE;
+			frame.payload = json::from_msgpack(payload, payload + length);
+			position += HEADER_SIZE + length;
+			return true;
+		}
+	private:
+		static void appendInteger(std::string& output, std::uint32_t value)
+		{
+			for (int shift = 0; shift < 32; shift += 8)
+			{
+				output.push_back((char)((value >> shift) & 0xff));
+			}
+		}
+
+		static std::uint32_t readInteger(const std::string& input, size_t position)
+		{
+			std::uint32_t value = 0;
+			for (int i = 3; i >= 0; i--)
+			{
+				value = (value << 8) | (std::uint8_t)input[position + (size_t)i];
+			}
+			return value;
+		}
+	};
+}
@@ -0,0 +1,366 @@
+#include "RemoteDatabase.h"
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace DatabaseLib
+{
+	namespace
+	{
+		const size_t READ_CHUNK_SIZE = 1 << 16;
+		const size_t MAX_QUEUED_SIZE = 1 << 20;
+	}
+
+	RemoteDatabase::RemoteDatabase(const std::string& socketPath)
+	{
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		if (socketPath.size() >= sizeof(address.sun_path))
+		{
+			throw DatabaseException("Socket path is too long: " + socketPath, ErrorCode::NO_CONNECTION);
+		}
+		std::strcpy(address.sun_path, socketPath.c_str());
+		socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (socket < 0 || ::connect(socket, (sockaddr*)&address, sizeof(address)) < 0)
+		{
+			std::string error = std::strerror(errno);
+			if (socket >= 0)
+			{
+				::close(socket);
+			}
+			throw DatabaseException("Cannot connect to " + socketPath + ": " + error, ErrorCode::NO_CONNECTION);
+		}
+	}
+
+	RemoteDatabase::~RemoteDatabase()
+	{
+		::close(socket);
+	}
+
+	std::uint32_t RemoteDatabase::send(Command command, const json& arguments)
+	{
+		std::uint32_t requestId = nextRequestId++;
+		Protocol::appendFrame(output, requestId, (std::uint8_t)command, arguments);
+		if (output.size() >= MAX_QUEUED_SIZE)
+		{
+			flush();
+		}
+		return requestId;
+	}
+
+	json RemoteDatabase::receive(std::uint32_t requestId)
+	{
+		json parts;
+		while (true)
+		{
+			Frame frame = receiveFrame(requestId);
+			if (frame.code != Protocol::STATUS_MORE)
+			{
+				json result = getResult(frame.code, std::move(frame.payload));
+				return parts.is_null() ? result : parts;
+			}
+			parts.push_back(std::move(frame.payload));
+		}
+	}
+
+	Frame RemoteDatabase::receiveFrame(std::uint32_t requestId)
+	{
+		flush();
+		auto response = responses.find(requestId);
+		if (response != responses.end())
+		{
+			Frame frame = std::move(response->second.front());
+			response->second.pop_front();
+			if (response->second.empty())
+			{
+				responses.erase(response);
+			}
+			return frame;
+		}
+		while (true)
+		{
+			Frame frame = readFrame();
+			if (frame.requestId == requestId)
+			{
+				return frame;
+			}
+			responses[frame.requestId].push_back(std::move(frame));
+		}
+	}
+
+	json RemoteDatabase::call(Command command, const json& arguments)
+	{
+		return receive(send(command, arguments));
+	}
+
+	std::vector<json> RemoteDatabase::batch(const std::vector<std::pair<Command, json>>& requests)
+	{
+		json arguments = json::array();
+		for (auto& request : requests)
+		{
+			arguments.push_back(json::array({ (std::uint8_t)request.first, request.second }));
+		}
+		json results = call(Command::BATCH, arguments);
+
+		std::vector<json> values;
+		values.reserve(results.size());
+		std::exception_ptr firstError;
+		for (auto& result : results)
+		{
+			try
+			{
+				values.push_back(getResult(result[0].get<std::uint8_t>(), std::move(result[1])));
+			}
+			catch (...)
+			{
+				values.push_back(json());
+				if (!firstError)
+				{
+					firstError = std::current_exception();
+				}
+			}
+		}
+		if (firstError)
+		{
+			std::rethrow_exception(firstError);
+		}
+		return values;
+	}
+
+	void RemoteDatabase::flush()
+	{
+		size_t sent = 0;
+		while (sent < output.size())
+		{
+			ssize_t written = ::send(socket, output.data() + sent, output.size() - sent, MSG_NOSIGNAL);
+			if (written < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (written <= 0)
+			{
+				throw DatabaseException("Connection to the server was lost", ErrorCode::NO_CONNECTION);
+			}
+			sent += (size_t)written;
+		}
+		output.clear();
+	}
+
+	Frame RemoteDatabase::readFrame()
+	{
+		Frame frame;
+		while (!Protocol::readFrame(input, inputPosition, frame))
+		{
+			input.erase(0, inputPosition);
+			inputPosition = 0;
+			size_t size = input.size();
+			input.resize(size + READ_CHUNK_SIZE);
+			ssize_t received = ::recv(socket, &input[size], READ_CHUNK_SIZE, 0);
+			input.resize(size + (received > 0 ? (size_t)received : 0));
+			if (received < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (received <= 0)
+			{
+				throw DatabaseException("Connection to the server was lost", ErrorCode::NO_CONNECTION);
+			}
+		}
+		return frame;
+	}
+
+	json RemoteDatabase::getResult(std::uint8_t status, json payload)
+	{
+		if (status == Protocol::STATUS_OK)
+		{
+			return payload;
+		}
+		std::string message = payload.is_string() ? payload.get<std::string>() : payload.dump();
+		if (status == Protocol::STATUS_FAILED)
+		{
+			throw std::runtime_error(message);
+		}
+		throw DatabaseException(message, (ErrorCode)status);
+	}
+
+	void RemoteDatabase::createTable(const std::string& tableName, const json& keysJson, const json& options)
+	{
+		call(Command::CREATE_TABLE, json::array({ tableName, keysJson, options }));
+	}
+
+	void RemoteDatabase::removeTable(const std::string& tableName)
+	{
+		call(Command::REMOVE_TABLE, json::array({ tableName }));
+	}
+
+	void RemoteDatabase::addKey(const std::string& tableName, const json& keysJson, const json& includedColumns)
+	{
+		call(Command::ADD_KEY, json::array({ tableName, keysJson, includedColumns }));
+	}
+
+	void RemoteDatabase::removeKey(const std::string& tableName, const std::string& keyName)
+	{
+		call(Command::REMOVE_KEY, json::array({ tableName, keyName }));
+	}
+
+	void RemoteDatabase::reorganizeTable(const std::string& tableName)
+	{
+		call(Command::REORGANIZE_TABLE, json::array({ tableName }));
+	}
+
+	void RemoteDatabase::checkpoint(const std::string& directory, Offset bytesPerSecond)
+	{
+		call(Command::CHECKPOINT, json::array({ directory, bytesPerSecond }));
+	}
+
+	json RemoteDatabase::getRowByKey(const std::string& tableName, const json& keyJson, const json& projection)
+	{
+		return call(Command::GET_ROW_BY_KEY, json::array({ tableName, keyJson, projection }));
+	}
+
+	json RemoteDatabase::getRowInSortedTable(const std::string& tableName, const std::string& keyName, bool isReversed)
+	{
+		return call(Command::GET_ROW_IN_SORTED_TABLE, json::array({ tableName, keyName, isReversed }));
+	}
+
+	json RemoteDatabase::getNextRow(const std::string& tableName)
+	{
+		return call(Command::GET_NEXT_ROW, json::array({ tableName }));
+	}
+
+	json RemoteDatabase::getPrevRow(const std::string& tableName)
+	{
+		return call(Command::GET_PREV_ROW, json::array({ tableName }));
+	}
+
+	CursorId RemoteDatabase::openCursor(const std::string& tableName, const std::string& keyName)
+	{
+		return call(Command::OPEN_CURSOR, json::array({ tableName, keyName })).get<CursorId>();
+	}
+
+	std::vector<CursorId> RemoteDatabase::splitScan(const std::string& tableName, const std::string& keyName,
+		unsigned parts)
+	{
+		return call(Command::SPLIT_SCAN, json::array({ tableName, keyName, parts })).get<std::vector<CursorId>>();
+	}
+
+	json RemoteDatabase::fetchRow(CursorId cursorId)
+	{
+		return call(Command::FETCH_ROW, json::array({ cursorId }));
+	}
+
+	void RemoteDatabase::closeCursor(CursorId cursorId)
+	{
+		call(Command::CLOSE_CURSOR, json::array({ cursorId }));
+	}
+
+	json RemoteDatabase::getPage(const std::string& tableName, const std::string& keyName, unsigned pageSize,
+		const std::string& continuationToken)
+	{
+		return call(Command::GET_PAGE, json::array({ tableName, keyName, pageSize, continuationToken }));
+	}
+
+	json RemoteDatabase::find(const std::string& tableName, const json& predicate, const json& projection,
+		unsigned limit)
+	{
+		return call(Command::FIND, json::array({ tableName, predicate, projection, limit }));
+	}
+
+	json RemoteDatabase::find(const std::string& tableName, const json& predicate, const json& projection,
+		unsigned limit, const std::string& continuationToken)
+	{
+		return call(Command::FIND, json::array({ tableName, predicate, projection, limit, continuationToken }));
+	}
+
+	Offset RemoteDatabase::count(const std::string& tableName, const std::string& keyName)
+	{
+		return call(Command::COUNT, json::array({ tableName, keyName })).get<Offset>();
+	}
+
+	Offset RemoteDatabase::count(const std::string& tableName, const std::string& keyName, const json& from,
+		const json& to)
+	{
+		return call(Command::COUNT, json::array({ tableName, keyName, from, to })).get<Offset>();
+	}
+
+	json RemoteDatabase::minKey(const std::string& tableName, const std::string& keyName)
+	{
+		return call(Command::MIN_KEY, json::array({ tableName, keyName }));
+	}
+
+	json RemoteDatabase::maxKey(const std::string& tableName, const std::string& keyName)
+	{
+		return call(Command::MAX_KEY, json::array({ tableName, keyName }));
+	}
+
+	void RemoteDatabase::join(const std::string& leftTableName, const std::string& rightTableName,
+		const std::string& rightKeyName, unsigned batchSize, std::function<bool(json)> onBatch)
+	{
+		std::uint32_t requestId = send(Command::JOIN, json::array({ leftTableName, rightTableName, rightKeyName, batchSize }));
+		bool isContinued = true;
+		while (true)
+		{
+			Frame frame = receiveFrame(requestId);
+			if (frame.code != Protocol::STATUS_MORE)
+			{
+				getResult(frame.code, std::move(frame.payload));
+				return;
+			}
+			if (isContinued && !onBatch(std::move(frame.payload)))
+			{
+				// Batches sent before the server sees the cancel are still read.
+				send(Command::CANCEL, json::array({ requestId }));
+				isContinued = false;
+			}
+		}
+	}
+
+	json RemoteDatabase::sum(const std::string& tableName, const std::string& column, const json& predicate)
+	{
+		return call(Command::SUM, json::array({ tableName, column, predicate }));
+	}
+
+	json RemoteDatabase::avg(const std::string& tableName, const std::string& column, const json& predicate)
+	{
+		return call(Command::AVG, json::array({ tableName, column, predicate }));
+	}
+
+	void RemoteDatabase::appendRow(const std::string& tableName, const json& keys, const json& value)
+	{
+		call(Command::APPEND_ROW, json::array({ tableName, keys, value }));
+	}
+
+	void RemoteDatabase::removeRow(const std::string& tableName)
+	{
+		call(Command::REMOVE_ROW, json::array({ tableName }));
+	}
+
+	void RemoteDatabase::updateRow(const std::string& tableName, const json& fields)
+	{
+		call(Command::UPDATE_ROW, json::array({ tableName, fields }));
+	}
+
+	void RemoteDatabase::upsert(const std::string& tableName, const json& keys, const json& value)
+	{
+		call(Command::UPSERT, json::array({ tableName, keys, value }));
+	}
+
+	json RemoteDatabase::getStats()
+	{
+		return call(Command::GET_STATS, json::array());
+	}
+
+	json RemoteDatabase::getLockProfile()
+	{
+		return call(Command::GET_LOCK_PROFILE, json::array());
+	}
+
+	json RemoteDatabase::readChanges(std::uint64_t afterSequence, unsigned limit)
+	{
+		return call(Command::READ_CHANGES, json::array({ afterSequence, limit }));
+	}
+}
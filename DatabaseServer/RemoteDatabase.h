@@ -0,0 +1,88 @@
+#pragma once
+#include "Database.h"
+#include "Protocol.h"
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace DatabaseLib
+{
+	// Client of a Server. Mirrors the Database API, with the socket standing in
+	// for the Connection argument. Errors of the database come back as
+	// DatabaseException with the original error code.
+	//
+	// Requests can be pipelined: send queues a request and returns its id,
+	// receive flushes the queue and waits for that response.
+	class RemoteDatabase
+	{
+	private:
+		int socket = -1;
+		std::uint32_t nextRequestId = 1;
+		std::string output;
+		std::string input;
+		size_t inputPosition = 0;
+		std::unordered_map<std::uint32_t, std::deque<Frame>> responses;
+
+		void flush();
+		Frame readFrame();
+		Frame receiveFrame(std::uint32_t requestId);
+		static json getResult(std::uint8_t status, json payload);
+	public:
+		explicit RemoteDatabase(const std::string& socketPath);
+		RemoteDatabase(const RemoteDatabase&) = delete;
+		RemoteDatabase& operator=(const RemoteDatabase&) = delete;
+		~RemoteDatabase();
+
+		std::uint32_t send(Command command, const json& arguments);
+		// A result streamed in parts comes back as the array of its parts.
+		json receive(std::uint32_t requestId);
+		json call(Command command, const json& arguments);
+		// Runs the requests in one round trip; throws the first error after all of them ran.
+		std::vector<json> batch(const std::vector<std::pair<Command, json>>& requests);
+
+		void createTable(const std::string& tableName, const json& keysJson, const json& options = json::object());
+		void removeTable(const std::string& tableName);
+		void addKey(const std::string& tableName, const json& keysJson, const json& includedColumns = json::array());
+		void removeKey(const std::string& tableName, const std::string& keyName);
+		void reorganizeTable(const std::string& tableName);
+		void checkpoint(const std::string& directory, Offset bytesPerSecond);
+
+		json getRowByKey(const std::string& tableName, const json& keyJson, const json& projection = json::array());
+		json getRowInSortedTable(const std::string& tableName, const std::string& keyName, bool isReversed);
+		json getNextRow(const std::string& tableName);
+		json getPrevRow(const std::string& tableName);
+		CursorId openCursor(const std::string& tableName, const std::string& keyName);
+		std::vector<CursorId> splitScan(const std::string& tableName, const std::string& keyName, unsigned parts);
+		json fetchRow(CursorId cursorId);
+		void closeCursor(CursorId cursorId);
+		json getPage(const std::string& tableName, const std::string& keyName, unsigned pageSize,
+			const std::string& continuationToken);
+		json find(const std::string& tableName, const json& predicate, const json& projection, unsigned limit);
+		json find(const std::string& tableName, const json& predicate, const json& projection, unsigned limit,
+			const std::string& continuationToken);
+
+		Offset count(const std::string& tableName, const std::string& keyName);
+		Offset count(const std::string& tableName, const std::string& keyName, const json& from, const json& to);
+		json minKey(const std::string& tableName, const std::string& keyName);
+		json maxKey(const std::string& tableName, const std::string& keyName);
+		// Batches arrive as the server makes them. Once onBatch returns false the
+		// server is told to stop, and the batches it sent before that are read
+		// and dropped.
+		void join(const std::string& leftTableName, const std::string& rightTableName,
+			const std::string& rightKeyName, unsigned batchSize, std::function<bool(json)> onBatch);
+		json sum(const std::string& tableName, const std::string& column, const json& predicate);
+		json avg(const std::string& tableName, const std::string& column, const json& predicate);
+
+		void appendRow(const std::string& tableName, const json& keys, const json& value);
+		void removeRow(const std::string& tableName);
+		void updateRow(const std::string& tableName, const json& fields);
+		void upsert(const std::string& tableName, const json& keys, const json& value);
+
+		json getStats();
+		json getLockProfile();
+		json readChanges(std::uint64_t afterSequence, unsigned limit);
+	};
+}
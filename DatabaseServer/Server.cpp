@@ -0,0 +1,633 @@
+#include "Server.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace DatabaseLib
+{
+	namespace
+	{
+		const int MAX_EVENTS = 64;
+		const size_t READ_CHUNK_SIZE = 1 << 16;
+		// A streaming job pauses once this much of its output waits to be sent.
+		const size_t MAX_UNSENT_SIZE = 4 << 20;
+
+		std::system_error getSystemError(const std::string& operation)
+		{
+			return std::system_error(errno, std::generic_category(), operation);
+		}
+
+		const json& getArgument(const json& arguments, size_t index)
+		{
+			static const json missing;
+			return index < arguments.size() ? arguments[index] : missing;
+		}
+	}
+
+	Server::Server(Database& database, std::string socketPath, unsigned workerCount)
+		: database(database), socketPath(std::move(socketPath))
+	{
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		if (this->socketPath.size() >= sizeof(address.sun_path))
+		{
+			throw std::invalid_argument("Socket path is too long: " + this->socketPath);
+		}
+		std::strcpy(address.sun_path, this->socketPath.c_str());
+
+		listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listener < 0)
+		{
+			throw getSystemError("socket");
+		}
+		::unlink(this->socketPath.c_str());
+		if (::bind(listener, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(listener, SOMAXCONN) < 0)
+		{
+			int error = errno;
+			::close(listener);
+			throw std::system_error(error, std::generic_category(), "bind " + this->socketPath);
+		}
+
+		poller = ::epoll_create1(EPOLL_CLOEXEC);
+		wakeup = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (poller < 0 || wakeup < 0)
+		{
+			throw getSystemError("epoll");
+		}
+		epoll_event event{};
+		event.events = EPOLLIN;
+		event.data.fd = listener;
+		::epoll_ctl(poller, EPOLL_CTL_ADD, listener, &event);
+		event.data.fd = wakeup;
+		::epoll_ctl(poller, EPOLL_CTL_ADD, wakeup, &event);
+
+		for (unsigned i = 0; i < std::max(workerCount, 1u); i++)
+		{
+			workers.emplace_back(&Server::runWorker, this);
+		}
+	}
+
+	Server::~Server()
+	{
+		while (!clients.empty())
+		{
+			closeClient(*clients.begin()->second);
+		}
+		{
+			std::lock_guard lock(workMutex);
+			isWorkStopping = true;
+		}
+		workAvailable.notify_all();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+		for (int descriptor : { listener, poller, wakeup })
+		{
+			if (descriptor >= 0)
+			{
+				::close(descriptor);
+			}
+		}
+		::unlink(socketPath.c_str());
+	}
+
+	void Server::run()
+	{
+		epoll_event events[MAX_EVENTS];
+		while (!isStopping)
+		{
+			int ready = ::epoll_wait(poller, events, MAX_EVENTS, -1);
+			if (ready < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				throw getSystemError("epoll_wait");
+			}
+			for (int i = 0; i < ready; i++)
+			{
+				int descriptor = events[i].data.fd;
+				if (descriptor == listener)
+				{
+					acceptClients();
+					continue;
+				}
+				if (descriptor == wakeup)
+				{
+					takeCompletions();
+					continue;
+				}
+				auto client = clients.find(descriptor);
+				if (client == clients.end())
+				{
+					continue;
+				}
+				bool isOpen = true;
+				if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				{
+					isOpen = readRequests(*client->second);
+				}
+				if (isOpen)
+				{
+					isOpen = writeResponses(*client->second);
+				}
+				if (!isOpen)
+				{
+					closeClient(*client->second);
+				}
+			}
+		}
+	}
+
+	void Server::stop()
+	{
+		isStopping = true;
+		std::uint64_t signal = 1;
+		ssize_t written = ::write(wakeup, &signal, sizeof(signal));
+		(void)written;
+	}
+
+	void Server::acceptClients()
+	{
+		while (true)
+		{
+			int descriptor = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (descriptor < 0)
+			{
+				return;
+			}
+			auto client = std::make_unique<Client>(descriptor, nextSerial++);
+			// Requests wait until a worker has connected the client.
+			client->job = std::make_shared<Job>(descriptor, client->serial, std::vector<Frame>(), Connection());
+			client->job->isConnecting = true;
+			queueJob(client->job);
+			epoll_event event{};
+			event.events = EPOLLIN;
+			event.data.fd = descriptor;
+			::epoll_ctl(poller, EPOLL_CTL_ADD, descriptor, &event);
+			clients[descriptor] = std::move(client);
+		}
+	}
+
+	bool Server::readRequests(Client& client)
+	{
+		bool isOpen = true;
+		while (true)
+		{
+			size_t size = client.input.size();
+			client.input.resize(size + READ_CHUNK_SIZE);
+			ssize_t received = ::recv(client.socket, &client.input[size], READ_CHUNK_SIZE, 0);
+			client.input.resize(size + (received > 0 ? (size_t)received : 0));
+			if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			{
+				isOpen = false;
+				break;
+			}
+			if (received < 0 && errno != EINTR)
+			{
+				break;
+			}
+		}
+
+		size_t position = 0;
+		try
+		{
+			Frame frame;
+			while (Protocol::readFrame(client.input, position, frame))
+			{
+				if ((Command)frame.code == Command::CANCEL)
+				{
+					cancelRequest(client, frame);
+					continue;
+				}
+				client.pending.push_back(std::move(frame));
+			}
+		}
+		catch (const std::exception&)
+		{
+			return false;
+		}
+		client.input.erase(0, position);
+		runPending(client);
+		return isOpen;
+	}
+
+	bool Server::writeResponses(Client& client)
+	{
+		size_t previouslySent = client.outputSent;
+		while (client.outputSent < client.output.size())
+		{
+			ssize_t sent = ::send(client.socket, client.output.data() + client.outputSent,
+				client.output.size() - client.outputSent, MSG_NOSIGNAL);
+			if (sent < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+				{
+					return false;
+				}
+				break;
+			}
+			client.outputSent += (size_t)sent;
+		}
+		if (client.job != nullptr && client.outputSent > previouslySent)
+		{
+			std::lock_guard lock(client.job->mutex);
+			client.job->unsentSize -= std::min(client.job->unsentSize, client.outputSent - previouslySent);
+			client.job->drained.notify_all();
+		}
+
+		bool isWriting = client.outputSent < client.output.size();
+		if (!isWriting)
+		{
+			client.output.clear();
+			client.outputSent = 0;
+		}
+		if (isWriting != client.isWriting)
+		{
+			epoll_event event{};
+			event.events = isWriting ? (std::uint32_t)(EPOLLIN | EPOLLOUT) : (std::uint32_t)EPOLLIN;
+			event.data.fd = client.socket;
+			::epoll_ctl(poller, EPOLL_CTL_MOD, client.socket, &event);
+			client.isWriting = isWriting;
+		}
+		return true;
+	}
+
+	void Server::closeClient(Client& client)
+	{
+		int descriptor = client.socket;
+		bool isRunning = false;
+		Connection connection = client.connection;
+		if (client.job != nullptr)
+		{
+			// A running job drops the connection once it is done with it.
+			std::lock_guard lock(client.job->mutex);
+			client.job->isCancelled = true;
+			client.job->drained.notify_all();
+			isRunning = !client.job->isFinished;
+			connection = client.job->connection;
+		}
+		if (!isRunning)
+		{
+			auto job = std::make_shared<Job>(descriptor, client.serial, std::vector<Frame>(), connection);
+			job->isCancelled = true;
+			queueJob(job);
+		}
+		::epoll_ctl(poller, EPOLL_CTL_DEL, descriptor, nullptr);
+		::close(descriptor);
+		clients.erase(descriptor);
+	}
+
+	void Server::runPending(Client& client)
+	{
+		if (client.job != nullptr || client.pending.empty())
+		{
+			return;
+		}
+		std::vector<Frame> frames(std::make_move_iterator(client.pending.begin()),
+			std::make_move_iterator(client.pending.end()));
+		client.pending.clear();
+		client.job = std::make_shared<Job>(client.socket, client.serial, std::move(frames), client.connection);
+		client.job->cancelledRequests.swap(client.cancelledRequests);
+		queueJob(client.job);
+	}
+
+	void Server::cancelRequest(Client& client, const Frame& frame)
+	{
+		const json& argument = getArgument(frame.payload, 0);
+		if (!argument.is_number_unsigned())
+		{
+			return;
+		}
+		auto requestId = argument.get<std::uint32_t>();
+		bool isPending = std::any_of(client.pending.begin(), client.pending.end(),
+			[&](const Frame& pending) { return pending.requestId == requestId; });
+		if (isPending || client.job == nullptr)
+		{
+			client.cancelledRequests.push_back(requestId);
+			return;
+		}
+		std::lock_guard lock(client.job->mutex);
+		client.job->cancelledRequests.push_back(requestId);
+		client.job->drained.notify_all();
+	}
+
+	void Server::queueJob(std::shared_ptr<Job> job)
+	{
+		{
+			std::lock_guard lock(workMutex);
+			jobs.push_back(std::move(job));
+		}
+		workAvailable.notify_one();
+	}
+
+	void Server::answer(std::string& output, const Frame& frame, Connection connection, Job* job)
+	{
+		try
+		{
+			json result = execute((Command)frame.code, frame.payload, connection, job);
+			Protocol::appendFrame(output, frame.requestId, Protocol::STATUS_OK, result);
+		}
+		catch (const DatabaseException& ex)
+		{
+			Protocol::appendFrame(output, frame.requestId, (std::uint8_t)ex.getErrorNumber(), ex.what());
+		}
+		catch (const std::exception& ex)
+		{
+			Protocol::appendFrame(output, frame.requestId, Protocol::STATUS_FAILED, ex.what());
+		}
+	}
+
+	void Server::takeCompletions()
+	{
+		std::uint64_t signals = 0;
+		ssize_t received = ::read(wakeup, &signals, sizeof(signals));
+		(void)received;
+		std::vector<Completion> taken;
+		{
+			std::lock_guard lock(workMutex);
+			taken.swap(completions);
+		}
+
+		for (auto& completion : taken)
+		{
+			auto client = clients.find(completion.socket);
+			if (client == clients.end() || client->second->serial != completion.serial)
+			{
+				continue;
+			}
+			client->second->output.append(completion.output);
+			if (completion.isFinished)
+			{
+				client->second->connection = completion.connection;
+				client->second->job = nullptr;
+				runPending(*client->second);
+			}
+			if (!writeResponses(*client->second))
+			{
+				closeClient(*client->second);
+			}
+		}
+	}
+
+	void Server::runWorker()
+	{
+		while (true)
+		{
+			std::shared_ptr<Job> job;
+			{
+				std::unique_lock lock(workMutex);
+				workAvailable.wait(lock, [this]() { return isWorkStopping || !jobs.empty(); });
+				if (jobs.empty())
+				{
+					return;
+				}
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+
+			if (job->isConnecting)
+			{
+				job->connection = database.connect();
+			}
+			std::string output;
+			for (auto& frame : job->frames)
+			{
+				{
+					std::lock_guard lock(job->mutex);
+					if (job->isCancelled)
+					{
+						break;
+					}
+					job->requestId = frame.requestId;
+				}
+				// Answers ready before a long command are not held back by it.
+				if (!output.empty() && isLong((Command)frame.code, frame.payload))
+				{
+					post(*job, std::move(output), false);
+					output.clear();
+				}
+				answer(output, frame, job->connection, job.get());
+			}
+
+			bool isCancelled = false;
+			{
+				std::lock_guard lock(job->mutex);
+				job->isFinished = true;
+				isCancelled = job->isCancelled;
+			}
+			if (isCancelled)
+			{
+				try
+				{
+					database.disconnect(job->connection);
+				}
+				catch (const DatabaseException&) {}
+				continue;
+			}
+			post(*job, std::move(output), true);
+		}
+	}
+
+	void Server::post(Job& job, std::string output, bool isFinished)
+	{
+		{
+			std::lock_guard lock(job.mutex);
+			job.unsentSize += output.size();
+		}
+		{
+			std::lock_guard lock(workMutex);
+			completions.push_back({ job.socket, job.serial, job.connection, std::move(output), isFinished });
+		}
+		std::uint64_t signal = 1;
+		ssize_t written = ::write(wakeup, &signal, sizeof(signal));
+		(void)written;
+	}
+
+	bool Server::isLong(Command command, const json& arguments)
+	{
+		switch (command)
+		{
+		case Command::ADD_KEY:
+		case Command::REORGANIZE_TABLE:
+		case Command::CHECKPOINT:
+		case Command::FIND:
+		case Command::JOIN:
+		case Command::SUM:
+		case Command::AVG:
+			return true;
+		case Command::BATCH:
+			return arguments.is_array() && std::any_of(arguments.begin(), arguments.end(), [](const json& request)
+			{
+				return request.is_array() && !request.empty() && request[0].is_number_unsigned()
+					&& isLong((Command)request[0].get<std::uint8_t>(), json());
+			});
+		default:
+			return false;
+		}
+	}
+
+	json Server::execute(Command command, const json& arguments, Connection connection, Job* job)
+	{
+		auto text = [&](size_t index) { return getArgument(arguments, index).get<std::string>(); };
+		auto number = [&](size_t index) { return getArgument(arguments, index).get<Offset>(); };
+		auto value = [&](size_t index, json fallback)
+		{
+			const json& argument = getArgument(arguments, index);
+			return argument.is_null() ? fallback : argument;
+		};
+
+		switch (command)
+		{
+		case Command::CREATE_TABLE:
+			database.createTable(text(0), arguments.at(1), value(2, json::object()), connection);
+			return json();
+		case Command::REMOVE_TABLE:
+			database.removeTable(text(0), connection);
+			return json();
+		case Command::ADD_KEY:
+			database.addKey(text(0), arguments.at(1), value(2, json::array()), connection);
+			return json();
+		case Command::REMOVE_KEY:
+			database.removeKey(text(0), text(1), connection);
+			return json();
+		case Command::REORGANIZE_TABLE:
+			database.reorganizeTable(text(0), connection);
+			return json();
+		case Command::CHECKPOINT:
+			database.checkpoint(text(0), number(1), connection);
+			return json();
+		case Command::GET_ROW_BY_KEY:
+			return database.getRowByKey(text(0), arguments.at(1), value(2, json::array()), connection);
+		case Command::GET_ROW_IN_SORTED_TABLE:
+			return database.getRowInSortedTable(text(0), text(1), value(2, false).get<bool>(), connection);
+		case Command::GET_NEXT_ROW:
+			return database.getNextRow(text(0), connection);
+		case Command::GET_PREV_ROW:
+			return database.getPrevRow(text(0), connection);
+		case Command::OPEN_CURSOR:
+			return database.openCursor(text(0), text(1), connection);
+		case Command::SPLIT_SCAN:
+			return database.splitScan(text(0), text(1), (unsigned)number(2), connection);
+		case Command::FETCH_ROW:
+			return database.fetchRow((CursorId)number(0), connection);
+		case Command::CLOSE_CURSOR:
+			database.closeCursor((CursorId)number(0), connection);
+			return json();
+		case Command::GET_PAGE:
+			return database.getPage(text(0), text(1), (unsigned)number(2), value(3, "").get<std::string>(),
+				connection);
+		case Command::FIND:
+			if (arguments.size() > 4)
+			{
+				return database.find(text(0), arguments.at(1), value(2, json::array()),
+					value(3, 0).get<unsigned>(), text(4), connection);
+			}
+			return database.find(text(0), arguments.at(1), value(2, json::array()),
+				value(3, 0).get<unsigned>(), connection);
+		case Command::COUNT:
+			if (arguments.size() > 2)
+			{
+				return database.count(text(0), text(1), arguments.at(2), getArgument(arguments, 3), connection);
+			}
+			return database.count(text(0), text(1), connection);
+		case Command::MIN_KEY:
+			return database.minKey(text(0), text(1), connection);
+		case Command::MAX_KEY:
+			return database.maxKey(text(0), text(1), connection);
+		case Command::JOIN:
+		{
+			// On a worker every batch is sent as it is made, until the client
+			// cancels the request or goes away; inside a BATCH they are collected
+			// into the result.
+			json batches = json::array();
+			auto isStopped = [&]()
+			{
+				return job->isCancelled || std::find(job->cancelledRequests.begin(), job->cancelledRequests.end(),
+					job->requestId) != job->cancelledRequests.end();
+			};
+			database.join(text(0), text(1), text(2), (unsigned)number(3), [&](json batch)
+			{
+				if (job == nullptr)
+				{
+					batches.push_back(std::move(batch));
+					return true;
+				}
+				{
+					std::lock_guard lock(job->mutex);
+					if (isStopped())
+					{
+						return false;
+					}
+				}
+				std::string output;
+				Protocol::appendFrame(output, job->requestId, Protocol::STATUS_MORE, batch);
+				post(*job, std::move(output), false);
+				std::unique_lock lock(job->mutex);
+				job->drained.wait(lock, [&]() { return isStopped() || job->unsentSize < MAX_UNSENT_SIZE; });
+				return !isStopped();
+			}, connection);
+			return job == nullptr ? batches : json();
+		}
+		case Command::SUM:
+			return database.sum(text(0), text(1), value(2, json::object()), connection);
+		case Command::AVG:
+			return database.avg(text(0), text(1), value(2, json::object()), connection);
+		case Command::APPEND_ROW:
+			database.appendRow(text(0), arguments.at(1), arguments.at(2), connection);
+			return json();
+		case Command::REMOVE_ROW:
+			database.removeRow(text(0), connection);
+			return json();
+		case Command::UPDATE_ROW:
+			database.updateRow(text(0), arguments.at(1), connection);
+			return json();
+		case Command::UPSERT:
+			database.upsert(text(0), arguments.at(1), arguments.at(2), connection);
+			return json();
+		case Command::GET_STATS:
+			return database.getStats();
+		case Command::GET_LOCK_PROFILE:
+			return database.getLockProfile();
+		case Command::READ_CHANGES:
+			return database.readChanges(number(0), (unsigned)number(1));
+		case Command::CANCEL:
+			// Handled as it is read; only reaches here inside a BATCH.
+			return json();
+		case Command::BATCH:
+		{
+			json results = json::array();
+			for (auto& request : arguments)
+			{
+				try
+				{
+					json result = execute((Command)request.at(0).get<std::uint8_t>(), request.at(1), connection, nullptr);
+					results.push_back(json::array({ Protocol::STATUS_OK, std::move(result) }));
+				}
+				catch (const DatabaseException& ex)
+				{
+					results.push_back(json::array({ (std::uint8_t)ex.getErrorNumber(), ex.what() }));
+				}
+				catch (const std::exception& ex)
+				{
+					results.push_back(json::array({ Protocol::STATUS_FAILED, ex.what() }));
+				}
+			}
+			return results;
+		}
+		}
+		throw std::invalid_argument("Unknown command: " + std::to_string((int)command));
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include "Database.h"
+#include "Protocol.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace DatabaseLib
+{
+	// Serves one Database to clients on a Unix domain socket. A single epoll
+	// thread reads and writes the sockets but never takes the database lock:
+	// every complete frame a client has sent goes to a worker as one job,
+	// which executes them in order and answers them with one write, so
+	// pipelined requests share the system calls. A client's later requests
+	// wait until its job finishes, and responses are handed back to the epoll
+	// thread through the wakeup eventfd. Each client socket holds its own
+	// Connection, opened and closed by a worker as well. A JOIN answers with
+	// one frame per batch and stops early on a CANCEL.
+	class Server
+	{
+	private:
+		// Requests of one client running on a worker. The worker waits while too
+		// much of its output is unsent and gives up once the client is gone.
+		struct Job
+		{
+			int socket;
+			std::uint64_t serial;
+			std::vector<Frame> frames;
+			Connection connection;
+			bool isConnecting = false;
+			// The request the worker is running.
+			std::uint32_t requestId = 0;
+			std::mutex mutex;
+			std::condition_variable drained;
+			size_t unsentSize = 0;
+			std::vector<std::uint32_t> cancelledRequests;
+			bool isCancelled = false;
+			bool isFinished = false;
+
+			Job(int socket, std::uint64_t serial, std::vector<Frame> frames, Connection connection)
+				: socket(socket), serial(serial), frames(std::move(frames)), connection(connection) {}
+		};
+
+		struct Client
+		{
+			int socket;
+			// Tells a client from a later one given the same socket descriptor.
+			std::uint64_t serial;
+			Connection connection;
+			std::string input;
+			std::string output;
+			size_t outputSent = 0;
+			bool isWriting = false;
+			std::deque<Frame> pending;
+			std::vector<std::uint32_t> cancelledRequests;
+			std::shared_ptr<Job> job;
+
+			Client(int socket, std::uint64_t serial) : socket(socket), serial(serial) {}
+		};
+
+		struct Completion
+		{
+			int socket;
+			std::uint64_t serial;
+			Connection connection;
+			std::string output;
+			bool isFinished;
+		};
+
+		Database& database;
+		std::string socketPath;
+		int listener = -1;
+		int poller = -1;
+		int wakeup = -1;
+		std::atomic<bool> isStopping{ false };
+		std::unordered_map<int, std::unique_ptr<Client>> clients;
+		std::uint64_t nextSerial = 1;
+
+		std::mutex workMutex;
+		std::condition_variable workAvailable;
+		std::deque<std::shared_ptr<Job>> jobs;
+		std::vector<Completion> completions;
+		bool isWorkStopping = false;
+		std::vector<std::thread> workers;
+
+		void acceptClients();
+		bool readRequests(Client& client);
+		bool writeResponses(Client& client);
+		void closeClient(Client& client);
+		void runPending(Client& client);
+		void cancelRequest(Client& client, const Frame& frame);
+		void queueJob(std::shared_ptr<Job> job);
+		void answer(std::string& output, const Frame& frame, Connection connection, Job* job);
+		void takeCompletions();
+		void runWorker();
+		void post(Job& job, std::string output, bool isFinished);
+		json execute(Command command, const json& arguments, Connection connection, Job* job);
+		static bool isLong(Command command, const json& arguments);
+	public:
+		Server(Database& database, std::string socketPath, unsigned workerCount = 4);
+		Server(const Server&) = delete;
+		Server& operator=(const Server&) = delete;
+		~Server();
+
+		// Blocks until stop is called; stop may be called from any thread or
+		// from a signal handler.
+		void run();
+		void stop();
+	};
+}
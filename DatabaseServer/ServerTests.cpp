@@ -0,0 +1,153 @@
+// Runs a Server on a temporary directory and drives it through RemoteDatabase
+// clients. Exits with the number of failed checks.
+
+#include "RemoteDatabase.h"
+#include "Server.h"
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+
+using DatabaseLib::json;
+
+namespace
+{
+	int failures = 0;
+
+	void check(bool condition, const char* description)
+	{
+		if (!condition)
+		{
+			std::cerr << "FAILED: " << description << std::endl;
+			failures++;
+		}
+	}
+
+	DatabaseLib::ErrorCode getErrorCode(std::function<void()> action)
+	{
+		try
+		{
+			action();
+		}
+		catch (const DatabaseLib::DatabaseException& ex)
+		{
+			return ex.getErrorNumber();
+		}
+		return (DatabaseLib::ErrorCode)0;
+	}
+}
+
+int main()
+{
+	std::filesystem::path workingDirectory = std::filesystem::current_path();
+	std::filesystem::path directory = std::filesystem::temp_directory_path()
+		/ ("database_server_tests_" + std::to_string(::getpid()));
+	std::filesystem::create_directories(directory);
+	std::filesystem::current_path(directory);
+
+	{
+		DatabaseLib::Database database;
+		database.enableChangeStream("changes.log");
+		DatabaseLib::Server server(database, "test.sock");
+		std::thread serving([&]() { server.run(); });
+
+		{
+			DatabaseLib::RemoteDatabase first("test.sock");
+			DatabaseLib::RemoteDatabase second("test.sock");
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			first.createTable("clients", keys);
+
+			std::vector<std::uint32_t> requests;
+			requests.push_back(first.send(DatabaseLib::Command::APPEND_ROW, json::array({ "clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} } })));
+			requests.push_back(first.send(DatabaseLib::Command::APPEND_ROW, json::array({ "clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} } })));
+			requests.push_back(first.send(DatabaseLib::Command::APPEND_ROW, json::array({ "clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} } })));
+			requests.push_back(first.send(DatabaseLib::Command::APPEND_ROW, json::array({ "clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} } })));
+			for (auto request = requests.rbegin(); request != requests.rend(); request++)
+			{
+				first.receive(*request);
+			}
+
+			json john = second.getRowByKey("clients", { {"emailKey", "jh@mail.com"} });
+			check(john["message"] == "hello, John", "a second client reads rows appended by the first");
+			check(second.count("clients", "idNameKey") == 4, "pipelined appends all ran");
+
+			first.getRowInSortedTable("clients", "emailKey", false);
+			second.getRowInSortedTable("clients", "emailKey", true);
+			check(first.getNextRow("clients")["message"] == "bye, John", "clients keep their own cursors");
+			check(second.getPrevRow("clients")["message"] == "hello, John", "clients keep their own cursors");
+
+			std::vector<json> found = second.batch({
+				{ DatabaseLib::Command::GET_ROW_BY_KEY, json::array({ "clients", { {"emailKey", "mary@mail.com"} } }) },
+				{ DatabaseLib::Command::COUNT, json::array({ "clients", "emailKey" }) } });
+			check(found.size() == 2 && found[0]["message"] == "hello, Mary" && found[1] == 4,
+				"a batch returns every result in order");
+			check(getErrorCode([&]()
+			{
+				second.batch({
+					{ DatabaseLib::Command::GET_ROW_BY_KEY, json::array({ "clients", { {"emailKey", "bob@mail.com"} } }) },
+					{ DatabaseLib::Command::UPSERT, json::array({ "clients", { {"emailKey", {{"email", "bob@mail.com"}}}, { "idNameKey", {{"id", 4}, {"name", "Bob"}} } }, { {"message", "hello, Bob"} } }) } });
+			}) == DatabaseLib::ErrorCode::KEY_VALUE_NOT_FOUND, "a failed batch request reports its error code");
+			check(first.count("clients", "emailKey") == 5, "batch requests after a failed one still run");
+			check(getErrorCode([&]() { first.removeTable("missing"); }) == DatabaseLib::ErrorCode::TABLE_NOT_FOUND,
+				"errors keep their error code");
+
+			json page = first.getPage("clients", "emailKey", 2, "");
+			json rest = first.getPage("clients", "emailKey", 10, page["continuationToken"]);
+			check(page["rows"].size() == 2 && rest["rows"].size() == 3, "pages cover the table");
+			json matches = first.find("clients", { {"message", {{"$contains", "hello"}}} }, json::array(), 2, "");
+			json moreMatches = first.find("clients", { {"message", {{"$contains", "hello"}}} }, json::array(), 10,
+				matches["continuationToken"]);
+			check(matches["rows"].size() == 2 && moreMatches["rows"].size() == 2, "find resumes from its continuation token");
+
+			auto started = std::chrono::steady_clock::now();
+			std::uint32_t checkpoint = first.send(DatabaseLib::Command::CHECKPOINT, json::array({ "checkpoint", 1000 }));
+			std::uint32_t afterCheckpoint = first.send(DatabaseLib::Command::COUNT, json::array({ "clients", "emailKey" }));
+			second.count("clients", "emailKey");
+			auto counted = std::chrono::steady_clock::now() - started;
+			first.receive(checkpoint);
+			auto checkpointed = std::chrono::steady_clock::now() - started;
+			check(counted * 4 < checkpointed, "a throttled checkpoint does not hold up other clients");
+			check(first.receive(afterCheckpoint) == 5, "requests after a long one still run in order");
+
+			first.createTable("orders", { {"orderKey", {"orderId"}} });
+			first.appendRow("orders", { {"orderKey", {{"orderId", 1}}} }, { {"email", "jh@mail.com"}, {"item", "book"} });
+			first.appendRow("orders", { {"orderKey", {{"orderId", 2}}} }, { {"email", "alex@mail.com"}, {"item", "pen"} });
+			first.appendRow("orders", { {"orderKey", {{"orderId", 3}}} }, { {"email", "jh@mail.com"}, {"item", "lamp"} });
+			unsigned batches = 0;
+			first.join("orders", "clients", "emailKey", 1, [&](json batch) { batches += (unsigned)batch.size(); return true; });
+			unsigned stoppedBatches = 0;
+			first.join("orders", "clients", "emailKey", 1, [&](json) { stoppedBatches++; return false; });
+			check(batches == 3, "join batches are streamed");
+			check(stoppedBatches == 1 && first.count("clients", "emailKey") == 5, "a join stopped early leaves the client usable");
+			std::uint32_t cancelledJoin = first.send(DatabaseLib::Command::JOIN, json::array({ "orders", "clients", "emailKey", 1 }));
+			first.send(DatabaseLib::Command::CANCEL, json::array({ cancelledJoin }));
+			check(first.receive(cancelledJoin).is_null(), "a join cancelled before it starts sends no batches");
+			first.removeTable("orders");
+
+			std::filesystem::create_directories("replica");
+			DatabaseLib::Database follower(std::make_shared<DatabaseLib::FileStorage>("replica"));
+			DatabaseLib::Connection connection = follower.connect();
+			follower.applyChanges(second.readChanges(follower.getAppliedSequence(), 3), connection);
+			follower.applyChanges(second.readChanges(follower.getAppliedSequence(), 100), connection);
+			check(follower.count("clients", "emailKey", connection) == 5, "a follower applies changes read from the server");
+			follower.disconnect(connection);
+
+			first.removeTable("clients");
+		}
+
+		check(getErrorCode([]() { DatabaseLib::RemoteDatabase missing("missing.sock"); })
+			== DatabaseLib::ErrorCode::NO_CONNECTION, "connecting to a missing socket fails");
+
+		server.stop();
+		serving.join();
+	}
+
+	std::filesystem::current_path(workingDirectory);
+	std::filesystem::remove_all(directory);
+	if (failures == 0)
+	{
+		std::cerr << "All checks passed" << std::endl;
+	}
+	return failures;
+}
@@ -0,0 +1,102 @@
+// Serves a data directory to other processes over a Unix domain socket.
+//
+//   DatabaseServer [--dir .] [--socket database.sock] [--changes changes.log] [--workers 4]
+//
+// The server takes an exclusive lock on the directory, so a second server
+// fails to start instead of corrupting the first one's index files. Indexes
+// of every table are loaded at startup. With --changes, every change is
+// appended to that file in the data directory, where followers can tail it
+// or read it through the READ_CHANGES command. --workers sets the number of
+// threads running the clients' commands. SIGINT and SIGTERM stop the
+// server.
+
+#include "Server.h"
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+namespace
+{
+	const char* LOCK_FILE = "database.lock";
+	DatabaseLib::Server* runningServer = nullptr;
+
+	void onSignal(int)
+	{
+		if (runningServer != nullptr)
+		{
+			runningServer->stop();
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string directory = ".";
+	std::string socketPath = "database.sock";
+	std::string changesFile;
+	unsigned workerCount = 4;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		std::string name = argv[i];
+		if (name == "--dir")
+		{
+			directory = argv[i + 1];
+		}
+		else if (name == "--socket")
+		{
+			socketPath = argv[i + 1];
+		}
+		else if (name == "--changes")
+		{
+			changesFile = argv[i + 1];
+		}
+		else if (name == "--workers")
+		{
+			workerCount = (unsigned)std::strtoul(argv[i + 1], nullptr, 10);
+		}
+		else
+		{
+			std::cerr << "Unknown option: " << name << std::endl;
+			return 2;
+		}
+	}
+
+	try
+	{
+		socketPath = std::filesystem::absolute(socketPath).string();
+		std::filesystem::create_directories(directory);
+		std::filesystem::current_path(directory);
+
+		int lock = ::open(LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (lock < 0 || ::flock(lock, LOCK_EX | LOCK_NB) < 0)
+		{
+			std::cerr << "Data directory " << directory << " is in use: " << std::strerror(errno) << std::endl;
+			return 1;
+		}
+
+		DatabaseLib::Database database(true);
+		if (!changesFile.empty())
+		{
+			database.enableChangeStream(changesFile);
+		}
+		DatabaseLib::Server server(database, socketPath, workerCount);
+		runningServer = &server;
+		std::signal(SIGINT, onSignal);
+		std::signal(SIGTERM, onSignal);
+		std::cerr << "Serving " << directory << " on " << socketPath << std::endl;
+		server.run();
+		runningServer = nullptr;
+	}
+	catch (const std::exception& ex)
+	{
+		std::cerr << "Server failed: " << ex.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
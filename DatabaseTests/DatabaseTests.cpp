@@ -1,10 +1,33 @@
 #include "pch.h"
 #include "CppUnitTest.h"
 #include "Database.h"
+#include "TypedTable.h"
 #include <fstream>
+#include <algorithm>
+#include <filesystem>
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
+struct Client
+{
+	int id = 0;
+	std::string name;
+	std::string email;
+	std::string message;
+};
+
+template <>
+struct DatabaseLib::RowTraits<Client>
+{
+	static constexpr auto columns = std::make_tuple(DatabaseLib::column("id", &Client::id),
+		DatabaseLib::column("name", &Client::name), DatabaseLib::column("email", &Client::email),
+		DatabaseLib::column("message", &Client::message));
+};
+
+struct EmailKey : DatabaseLib::TypedKey<Client, 2> { static constexpr const char* name = "emailKey"; };
+struct IdNameKey : DatabaseLib::TypedKey<Client, 0, 1> { static constexpr const char* name = "idNameKey"; };
+struct NameIdKey : DatabaseLib::TypedKey<Client, 1, 0> { static constexpr const char* name = "nameIdKey"; };
+
 namespace DatabaseTests
 {
 	using json = nlohmann::json;
@@ -498,6 +521,31 @@ namespace DatabaseTests
 			database.disconnect(connection);
 		}
 
+		TEST_METHOD(RemoveRowWithSharedKeyValue)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jj@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hi, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+
+			database.getRowInSortedTable("clients", "idNameKey", false, connection);
+
+			database.removeRow("clients", connection);
+
+			json nextRow = database.getNextRow("clients", connection);
+			json prevRow = database.getPrevRow("clients", connection);
+
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			Assert::AreEqual(std::string("hi, John"), nextRow["message"].get<std::string>());
+			Assert::AreEqual(std::string("bye, John"), prevRow["message"].get<std::string>());
+		}
+
 		TEST_METHOD(RemoveFirstRowInTable)
 		{
 			DatabaseLib::Database database;
@@ -621,6 +669,1109 @@ namespace DatabaseTests
 			database.disconnect(connection);
 		}
 
+		TEST_METHOD(ReorganizeClusteredTable)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, { {"clusterKey", "emailKey"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+
+			database.reorganizeTable("clients", connection);
+
+			std::ifstream tableFile("clients.txt");
+			std::string line;
+			std::vector<std::string> emails;
+			while (std::getline(tableFile, line))
+			{
+				emails.push_back(json::parse(line)["email"]);
+			}
+			tableFile.close();
+
+			json keyValue;
+			keyValue["idNameKey"] = { {"id", 2}, {"name", "Mary"} };
+			json row = database.getRowByKey("clients", keyValue, connection);
+
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			std::vector<std::string> expectedEmails = { "alex@mail.com", "j23@mail.com", "jh@mail.com", "mary@mail.com" };
+			Assert::IsTrue(expectedEmails == emails);
+			Assert::AreEqual(std::string("hello, Mary"), row["message"].get<std::string>());
+		}
+
+		TEST_METHOD(LogEngineTable)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, { {"engine", "log"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+
+			json keyValue;
+			keyValue["emailKey"] = "mary@mail.com";
+			database.getRowByKey("clients", keyValue, connection);
+			database.removeRow("clients", connection);
+
+			DatabaseLib::Database reopened;
+			DatabaseLib::Connection reopenedConnection = reopened.connect();
+			reopened.addKey("clients", { {"messageKey", {"message"}} }, reopenedConnection);
+
+			bool exceptionIsThrown = false;
+			try
+			{
+				json messageKeyValue;
+				messageKeyValue["messageKey"] = { {"message", "hello, Mary"} };
+				reopened.getRowByKey("clients", messageKeyValue, reopenedConnection);
+			}
+			catch (DatabaseLib::DatabaseException ex)
+			{
+				Assert::IsTrue(DatabaseLib::ErrorCode::KEY_VALUE_NOT_FOUND == ex.getErrorNumber());
+				exceptionIsThrown = true;
+			}
+			Assert::IsTrue(exceptionIsThrown);
+
+			json row = reopened.getRowInSortedTable("clients", "emailKey", true, reopenedConnection);
+
+			reopened.removeTable("clients", reopenedConnection);
+			reopened.disconnect(reopenedConnection);
+			database.disconnect(connection);
+
+			std::string expectedMessage = "hello, John";
+			Assert::AreEqual(expectedMessage, row["message"].get<std::string>());
+		}
+
+		TEST_METHOD(CompressedTable)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, { {"compressed", true} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+
+			std::ifstream tableFile("clients.txt");
+			std::string firstLine;
+			std::getline(tableFile, firstLine);
+			tableFile.close();
+			Assert::AreEqual(std::string("[0,\"jh@mail.com\",1,1,2,\"hello, John\",3,\"John\"]"), firstLine);
+
+			DatabaseLib::Database reopened;
+			DatabaseLib::Connection reopenedConnection = reopened.connect();
+			json keyValue;
+			keyValue["idNameKey"] = { {"id", 1}, {"name", "John"} };
+			reopened.getRowByKey("clients", keyValue, reopenedConnection);
+			json nextRow = reopened.getNextRow("clients", reopenedConnection);
+
+			reopened.removeTable("clients", reopenedConnection);
+			reopened.disconnect(reopenedConnection);
+			database.disconnect(connection);
+
+			Assert::AreEqual(std::string("bye, John"), nextRow["message"].get<std::string>());
+			Assert::AreEqual(std::string("j23@mail.com"), nextRow["email"].get<std::string>());
+		}
+
+		TEST_METHOD(PartitionedTable)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			json options = { {"partitioning", { {"column", "id"}, {"type", "range"}, {"bounds", {2}} }} };
+			database.createTable("clients", keys, options, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+
+			std::ifstream secondPartition("clients.1.txt");
+			std::string line;
+			std::getline(secondPartition, line);
+			secondPartition.close();
+			Assert::AreEqual(std::string("mary@mail.com"), json::parse(line)["email"].get<std::string>());
+
+			database.getRowInSortedTable("clients", "emailKey", false, connection);
+			database.removeRow("clients", connection);
+			database.addKey("clients", { {"nameKey", {"name"}} }, connection);
+
+			json row = database.getRowInSortedTable("clients", "nameKey", true, connection);
+			json nextRow = database.getRowInSortedTable("clients", "emailKey", false, connection);
+
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			Assert::AreEqual(std::string("hello, Mary"), row["message"].get<std::string>());
+			Assert::AreEqual(std::string("bye, John"), nextRow["message"].get<std::string>());
+		}
+
+		TEST_METHOD(FindByPredicate)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+
+			json byIndex = database.find("clients", { {"id", {{"$gte", 2}}} }, { "message" }, 0, connection);
+			json byPrefix = database.find("clients", { {"message", {{"$contains", "hello"}}}, {"id", 1} }, { "email" }, 0, connection);
+			json byScan = database.find("clients", { {"message", {{"$contains", "Alex"}}} }, { "id" }, 0, connection);
+			json limited = database.find("clients", json::object(), json::array(), 3, connection);
+			std::vector<std::string> pagedByIndex, pagedByScan;
+			for (json page = { {"continuationToken", ""} }; pagedByIndex.empty() || page["continuationToken"] != ""; )
+			{
+				page = database.find("clients", { {"id", {{"$gte", 1}}} }, { "email" }, 1, page["continuationToken"], connection);
+				for (auto& row : page["rows"])
+				{
+					pagedByIndex.push_back(row["email"]);
+				}
+			}
+			for (json page = { {"continuationToken", ""} }; pagedByScan.empty() || page["continuationToken"] != ""; )
+			{
+				page = database.find("clients", { {"message", {{"$contains", "hello"}}} }, { "email" }, 2, page["continuationToken"], connection);
+				for (auto& row : page["rows"])
+				{
+					pagedByScan.push_back(row["email"]);
+				}
+			}
+
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			json expectedByIndex = { {{"message", "hello, Mary"}}, {{"message", "hello, Alex"}} };
+			json expectedByPrefix = { {{"email", "jh@mail.com"}} };
+			json expectedByScan = { {{"id", 3}} };
+			Assert::AreEqual(expectedByIndex.dump(), byIndex.dump());
+			Assert::AreEqual(expectedByPrefix.dump(), byPrefix.dump());
+			Assert::AreEqual(expectedByScan.dump(), byScan.dump());
+			Assert::AreEqual((size_t)3, limited.size());
+			Assert::IsTrue(std::vector<std::string>({ "jh@mail.com", "j23@mail.com", "mary@mail.com", "alex@mail.com" }) == pagedByIndex);
+			Assert::IsTrue(std::vector<std::string>({ "jh@mail.com", "mary@mail.com", "alex@mail.com" }) == pagedByScan);
+		}
+
+		TEST_METHOD(AggregateRows)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+
+			DatabaseLib::Offset total = database.count("clients", "emailKey", connection);
+			DatabaseLib::Offset inRange = database.count("clients", "idNameKey", { {"id", 1} }, { {"id", 2} }, connection);
+			json minEmail = database.minKey("clients", "emailKey", connection);
+			json maxIdName = database.maxKey("clients", "idNameKey", connection);
+			json idSum = database.sum("clients", "id", json::object(), connection);
+			json greetedAvg = database.avg("clients", "id", { {"message", {{"$contains", "hello"}}} }, connection);
+
+			database.getRowInSortedTable("clients", "emailKey", false, connection);
+			database.removeRow("clients", connection);
+			DatabaseLib::Offset afterRemove = database.count("clients", "idNameKey", connection);
+
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			json expectedMinEmail = { {"email", "alex@mail.com"} };
+			json expectedMaxIdName = { {"id", 3}, {"name", "Alex"} };
+			Assert::AreEqual((DatabaseLib::Offset)4, total);
+			Assert::AreEqual((DatabaseLib::Offset)3, inRange);
+			Assert::AreEqual(expectedMinEmail.dump(), minEmail.dump());
+			Assert::AreEqual(expectedMaxIdName.dump(), maxIdName.dump());
+			Assert::AreEqual(7.0, idSum.get<double>());
+			Assert::AreEqual(2.0, greetedAvg.get<double>());
+			Assert::AreEqual((DatabaseLib::Offset)3, afterRemove);
+		}
+
+		TEST_METHOD(CoveringIndex)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			json options = { {"include", {{"emailKey", {"id", "message"}}}} };
+			database.createTable("clients", keys, options, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+			database.addKey("clients", { {"nameKey", {"name"}} }, { "message" }, connection);
+
+			database.getRowByKey("clients", { {"emailKey", "jh@mail.com"} }, connection);
+			database.removeRow("clients", connection);
+
+			// Covered reads must not touch the table file.
+			std::ofstream("clients.txt", std::ios::trunc);
+			json byEmail = database.getRowByKey("clients", { {"emailKey", "mary@mail.com"} }, { "id", "message" }, connection);
+			json byName = database.find("clients", { {"name", "John"} }, { "message" }, 0, connection);
+
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			json expectedByEmail = { {"id", 2}, {"message", "hello, Mary"} };
+			json expectedByName = { {{"message", "bye, John"}} };
+			Assert::AreEqual(expectedByEmail.dump(), byEmail.dump());
+			Assert::AreEqual(expectedByName.dump(), byName.dump());
+		}
+
+		TEST_METHOD(JoinTables)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+			database.createTable("orders", { {"orderKey", {"orderId"}} }, connection);
+			database.appendRow("orders", { {"orderKey", {{"orderId", 1}}} }, { {"email", "jh@mail.com"}, {"item", "book"} }, connection);
+			database.appendRow("orders", { {"orderKey", {{"orderId", 2}}} }, { {"email", "alex@mail.com"}, {"item", "pen"} }, connection);
+			database.appendRow("orders", { {"orderKey", {{"orderId", 3}}} }, { {"email", "jh@mail.com"}, {"item", "lamp"} }, connection);
+			database.appendRow("orders", { {"orderKey", {{"orderId", 4}}} }, { {"email", "nobody@mail.com"}, {"item", "cup"} }, connection);
+
+			database.getRowByKey("clients", { {"emailKey", "jh@mail.com"} }, connection);
+			std::vector<std::string> nestedLoop;
+			unsigned batches = 0;
+			database.join("orders", "clients", "emailKey", 1, [&](json batch)
+			{
+				batches++;
+				for (auto& row : batch)
+				{
+					nestedLoop.push_back(row[0]["item"].get<std::string>() + ":" + row[1]["message"].get<std::string>());
+				}
+				return true;
+			}, connection);
+			json nextRow = database.getNextRow("clients", connection);
+			bool isRewriteNoticed = false;
+			try
+			{
+				database.join("orders", "clients", "emailKey", 1, [&](json)
+				{
+					database.reorganizeTable("orders", connection);
+					return true;
+				}, connection);
+			}
+			catch (DatabaseLib::DatabaseException ex)
+			{
+				isRewriteNoticed = ex.getErrorNumber() == DatabaseLib::ErrorCode::TABLE_REWRITTEN;
+			}
+
+			database.addKey("orders", { {"emailKey", {"email"}} }, connection);
+			std::vector<std::string> merged;
+			database.join("orders", "clients", "emailKey", 100, [&](json batch)
+			{
+				for (auto& row : batch)
+				{
+					merged.push_back(row[0]["item"].get<std::string>() + ":" + row[1]["message"].get<std::string>());
+				}
+				return true;
+			}, connection);
+
+			database.removeTable("orders", connection);
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			std::vector<std::string> expected = { "book:hello, John", "pen:hello, Alex", "lamp:hello, John" };
+			Assert::IsTrue(expected == nestedLoop);
+			Assert::AreEqual(3u, batches);
+			Assert::IsTrue(isRewriteNoticed);
+			std::sort(expected.begin(), expected.end());
+			std::sort(merged.begin(), merged.end());
+			Assert::IsTrue(expected == merged);
+			Assert::AreEqual(std::string("mary@mail.com"), nextRow["email"].get<std::string>());
+		}
+
+		TEST_METHOD(CheckpointTables)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+
+			database.checkpoint("checkpoint", 1 << 20, connection);
+			database.getRowByKey("clients", { {"emailKey", "jh@mail.com"} }, connection);
+			database.removeRow("clients", connection);
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			std::filesystem::path workingDirectory = std::filesystem::current_path();
+			std::filesystem::current_path("checkpoint");
+			json row;
+			DatabaseLib::Offset rowCount;
+			{
+				DatabaseLib::Database restored;
+				connection = restored.connect();
+				row = restored.getRowByKey("clients", { {"emailKey", "jh@mail.com"} }, connection);
+				rowCount = restored.count("clients", "idNameKey", connection);
+				restored.disconnect(connection);
+			}
+			std::filesystem::current_path(workingDirectory);
+			std::filesystem::remove_all("checkpoint");
+
+			Assert::AreEqual(std::string("hello, John"), row["message"].get<std::string>());
+			Assert::AreEqual((DatabaseLib::Offset)4, rowCount);
+		}
+
+		TEST_METHOD(WarmUpIndexes)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, { {"engine", "log"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+			database.getRowByKey("clients", { {"emailKey", "j23@mail.com"} }, connection);
+			database.removeRow("clients", connection);
+
+			DatabaseLib::Database warmed(true);
+			DatabaseLib::Connection warmedConnection = warmed.connect();
+			json row = warmed.getRowInSortedTable("clients", "idNameKey", true, warmedConnection);
+			DatabaseLib::Offset rowCount = warmed.count("clients", "emailKey", warmedConnection);
+			warmed.disconnect(warmedConnection);
+
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			Assert::AreEqual(std::string("alex@mail.com"), row["email"].get<std::string>());
+			Assert::AreEqual((DatabaseLib::Offset)3, rowCount);
+		}
+
+		TEST_METHOD(OperationStats)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+			for (int i = 0; i < 10; ++i)
+			{
+				database.getRowByKey("clients", { {"emailKey", "mary@mail.com"} }, connection);
+			}
+
+			json stats = database.getStats();
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			json getRowByKey = stats["operations"]["getRowByKey"];
+			Assert::AreEqual(10, getRowByKey["count"].get<int>());
+			Assert::IsTrue(getRowByKey["p50Ns"].get<std::uint64_t>() <= getRowByKey["p99Ns"].get<std::uint64_t>());
+			Assert::IsTrue(getRowByKey["p99Ns"].get<std::uint64_t>() <= getRowByKey["maxNs"].get<std::uint64_t>());
+			Assert::AreEqual(4, stats["operations"]["appendRow"]["count"].get<int>());
+			Assert::IsTrue(stats["counters"]["bytesWritten"].get<std::uint64_t>() > 0);
+			Assert::IsTrue(stats["counters"]["indexCacheHits"].get<int>() >= 10);
+		}
+
+		TEST_METHOD(SlowOperationLog)
+		{
+			DatabaseLib::Database database;
+			database.enableSlowOperationLog("slow.log", 0);
+			database.enableLockProfiler(true);
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+			database.getRowByKey("clients", { {"emailKey", "mary@mail.com"} }, connection);
+
+			json profile = database.getLockProfile();
+			database.disableSlowOperationLog();
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			std::vector<json> entries;
+			std::ifstream slowLog("slow.log");
+			std::string line;
+			while (std::getline(slowLog, line))
+			{
+				entries.push_back(json::parse(line));
+			}
+			slowLog.close();
+			std::remove("slow.log");
+
+			auto lookup = std::find_if(entries.begin(), entries.end(),
+				[](const json& entry) { return entry["operation"] == "getRowByKey"; });
+			Assert::IsTrue(lookup != entries.end());
+			Assert::AreEqual(std::string("clients"), (*lookup)["table"].get<std::string>());
+			Assert::AreEqual(std::string("emailKey"), (*lookup)["key"].get<std::string>());
+			Assert::IsTrue((*lookup)["lockHoldUs"].get<std::uint64_t>() <= (*lookup)["durationUs"].get<std::uint64_t>());
+			Assert::AreEqual(4, profile["holdByOperation"]["appendRow"]["count"].get<int>());
+			Assert::IsTrue(profile["holder"].is_null());
+		}
+
+		TEST_METHOD(UpdateRows)
+		{
+			for (std::string engine : { "file", "log" })
+			{
+				DatabaseLib::Database database;
+				DatabaseLib::Connection connection = database.connect();
+				json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+				database.createTable("clients", keys, { {"engine", engine} }, connection);
+				database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+				database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+				database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+				database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+
+				database.getRowByKey("clients", { {"emailKey", "jh@mail.com"} }, connection);
+				database.updateRow("clients", { {"message", "hi"} }, connection);
+				json nextRow = database.getNextRow("clients", connection);
+				database.getRowByKey("clients", { {"emailKey", "mary@mail.com"} }, connection);
+				database.updateRow("clients", { {"message", "hello again, Mary, this message no longer fits"} }, connection);
+				database.updateRow("clients", { {"email", "maria@mail.com"} }, connection);
+				database.upsert("clients", { {"idNameKey", {{"id", 3}, {"name", "Alex"}}} }, { {"message", "bye, Alex"} }, connection);
+				database.upsert("clients", { {"emailKey", {{"email", "bob@mail.com"}}}, { "idNameKey", {{"id", 4}, {"name", "Bob"}} } }, { {"message", "hello, Bob"} }, connection);
+				database.getRowByKey("clients", { {"emailKey", "j23@mail.com"} }, connection);
+				database.removeRow("clients", connection);
+
+				json john = database.getRowByKey("clients", { {"emailKey", "jh@mail.com"} }, connection);
+				json maria = database.getRowByKey("clients", { {"idNameKey", {{"id", 2}, {"name", "Mary"}}} }, connection);
+				json alex = database.getRowByKey("clients", { {"emailKey", "alex@mail.com"} }, connection);
+				json bob = database.getRowByKey("clients", { {"emailKey", "bob@mail.com"} }, connection);
+				json found = database.find("clients", { {"message", "hello again, Mary, this message no longer fits"} }, json::array(), 0, connection);
+				bool isMaryFound = true;
+				try
+				{
+					database.getRowByKey("clients", { {"emailKey", "mary@mail.com"} }, connection);
+				}
+				catch (DatabaseLib::DatabaseException ex)
+				{
+					isMaryFound = ex.getErrorNumber() != DatabaseLib::ErrorCode::KEY_VALUE_NOT_FOUND;
+				}
+				database.reorganizeTable("clients", connection);
+				DatabaseLib::Offset rowCount = database.count("clients", "emailKey", connection);
+				json reorganized = database.getRowByKey("clients", { {"emailKey", "maria@mail.com"} }, connection);
+
+				database.removeTable("clients", connection);
+				database.disconnect(connection);
+
+				Assert::AreEqual(std::string("hello, Mary"), nextRow["message"].get<std::string>());
+				Assert::AreEqual(std::string("hi"), john["message"].get<std::string>());
+				Assert::AreEqual(std::string("maria@mail.com"), maria["email"].get<std::string>());
+				Assert::AreEqual(std::string("bye, Alex"), alex["message"].get<std::string>());
+				Assert::AreEqual(std::string("hello, Bob"), bob["message"].get<std::string>());
+				Assert::AreEqual((size_t)1, found.size());
+				Assert::IsFalse(isMaryFound);
+				Assert::AreEqual((DatabaseLib::Offset)4, rowCount);
+				Assert::AreEqual(std::string("Mary"), reorganized["name"].get<std::string>());
+			}
+		}
+
+		TEST_METHOD(UpdateKeyKeepsOtherCursors)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			DatabaseLib::Connection reader = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "ann@mail.com"}}},  { "idNameKey", {{"id", 0}, {"name", "Ann"}} } }, { {"message", "hello, Ann"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+
+			// The reader stands on the second John while the first one moves to
+			// another key value.
+			database.getRowByKey("clients", { {"idNameKey", {{"id", 1}, {"name", "John"}}} }, reader);
+			database.getNextRow("clients", reader);
+			database.getRowByKey("clients", { {"emailKey", "jh@mail.com"} }, connection);
+			database.updateRow("clients", { {"name", "Johnny"} }, connection);
+			json beforeJohn = database.getPrevRow("clients", reader);
+
+			// The reader stands on Alex, whose whole key value goes away.
+			database.getRowByKey("clients", { {"idNameKey", {{"id", 3}, {"name", "Alex"}}} }, reader);
+			database.getRowByKey("clients", { {"emailKey", "alex@mail.com"} }, connection);
+			database.updateRow("clients", { {"id", 5} }, connection);
+			json afterMary = database.getNextRow("clients", reader);
+
+			database.removeTable("clients", connection);
+			database.disconnect(reader);
+			database.disconnect(connection);
+
+			Assert::AreEqual(std::string("hello, Ann"), beforeJohn["message"].get<std::string>());
+			Assert::AreEqual(5, afterMary["id"].get<int>());
+		}
+
+		TEST_METHOD(SplitScan)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, json::object(), connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+
+			std::vector<DatabaseLib::CursorId> parts = database.splitScan("clients", "idNameKey", 3, connection);
+			std::vector<std::string> splitMessages;
+			for (DatabaseLib::CursorId part : parts)
+			{
+				try
+				{
+					while (true)
+					{
+						splitMessages.push_back(database.fetchRow(part, connection)["message"].get<std::string>());
+					}
+				}
+				catch (DatabaseLib::DatabaseException ex)
+				{
+					Assert::IsTrue(ex.getErrorNumber() == DatabaseLib::ErrorCode::NO_MORE_DATA_AVAILABLE);
+				}
+			}
+			std::sort(splitMessages.begin(), splitMessages.end());
+
+			DatabaseLib::CursorId cursor = database.openCursor("clients", "emailKey", connection);
+			json first = database.fetchRow(cursor, connection);
+			database.getRowByKey("clients", { {"emailKey", "j23@mail.com"} }, connection);
+			database.removeRow("clients", connection);
+			json second = database.fetchRow(cursor, connection);
+			json third = database.fetchRow(cursor, connection);
+			bool isEnded = false;
+			try
+			{
+				database.fetchRow(cursor, connection);
+			}
+			catch (DatabaseLib::DatabaseException ex)
+			{
+				isEnded = ex.getErrorNumber() == DatabaseLib::ErrorCode::NO_MORE_DATA_AVAILABLE;
+			}
+			database.closeCursor(cursor, connection);
+			bool isClosed = false;
+			try
+			{
+				database.fetchRow(cursor, connection);
+			}
+			catch (DatabaseLib::DatabaseException ex)
+			{
+				isClosed = ex.getErrorNumber() == DatabaseLib::ErrorCode::CURSOR_NOT_OPENED;
+			}
+
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			Assert::AreEqual((size_t)3, parts.size());
+			Assert::AreEqual((size_t)4, splitMessages.size());
+			Assert::AreEqual(std::string("bye, John"), splitMessages[0]);
+			Assert::AreEqual(std::string("hello, Mary"), splitMessages[3]);
+			Assert::AreEqual(std::string("hello, Alex"), first["message"].get<std::string>());
+			Assert::AreEqual(std::string("hello, John"), second["message"].get<std::string>());
+			Assert::AreEqual(std::string("hello, Mary"), third["message"].get<std::string>());
+			Assert::IsTrue(isEnded);
+			Assert::IsTrue(isClosed);
+		}
+
+		TEST_METHOD(PagedScan)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, { {"engine", "log"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+
+			json firstPage = database.getPage("clients", "emailKey", 2, "", connection);
+			json firstJohn = database.getPage("clients", "idNameKey", 1, "", connection);
+			json secondJohn = database.getPage("clients", "idNameKey", 1, firstJohn["continuationToken"], connection);
+
+			DatabaseLib::Database reopened;
+			DatabaseLib::Connection reopenedConnection = reopened.connect();
+			json secondPage = reopened.getPage("clients", "emailKey", 2, firstPage["continuationToken"], reopenedConnection);
+			reopened.getRowByKey("clients", { {"emailKey", "jh@mail.com"} }, reopenedConnection);
+			reopened.removeRow("clients", reopenedConnection);
+			json afterRemoval = reopened.getPage("clients", "emailKey", 2, firstPage["continuationToken"], reopenedConnection);
+			bool isRejected = false;
+			try
+			{
+				reopened.getPage("clients", "idNameKey", 2, firstPage["continuationToken"], reopenedConnection);
+			}
+			catch (DatabaseLib::DatabaseException ex)
+			{
+				isRejected = ex.getErrorNumber() == DatabaseLib::ErrorCode::INVALID_CONTINUATION_TOKEN;
+			}
+
+			reopened.removeTable("clients", reopenedConnection);
+			reopened.disconnect(reopenedConnection);
+			database.disconnect(connection);
+
+			Assert::AreEqual((size_t)2, firstPage["rows"].size());
+			Assert::AreEqual(std::string("hello, Alex"), firstPage["rows"][0]["message"].get<std::string>());
+			Assert::AreEqual(std::string("bye, John"), firstPage["rows"][1]["message"].get<std::string>());
+			Assert::AreEqual(std::string("hello, John"), firstJohn["rows"][0]["message"].get<std::string>());
+			Assert::AreEqual(std::string("bye, John"), secondJohn["rows"][0]["message"].get<std::string>());
+			Assert::AreEqual((size_t)2, secondPage["rows"].size());
+			Assert::AreEqual(std::string("hello, John"), secondPage["rows"][0]["message"].get<std::string>());
+			Assert::AreEqual(std::string("hello, Mary"), secondPage["rows"][1]["message"].get<std::string>());
+			Assert::AreEqual(std::string(""), secondPage["continuationToken"].get<std::string>());
+			Assert::AreEqual((size_t)1, afterRemoval["rows"].size());
+			Assert::AreEqual(std::string("hello, Mary"), afterRemoval["rows"][0]["message"].get<std::string>());
+			Assert::IsTrue(isRejected);
+		}
+
+		TEST_METHOD(MemoryStorageTables)
+		{
+			auto storage = std::make_shared<DatabaseLib::MemoryStorage>();
+			{
+				DatabaseLib::Database database(storage);
+				DatabaseLib::Connection connection = database.connect();
+				json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+				database.createTable("clients", keys, { {"engine", "log"} }, connection);
+				database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+				database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+				database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+				database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+				database.getRowByKey("clients", { {"emailKey", "j23@mail.com"} }, connection);
+				database.removeRow("clients", connection);
+				database.getRowByKey("clients", { {"emailKey", "mary@mail.com"} }, connection);
+				database.updateRow("clients", { {"message", "hello again, Mary, this message no longer fits"} }, connection);
+				database.reorganizeTable("clients", connection);
+				database.disconnect(connection);
+			}
+
+			DatabaseLib::Database reopened(storage);
+			DatabaseLib::Connection connection = reopened.connect();
+			json mary = reopened.getRowByKey("clients", { {"emailKey", "mary@mail.com"} }, connection);
+			json found = reopened.find("clients", { {"message", {{"$contains", "hello"}}} }, json::array(), 0, connection);
+			DatabaseLib::Offset rowCount = reopened.count("clients", "idNameKey", connection);
+			bool isOnDisk = std::filesystem::exists("clients.txt") || std::filesystem::exists("clients_emailKey.json");
+			reopened.removeTable("clients", connection);
+			reopened.disconnect(connection);
+
+			Assert::AreEqual(std::string("hello again, Mary, this message no longer fits"), mary["message"].get<std::string>());
+			Assert::AreEqual((size_t)3, found.size());
+			Assert::AreEqual((DatabaseLib::Offset)3, rowCount);
+			Assert::IsFalse(isOnDisk);
+			Assert::IsFalse(storage->exists("clients.txt"));
+		}
+
+		TEST_METHOD(ChangeStreamReplica)
+		{
+			std::filesystem::create_directories("replica");
+			DatabaseLib::Database leader;
+			DatabaseLib::Database follower(std::make_shared<DatabaseLib::FileStorage>("replica"));
+			DatabaseLib::Connection connection = leader.connect();
+			DatabaseLib::Connection followerConnection = follower.connect();
+			DatabaseLib::FileStorage leaderFiles;
+			DatabaseLib::ChangeStream changes(leaderFiles, "changes.log");
+			leader.enableChangeStream("changes.log");
+			unsigned notified = 0;
+			std::uint64_t subscription = leader.subscribe([&](const json&) { notified++; });
+
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			leader.createTable("clients", keys, json::object(), connection);
+			leader.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			leader.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			leader.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			leader.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+			follower.applyChanges(changes.read(follower.getAppliedSequence(), 100), followerConnection);
+			DatabaseLib::Offset firstCount = follower.count("clients", "emailKey", followerConnection);
+
+			leader.getRowByKey("clients", { {"idNameKey", {{"id", 1}, {"name", "John"}}} }, connection);
+			if (leader.getNextRow("clients", connection)["message"] != "bye, John")
+			{
+				leader.getPrevRow("clients", connection);
+			}
+			leader.removeRow("clients", connection);
+			leader.getRowByKey("clients", { {"emailKey", "mary@mail.com"} }, connection);
+			leader.updateRow("clients", { {"message", "hello again, Mary"} }, connection);
+			leader.upsert("clients", { {"emailKey", {{"email", "bob@mail.com"}}}, { "idNameKey", {{"id", 4}, {"name", "Bob"}} } }, { {"message", "hello, Bob"} }, connection);
+			leader.unsubscribe(subscription);
+			leader.addKey("clients", { {"messageKey", {"message"}} }, json::array(), connection);
+			json pending = leader.readChanges(follower.getAppliedSequence(), 100);
+			follower.applyChanges(pending, followerConnection);
+			std::uint64_t appliedSequence = follower.applyChanges(pending, followerConnection);
+
+			bool isJohnFound = true;
+			try
+			{
+				follower.getRowByKey("clients", { {"emailKey", "j23@mail.com"} }, followerConnection);
+			}
+			catch (DatabaseLib::DatabaseException ex)
+			{
+				isJohnFound = ex.getErrorNumber() != DatabaseLib::ErrorCode::KEY_VALUE_NOT_FOUND;
+			}
+			json mary = follower.getRowByKey("clients", { {"messageKey", "hello again, Mary"} }, followerConnection);
+			json bob = follower.getRowByKey("clients", { {"emailKey", "bob@mail.com"} }, followerConnection);
+			DatabaseLib::Offset rowCount = follower.count("clients", "idNameKey", followerConnection);
+			follower.disconnect(followerConnection);
+
+			DatabaseLib::Database reopened(std::make_shared<DatabaseLib::FileStorage>("replica"));
+			DatabaseLib::Connection reopenedConnection = reopened.connect();
+			leader.removeTable("clients", connection);
+			reopened.applyChanges(changes.read(reopened.getAppliedSequence(), 100), reopenedConnection);
+			bool isRemoved = !std::filesystem::exists("replica/clients.txt");
+			reopened.disconnect(reopenedConnection);
+			leader.disableChangeStream();
+			leader.disconnect(connection);
+			std::filesystem::remove_all("replica");
+			std::filesystem::remove("changes.log");
+
+			Assert::AreEqual((DatabaseLib::Offset)4, firstCount);
+			Assert::IsFalse(isJohnFound);
+			Assert::AreEqual(std::string("mary@mail.com"), mary["email"].get<std::string>());
+			Assert::AreEqual(std::string("hello, Bob"), bob["message"].get<std::string>());
+			Assert::AreEqual((DatabaseLib::Offset)4, rowCount);
+			Assert::AreEqual((std::uint64_t)9, appliedSequence);
+			Assert::AreEqual(8u, notified);
+			Assert::IsTrue(isRemoved);
+		}
+
+		TEST_METHOD(ChangeStreamReplicaRecovery)
+		{
+			std::filesystem::create_directories("replica");
+			DatabaseLib::Database leader;
+			DatabaseLib::Connection connection = leader.connect();
+			leader.enableChangeStream("changes.log");
+			json keys = { {"emailKey", {"email"}} };
+			leader.createTable("clients", keys, json::object(), connection);
+			leader.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}} }, { {"message", "hello, John"} }, connection);
+			leader.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}} }, { {"message", "hello, Mary"} }, connection);
+			json changes = leader.readChanges(0, 100);
+
+			// The replica stops after appending John's row but before recording it.
+			{
+				DatabaseLib::Database follower(std::make_shared<DatabaseLib::FileStorage>("replica"));
+				DatabaseLib::Connection followerConnection = follower.connect();
+				follower.applyChanges(json::array({ changes[0], changes[1] }), followerConnection);
+				follower.disconnect(followerConnection);
+			}
+			std::ofstream("replica/replica.json") << json({ {"sequence", 1}, {"applying", {{"sequence", 2}, {"matches", 0}}} }).dump();
+
+			DatabaseLib::Database reopened(std::make_shared<DatabaseLib::FileStorage>("replica"));
+			DatabaseLib::Connection reopenedConnection = reopened.connect();
+			std::vector<std::thread> appliers;
+			for (int i = 0; i < 2; i++)
+			{
+				appliers.emplace_back([&]() { reopened.applyChanges(changes, reopenedConnection); });
+			}
+			for (auto& applier : appliers)
+			{
+				applier.join();
+			}
+			DatabaseLib::Offset rowCount = reopened.count("clients", "emailKey", reopenedConnection);
+
+			DatabaseLib::ErrorCode unknownError = DatabaseLib::ErrorCode::NOT_FOUND;
+			try
+			{
+				reopened.applyChanges(json::array({ { {"sequence", 4}, {"operation", "truncateTable"}, {"table", "clients"} } }),
+					reopenedConnection);
+			}
+			catch (const DatabaseLib::DatabaseException& ex)
+			{
+				unknownError = ex.getErrorNumber();
+			}
+			std::uint64_t appliedSequence = reopened.getAppliedSequence();
+			reopened.disconnect(reopenedConnection);
+			leader.removeTable("clients", connection);
+			leader.disableChangeStream();
+			leader.disconnect(connection);
+			std::filesystem::remove_all("replica");
+			std::filesystem::remove("changes.log");
+
+			Assert::AreEqual((DatabaseLib::Offset)2, rowCount);
+			Assert::IsTrue(unknownError == DatabaseLib::ErrorCode::INVALID_OPTIONS);
+			Assert::AreEqual((std::uint64_t)3, appliedSequence);
+		}
+
+		TEST_METHOD(ExpiringRows)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, { {"ttl", {{"column", "expiresAt"}, {"seconds", 3600}}} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"}, {"expiresAt", 1} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"}, {"expiresAt", 1} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "aa@mail.com"}}},   { "idNameKey", {{"id", 0}, {"name", "Aaron"}} } }, { {"message", "bye, Aaron"}, {"expiresAt", 1} }, connection);
+
+			bool isMaryFound = true;
+			try
+			{
+				database.getRowByKey("clients", { {"emailKey", "mary@mail.com"} }, connection);
+			}
+			catch (DatabaseLib::DatabaseException ex)
+			{
+				isMaryFound = ex.getErrorNumber() != DatabaseLib::ErrorCode::KEY_VALUE_NOT_FOUND;
+			}
+			bool isBeforeAlexFound = true;
+			try
+			{
+				database.getRowByKey("clients", { {"emailKey", "alex@mail.com"} }, connection);
+				database.getPrevRow("clients", connection);
+			}
+			catch (DatabaseLib::DatabaseException ex)
+			{
+				isBeforeAlexFound = ex.getErrorNumber() != DatabaseLib::ErrorCode::NO_MORE_DATA_AVAILABLE;
+			}
+			database.upsert("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello again, Mary"} }, connection);
+			unsigned expiredRemovals = 0;
+			database.subscribe([&](const json& change) { expiredRemovals += change.value("isExpired", false) ? 1 : 0; });
+			json john = database.getRowInSortedTable("clients", "idNameKey", false, connection);
+			json mary = database.getNextRow("clients", connection);
+			json alex = database.getNextRow("clients", connection);
+			json found = database.find("clients", { {"message", {{"$contains", "hello"}}} }, json::array(), 0, connection);
+			json page = database.getPage("clients", "emailKey", 10, "", connection);
+			DatabaseLib::Offset countBeforeReaping = database.count("clients", "emailKey", connection);
+			DatabaseLib::Offset reaped = database.reapExpiredRows("clients", 100, connection);
+			DatabaseLib::Offset countAfterReaping = database.count("clients", "emailKey", connection);
+
+			database.appendRow("clients", { {"emailKey", {{"email", "bob@mail.com"}}}, { "idNameKey", {{"id", 4}, {"name", "Bob"}} } }, { {"message", "hello, Bob"}, {"expiresAt", 1} }, connection);
+			database.enableExpiryReaper(100, 10);
+			for (int attempt = 0; attempt < 200 && database.count("clients", "emailKey", connection) > 3; attempt++)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			database.disableExpiryReaper();
+			DatabaseLib::Offset countAfterReaper = database.count("clients", "emailKey", connection);
+			json remaining = database.getRowByKey("clients", { {"emailKey", "alex@mail.com"} }, connection);
+
+			database.createTable("sessions", { {"idKey", {"id"}} }, { {"ttl", {{"column", "expiresAt"}}} }, connection);
+			database.appendRow("sessions", { {"idKey", {{"id", 1}}} }, { {"expiresAt", 1} }, connection);
+			database.appendRow("sessions", { {"idKey", {{"id", 2}}} }, { {"expiresAt", 1} }, connection);
+			unsigned emptyErrors = 0;
+			for (bool isReversed : { false, true })
+			{
+				try
+				{
+					database.getRowInSortedTable("sessions", "idKey", isReversed, connection);
+				}
+				catch (const DatabaseLib::DatabaseException& ex)
+				{
+					emptyErrors += ex.getErrorNumber() == DatabaseLib::ErrorCode::TABLE_IS_EMPTY ? 1 : 0;
+				}
+			}
+
+			database.removeTable("sessions", connection);
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			Assert::IsFalse(isMaryFound);
+			Assert::IsFalse(isBeforeAlexFound);
+			Assert::AreEqual(std::string("hello, John"), john["message"].get<std::string>());
+			Assert::AreEqual(std::string("hello again, Mary"), mary["message"].get<std::string>());
+			Assert::AreEqual(std::string("hello, Alex"), alex["message"].get<std::string>());
+			Assert::AreEqual((size_t)3, found.size());
+			Assert::AreEqual((size_t)3, page["rows"].size());
+			Assert::AreEqual((DatabaseLib::Offset)6, countBeforeReaping);
+			Assert::AreEqual((DatabaseLib::Offset)3, reaped);
+			Assert::AreEqual((DatabaseLib::Offset)3, countAfterReaping);
+			Assert::AreEqual((DatabaseLib::Offset)3, countAfterReaper);
+			Assert::AreEqual(4u, expiredRemovals);
+			Assert::IsTrue(remaining["expiresAt"].get<double>() > 3600);
+			Assert::AreEqual(2u, emptyErrors);
+		}
+
+		TEST_METHOD(BackgroundMaintenance)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			database.enableMaintenance({ {"workers", 2}, {"bytesPerSecond", 1 << 24}, {"cpuShare", 0.5} });
+			json keys = { {"emailKey", {"email"}}, {"idNameKey", {"id", "name"}} };
+			database.createTable("clients", keys, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "jh@mail.com"}}},   { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "hello, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "j23@mail.com"}}},  { "idNameKey", {{"id", 1}, {"name", "John"}} } }, { {"message", "bye, John"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "mary@mail.com"}}}, { "idNameKey", {{"id", 2}, {"name", "Mary"}} } }, { {"message", "hello, Mary"} }, connection);
+			database.appendRow("clients", { {"emailKey", {{"email", "alex@mail.com"}}}, { "idNameKey", {{"id", 3}, {"name", "Alex"}} } }, { {"message", "hello, Alex"} }, connection);
+			auto tableSize = std::filesystem::file_size("clients.txt");
+			database.getRowByKey("clients", { {"emailKey", "j23@mail.com"} }, connection);
+			database.removeRow("clients", connection);
+			bool isRowKeptInPlace = std::filesystem::file_size("clients.txt") == tableSize;
+
+			database.createTable("events", { {"idKey", {"id"}} }, connection);
+			for (int id = 0; id < 5000; id++)
+			{
+				database.appendRow("events", { {"idKey", {{"id", id}}} }, { {"kind", "click"} }, connection);
+			}
+			for (int id = 0; id < 10; id++)
+			{
+				database.getRowByKey("events", { {"idKey", id} }, connection);
+				database.removeRow("events", connection);
+			}
+			database.scheduleCheckpoint("maintenance_checkpoint");
+			json progress = database.getMaintenanceProgress();
+			database.disableMaintenance();
+			json finished = database.getMaintenanceProgress();
+			auto logSize = std::filesystem::exists("events_idKey.log") ? std::filesystem::file_size("events_idKey.log") : 0;
+
+			DatabaseLib::Offset eventCount = 0, clientCount = 0, restoredCount = 0;
+			json mary;
+			{
+				DatabaseLib::Database reopened;
+				DatabaseLib::Connection reopenedConnection = reopened.connect();
+				eventCount = reopened.count("events", "idKey", reopenedConnection);
+				clientCount = reopened.find("clients", json::object(), json::array(), 0, reopenedConnection).size();
+				mary = reopened.getRowByKey("clients", { {"emailKey", "mary@mail.com"} }, reopenedConnection);
+				reopened.disconnect(reopenedConnection);
+			}
+			{
+				DatabaseLib::Database restored(std::make_shared<DatabaseLib::FileStorage>("maintenance_checkpoint"));
+				DatabaseLib::Connection restoredConnection = restored.connect();
+				restoredCount = restored.count("events", "idKey", restoredConnection);
+				restored.disconnect(restoredConnection);
+			}
+
+			database.removeTable("clients", connection);
+			database.removeTable("events", connection);
+			database.disconnect(connection);
+			std::filesystem::remove_all("maintenance_checkpoint");
+
+			Assert::IsTrue(isRowKeptInPlace);
+			Assert::IsTrue(progress["enabled"].get<bool>());
+			Assert::IsFalse(finished["enabled"].get<bool>());
+			Assert::IsTrue(logSize < 1000);
+			Assert::AreEqual((DatabaseLib::Offset)4990, eventCount);
+			Assert::AreEqual((DatabaseLib::Offset)3, clientCount);
+			Assert::AreEqual(std::string("hello, Mary"), mary["message"].get<std::string>());
+			Assert::AreEqual((DatabaseLib::Offset)4990, restoredCount);
+		}
+
+		TEST_METHOD(BackgroundRewriteWithWrites)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			// The rewrite copies a chunk and then waits for the disk budget, so
+			// the writes below land between its chunks.
+			database.enableMaintenance({ {"workers", 1}, {"bytesPerSecond", 1 << 20}, {"cpuShare", 0} });
+			database.createTable("events", { {"idKey", {"id"}} }, connection);
+			std::string payload(80, 'x');
+			for (int id = 0; id < 40000; id++)
+			{
+				database.appendRow("events", { {"idKey", {{"id", id}}} }, { {"kind", "click"}, {"payload", payload} }, connection);
+			}
+			auto tableSize = std::filesystem::file_size("events.txt");
+			for (int id = 0; id < 24000; id++)
+			{
+				database.getRowByKey("events", { {"idKey", id} }, connection);
+				database.removeRow("events", connection);
+			}
+			bool isRewriteRunning = false;
+			for (int attempt = 0; attempt < 400 && !isRewriteRunning; attempt++)
+			{
+				json progress = database.getMaintenanceProgress();
+				for (auto& task : progress["running"])
+				{
+					isRewriteRunning = isRewriteRunning || (task["name"] == "rewriteTable events"
+						&& task["done"].get<DatabaseLib::Offset>() > 0 && task["done"] < task["total"]);
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			}
+			database.getRowByKey("events", { {"idKey", 24000} }, connection);
+			database.updateRow("events", { {"kind", "view"} }, connection);
+			database.getRowByKey("events", { {"idKey", 24001} }, connection);
+			database.removeRow("events", connection);
+			database.appendRow("events", { {"idKey", {{"id", 50000}}} }, { {"kind", "click"}, {"payload", payload} }, connection);
+			database.disableMaintenance();
+
+			DatabaseLib::Offset eventCount = database.count("events", "idKey", connection);
+			DatabaseLib::Offset clickCount = database.find("events", { {"kind", "click"} }, { "id" }, 0, connection).size();
+			json viewed = database.getRowByKey("events", { {"idKey", 24000} }, connection);
+			json appended = database.getRowByKey("events", { {"idKey", 50000} }, connection);
+			auto rewrittenSize = std::filesystem::file_size("events.txt");
+			DatabaseLib::Offset reopenedCount = 0;
+			{
+				DatabaseLib::Database reopened;
+				DatabaseLib::Connection reopenedConnection = reopened.connect();
+				reopenedCount = reopened.find("events", json::object(), json::array(), 0, reopenedConnection).size();
+				reopened.disconnect(reopenedConnection);
+			}
+			database.removeTable("events", connection);
+			database.disconnect(connection);
+
+			Assert::IsTrue(isRewriteRunning);
+			Assert::IsTrue(rewrittenSize * 2 < tableSize);
+			Assert::AreEqual((DatabaseLib::Offset)16000, eventCount);
+			Assert::AreEqual((DatabaseLib::Offset)15999, clickCount);
+			Assert::AreEqual(std::string("view"), viewed["kind"].get<std::string>());
+			Assert::AreEqual(50000, appended["id"].get<int>());
+			Assert::AreEqual((DatabaseLib::Offset)16000, reopenedCount);
+		}
+
+		TEST_METHOD(TypedTableRows)
+		{
+			DatabaseLib::Database database;
+			DatabaseLib::Connection connection = database.connect();
+			DatabaseLib::TypedTable<Client, EmailKey, IdNameKey> clients(database, "clients", connection);
+			clients.create();
+			clients.insert({ 1, "John", "jh@mail.com", "hello, John" });
+			clients.insert({ 1, "John", "j23@mail.com", "bye, John" });
+			clients.insert({ 2, "Mary", "mary@mail.com", "hello, Mary" });
+			clients.insert({ 3, "Alex", "alex@mail.com", "hello, Alex" });
+
+			std::optional<Client> mary = clients.get<EmailKey>({ "mary@mail.com" });
+			std::optional<Client> missing = clients.get<EmailKey>({ "bob@mail.com" });
+			std::optional<Client> first = clients.first<IdNameKey>();
+			std::optional<Client> second = clients.next();
+			DatabaseLib::Offset rowCount = clients.count<IdNameKey>();
+			json row = database.getRowByKey("clients", { {"idNameKey", {{"id", 3}, {"name", "Alex"}}} }, connection);
+
+			database.removeTable("clients", connection);
+			database.disconnect(connection);
+
+			Assert::IsTrue(mary.has_value());
+			Assert::AreEqual(2, mary->id);
+			Assert::AreEqual(std::string("hello, Mary"), mary->message);
+			Assert::IsFalse(missing.has_value());
+			Assert::AreEqual(std::string("hello, John"), first->message);
+			Assert::AreEqual(std::string("bye, John"), second->message);
+			Assert::AreEqual((DatabaseLib::Offset)4, rowCount);
+			Assert::AreEqual(std::string("alex@mail.com"), row["email"].get<std::string>());
+		}
+
+		TEST_METHOD(TypedKeyOrder)
+		{
+			std::vector<Client> rows = { { 1, "John" }, { 2, "Alex" }, { 1, "Alex" }, { 10, "Bob" }, { 1, "John" } };
+			DatabaseLib::JsonComparator jsonLess;
+			NameIdKey::Less typedLess;
+			NameIdKey::Index index;
+			for (size_t i = 0; i < rows.size(); i++)
+			{
+				index[NameIdKey::extract(rows[i])].push_back(i);
+				for (auto& other : rows)
+				{
+					Assert::AreEqual(jsonLess(NameIdKey::fromRow(rows[i]), NameIdKey::fromRow(other)),
+						typedLess(NameIdKey::extract(rows[i]), NameIdKey::extract(other)));
+				}
+			}
+
+			Assert::AreEqual((size_t)4, index.size());
+			Assert::AreEqual(std::string("Alex"), std::get<0>(index.begin()->first));
+			Assert::AreEqual(10, std::get<1>(index.rbegin()->first));
+			Assert::IsTrue(std::vector<DatabaseLib::Offset>({ 0, 4 }) == index[NameIdKey::Value("John", 1)]);
+		}
+
+		TEST_METHOD(EncodeOffsetsAbove4GB)
+		{
+			std::vector<DatabaseLib::Offset> offsets = { 5000000000ull, 12ull, 4294967296ull, 18000000000000ull };
+
+			std::vector<std::uint8_t> encoded = DatabaseLib::OffsetsCodec::encode(offsets);
+			std::vector<DatabaseLib::Offset> decoded = DatabaseLib::OffsetsCodec::decode(encoded);
+
+			Assert::IsTrue(offsets == decoded);
+		}
+
 		TEST_METHOD(MultithreadedRead)
 		{
 			DatabaseLib::Database database;